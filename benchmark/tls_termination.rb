@@ -0,0 +1,80 @@
+#
+# Benchmark of TLS termination in a running OverSIP: TLS connections per second
+# and per-message latency (OPTIONS request to 200/4XX response round trip over
+# an established TLS connection).
+#
+# Run it against OverSIP with sip[use_tls_tunnel] disabled (in-process TLS) and
+# enabled (Stud tunnel) and compare the results.
+#
+# Usage:
+#   ruby benchmark/tls_termination.rb HOST PORT [NUM_CONNECTIONS] [NUM_MESSAGES]
+#
+
+require "socket"
+require "openssl"
+require "securerandom"
+
+
+host = ARGV[0] or abort "Usage: #{$0} HOST PORT [NUM_CONNECTIONS] [NUM_MESSAGES]"
+port = (ARGV[1] or abort "Usage: #{$0} HOST PORT [NUM_CONNECTIONS] [NUM_MESSAGES]").to_i
+num_connections = (ARGV[2] || 500).to_i
+num_messages = (ARGV[3] || 5000).to_i
+
+ssl_context = ::OpenSSL::SSL::SSLContext.new
+ssl_context.verify_mode = ::OpenSSL::SSL::VERIFY_NONE
+
+
+def now
+  ::Process.clock_gettime ::Process::CLOCK_MONOTONIC
+end
+
+def connect host, port, ssl_context
+  tcp = ::TCPSocket.new host, port
+  tcp.setsockopt ::Socket::IPPROTO_TCP, ::Socket::TCP_NODELAY, 1
+  ssl = ::OpenSSL::SSL::SSLSocket.new tcp, ssl_context
+  ssl.sync_close = true
+  ssl.connect
+  ssl
+end
+
+def options_request host, port, n
+  branch = "z9hG4bK#{::SecureRandom.hex(8)}"
+  "OPTIONS sip:#{host}:#{port};transport=tls SIP/2.0\r\n" \
+  "Via: SIP/2.0/TLS 127.0.0.1:5099;branch=#{branch};rport\r\n" \
+  "Max-Forwards: 70\r\n" \
+  "From: <sip:bench@oversip.invalid>;tag=#{::SecureRandom.hex(4)}\r\n" \
+  "To: <sip:#{host}>\r\n" \
+  "Call-ID: #{::SecureRandom.hex(12)}\r\n" \
+  "CSeq: #{n} OPTIONS\r\n" \
+  "Content-Length: 0\r\n\r\n"
+end
+
+# Read a full SIP response (no body expected).
+def read_response ssl
+  response = ""
+  response << ssl.readpartial(4096)  until response.include? "\r\n\r\n"
+  response
+end
+
+
+# TLS handshakes.
+start = now
+num_connections.times { connect(host, port, ssl_context).close }
+elapsed = now - start
+printf "TLS connections:   %d in %.3f s => %.1f connections/s\n", num_connections, elapsed, num_connections / elapsed
+
+# Per-message latency.
+ssl = connect host, port, ssl_context
+latencies = []
+num_messages.times do |n|
+  t = now
+  ssl.write options_request(host, port, n + 1)
+  read_response ssl
+  latencies << (now - t) * 1000
+end
+ssl.close
+
+latencies.sort!
+printf "OPTIONS latency:   %d messages, avg %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+       num_messages, latencies.inject(:+) / latencies.size, latencies[latencies.size / 2],
+       latencies[(latencies.size * 0.99).to_i - 1], latencies.last
@@ -0,0 +1,59 @@
+#
+# Benchmark of OverSIP::WebSocket::FramingUtils.unmask (new String),
+# OverSIP::WebSocket::FramingUtils.unmask! (in place) and the single pass
+# Utf8Validator#unmask_and_validate! (against unmask! + validate) across
+# payload sizes.
+#
+# Usage (after `rake compile`):
+#   ruby -Ilib benchmark/ws_unmask.rb
+#
+
+require "benchmark"
+require "securerandom"
+require "oversip/websocket/ws_framing_utils.#{RbConfig::CONFIG["DLEXT"]}"
+
+
+SIZES = [ 64, 256, 1024, 4096, 16384, 65536 ]
+MASK = ::SecureRandom.random_bytes 4
+VALIDATOR = ::OverSIP::WebSocket::FramingUtils::Utf8Validator.allocate
+# Process roughly the same amount of bytes for every payload size.
+TOTAL_BYTES = 256 * 1024 * 1024
+
+
+puts "Processing #{TOTAL_BYTES / (1024 * 1024)} MB per payload size"
+puts
+
+::Benchmark.bm(32) do |bm|
+  SIZES.each do |size|
+    payload = ::SecureRandom.random_bytes size
+    # Masked ASCII text payload (as SIP messages usually are). It is masked
+    # again after every iteration.
+    text = ::OverSIP::WebSocket::FramingUtils.unmask ("a" * size).force_encoding(::Encoding::BINARY), MASK
+    iterations = TOTAL_BYTES / size
+
+    bm.report("unmask   #{size} B") do
+      iterations.times { ::OverSIP::WebSocket::FramingUtils.unmask payload, MASK }
+    end
+
+    bm.report("unmask!  #{size} B") do
+      iterations.times { ::OverSIP::WebSocket::FramingUtils.unmask! payload, MASK }
+    end
+
+    bm.report("unmask! + validate  #{size} B") do
+      iterations.times do
+        VALIDATOR.reset
+        ::OverSIP::WebSocket::FramingUtils.unmask! text, MASK
+        VALIDATOR.validate(text) or raise "unexpected invalid UTF-8"
+        ::OverSIP::WebSocket::FramingUtils.unmask! text, MASK
+      end
+    end
+
+    bm.report("unmask_and_validate!  #{size} B") do
+      iterations.times do
+        VALIDATOR.reset
+        VALIDATOR.unmask_and_validate!(text, MASK) or raise "unexpected invalid UTF-8"
+        ::OverSIP::WebSocket::FramingUtils.unmask! text, MASK
+      end
+    end
+  end
+end
@@ -233,6 +233,9 @@ end
 
 
 # This method is called when a client initiates a SIP TLS handshake.
+# When TLS is terminated by a proxy sending the HAProxy Protocol v2 header with SSL
+# information, pems is empty and connection.haproxy_protocol_tlvs tells whether
+# the client certificate was verified by the proxy (:ssl_client_cert_verified, :ssl_cn).
 def (OverSIP::SipEvents).on_client_tls_handshake connection, pems
 
   log_info "validating TLS connection from IP #{connection.remote_ip} and port #{connection.remote_port}"
@@ -298,6 +301,7 @@ end
 
 
 # This method is called when a client initiates a WebSocket TLS handshake.
+# See the note about TLS proxies in OverSIP::SipEvents.on_client_tls_handshake.
 def (OverSIP::WebSocketEvents).on_client_tls_handshake connection, pems
 
   log_info "validating TLS connection from IP #{connection.remote_ip} and port #{connection.remote_port}"
@@ -0,0 +1,371 @@
+#include <ruby.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include "ext_help.h"
+
+
+/*
+ * SIP message capture into a memory-mapped ring file.
+ *
+ * The file starts with a capture_file_header followed by the ring data area in
+ * which every captured message is stored as a HEP3 (Homer Encapsulation Protocol
+ * version 3) packet. When a packet does not fit at the end of the data area four
+ * zero bytes are written (if room) and the ring wraps to the beginning. The
+ * header keeps the offset in which the next packet will be written, so readers
+ * find the oldest packet by looking for the first "HEP3" packet after it.
+ *
+ * Capturing a message just costs a few memcpy() into the mapped memory.
+ */
+
+
+#define CAPTURE_MAGIC "OVSCAP01"
+#define CAPTURE_MIN_DATA_SIZE 65536
+
+#define HEP3_MAX_LEN 65535
+#define HEP3_HEADER_LEN 6
+#define HEP3_CHUNK_HEADER_LEN 6
+/* Length of all the chunks but the payload with IPv6 addresses. */
+#define HEP3_MAX_CHUNKS_LEN ( (HEP3_CHUNK_HEADER_LEN * 9) + 1 + 1 + 16 + 16 + 2 + 2 + 4 + 4 + 1 )
+
+#define HEP3_PROTOCOL_TYPE_SIP 1
+
+
+struct capture_file_header {
+  char magic[8];
+  uint32_t header_size;
+  uint32_t reserved;
+  uint64_t data_size;
+  /* Offset (within the data area) for the next packet. */
+  uint64_t head;
+  /* Number of times the ring has wrapped. */
+  uint64_t wraps;
+  /* Number of captured messages. */
+  uint64_t num_packets;
+  char padding[16];
+};
+
+
+static VALUE mOverSIP;
+static VALUE mCapture;
+
+static VALUE symbol_udp;
+
+static struct capture_file_header *capture_header = NULL;
+static char *capture_data = NULL;
+static size_t capture_map_size = 0;
+
+static unsigned long num_truncated = 0;
+
+
+
+static char *put_chunk(char *p, uint16_t type, const void *value, uint16_t len)
+{
+  uint16_t n;
+
+  n = 0;  /* Vendor id: generic chunk. */
+  memcpy(p, &n, 2);
+  n = htons(type);
+  memcpy(p + 2, &n, 2);
+  n = htons(len + HEP3_CHUNK_HEADER_LEN);
+  memcpy(p + 4, &n, 2);
+  memcpy(p + HEP3_CHUNK_HEADER_LEN, value, len);
+
+  return p + HEP3_CHUNK_HEADER_LEN + len;
+}
+
+
+static char *put_chunk_uint8(char *p, uint16_t type, uint8_t value)
+{
+  return put_chunk(p, type, &value, 1);
+}
+
+
+static char *put_chunk_uint16(char *p, uint16_t type, uint16_t value)
+{
+  value = htons(value);
+  return put_chunk(p, type, &value, 2);
+}
+
+
+static char *put_chunk_uint32(char *p, uint16_t type, uint32_t value)
+{
+  value = htonl(value);
+  return put_chunk(p, type, &value, 4);
+}
+
+
+static void capture_unmap(void)
+{
+  if (capture_header) {
+    munmap(capture_header, capture_map_size);
+    capture_header = NULL;
+    capture_data = NULL;
+    capture_map_size = 0;
+  }
+}
+
+
+
+/*
+ * Whether the open file is a capture file with a data area of data_size bytes.
+ */
+static int capture_file_is_valid(int fd, size_t data_size)
+{
+  struct capture_file_header header;
+  struct stat st;
+
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size != sizeof(struct capture_file_header) + data_size)
+    return 0;
+
+  if (pread(fd, &header, sizeof(header), 0) != sizeof(header))
+    return 0;
+
+  return memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) == 0 &&
+         header.header_size == sizeof(struct capture_file_header) &&
+         header.data_size == data_size &&
+         header.head <= data_size;
+}
+
+
+
+/*
+ * Ruby functions.
+ */
+
+/*
+ * Opens the capture file with a data area of size bytes and maps it into memory.
+ * An existing capture file with the same size is kept, so the ring goes on after
+ * the messages captured before a restart. Any other existing file is renamed to
+ * "<path>.old" and a new capture file is created. Returns true if the existing
+ * capture file is kept.
+ */
+VALUE Capture_open(VALUE self, VALUE path, VALUE size)
+{
+  TRACE();
+  struct capture_file_header *header;
+  struct stat st;
+  VALUE old_path;
+  size_t data_size;
+  char *cpath;
+  int fd, keep;
+
+  data_size = NUM2SIZET(size);
+  if (data_size < CAPTURE_MIN_DATA_SIZE)
+    rb_raise(rb_eArgError, "capture file size must be at least %d bytes", CAPTURE_MIN_DATA_SIZE);
+
+  capture_unmap();
+
+  cpath = StringValueCStr(path);
+
+  if ((fd = open(cpath, O_RDWR | O_CREAT, 0640)) < 0)
+    rb_sys_fail(cpath);
+
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    rb_sys_fail(cpath);
+  }
+
+  keep = capture_file_is_valid(fd, data_size);
+
+  if (! keep && st.st_size > 0) {
+    close(fd);
+    old_path = rb_str_plus(path, rb_str_new2(".old"));
+    if (rename(cpath, StringValueCStr(old_path)) < 0)
+      rb_sys_fail(cpath);
+    if ((fd = open(cpath, O_RDWR | O_CREAT | O_TRUNC, 0640)) < 0)
+      rb_sys_fail(cpath);
+  }
+
+  if (! keep && ftruncate(fd, sizeof(struct capture_file_header) + data_size) < 0) {
+    close(fd);
+    rb_sys_fail(cpath);
+  }
+
+  header = mmap(NULL, sizeof(struct capture_file_header) + data_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (header == MAP_FAILED)
+    rb_sys_fail(cpath);
+
+  if (! keep) {
+    memcpy(header->magic, CAPTURE_MAGIC, sizeof(header->magic));
+    header->header_size = sizeof(struct capture_file_header);
+    header->data_size = data_size;
+    header->head = 0;
+    header->wraps = 0;
+    header->num_packets = 0;
+  }
+
+  capture_header = header;
+  capture_data = (char *)header + sizeof(struct capture_file_header);
+  capture_map_size = sizeof(struct capture_file_header) + data_size;
+
+  return keep ? Qtrue : Qfalse;
+}
+
+
+VALUE Capture_close(VALUE self)
+{
+  TRACE();
+
+  capture_unmap();
+  return Qnil;
+}
+
+
+VALUE Capture_is_open(VALUE self)
+{
+  TRACE();
+
+  return capture_header ? Qtrue : Qfalse;
+}
+
+
+/*
+ * Captures a SIP message. transport is :udp, :tcp, :tls, :ws or :wss. The
+ * message is given as a single String or as headers and body Strings (body
+ * can be nil). Returns false if the message is not captured (invalid
+ * addresses or capture not open).
+ */
+VALUE Capture_write(VALUE self, VALUE src_ip, VALUE src_port, VALUE dst_ip, VALUE dst_port, VALUE transport, VALUE msg, VALUE body)
+{
+  TRACE();
+  struct in6_addr src_addr, dst_addr;
+  struct timeval tv;
+  int family;
+  size_t addr_len, msg_len, body_len, payload_len, packet_len;
+  uint64_t head;
+  uint16_t n;
+  char *p;
+
+  if (! capture_header)
+    return Qfalse;
+
+  if (TYPE(src_ip) != T_STRING || TYPE(dst_ip) != T_STRING || TYPE(msg) != T_STRING)
+    return Qfalse;
+
+  if (inet_pton(AF_INET, StringValueCStr(src_ip), &src_addr) == 1) {
+    family = AF_INET;
+    addr_len = 4;
+  }
+  else if (inet_pton(AF_INET6, StringValueCStr(src_ip), &src_addr) == 1) {
+    family = AF_INET6;
+    addr_len = 16;
+  }
+  else
+    return Qfalse;
+
+  if (inet_pton(family, StringValueCStr(dst_ip), &dst_addr) != 1)
+    return Qfalse;
+
+  msg_len = RSTRING_LEN(msg);
+  body_len = (TYPE(body) == T_STRING) ? RSTRING_LEN(body) : 0;
+  payload_len = msg_len + body_len;
+
+  /* HEP3 packets length is a 16 bits field. */
+  if (HEP3_HEADER_LEN + HEP3_MAX_CHUNKS_LEN + HEP3_CHUNK_HEADER_LEN + payload_len > HEP3_MAX_LEN) {
+    payload_len = HEP3_MAX_LEN - HEP3_HEADER_LEN - HEP3_MAX_CHUNKS_LEN - HEP3_CHUNK_HEADER_LEN;
+    if (msg_len > payload_len)
+      msg_len = payload_len;
+    body_len = payload_len - msg_len;
+    num_truncated++;
+  }
+
+  packet_len = HEP3_HEADER_LEN + HEP3_CHUNK_HEADER_LEN * 10 + 1 + 1 + (addr_len * 2) + 2 + 2 + 4 + 4 + 1 + payload_len;
+
+  head = capture_header->head;
+  if (head + packet_len > capture_header->data_size) {
+    /* End of ring mark. */
+    if (capture_header->data_size - head >= 4)
+      memset(capture_data + head, 0, 4);
+    head = 0;
+    capture_header->wraps++;
+  }
+
+  p = capture_data + head;
+
+  memcpy(p, "HEP3", 4);
+  n = htons(packet_len);
+  memcpy(p + 4, &n, 2);
+  p += HEP3_HEADER_LEN;
+
+  gettimeofday(&tv, NULL);
+
+  p = put_chunk_uint8(p, 0x0001, family == AF_INET ? 2 : 10);
+  p = put_chunk_uint8(p, 0x0002, transport == symbol_udp ? IPPROTO_UDP : IPPROTO_TCP);
+  if (family == AF_INET) {
+    p = put_chunk(p, 0x0003, &src_addr, 4);
+    p = put_chunk(p, 0x0004, &dst_addr, 4);
+  }
+  else {
+    p = put_chunk(p, 0x0005, &src_addr, 16);
+    p = put_chunk(p, 0x0006, &dst_addr, 16);
+  }
+  p = put_chunk_uint16(p, 0x0007, (uint16_t)NUM2UINT(src_port));
+  p = put_chunk_uint16(p, 0x0008, (uint16_t)NUM2UINT(dst_port));
+  p = put_chunk_uint32(p, 0x0009, (uint32_t)tv.tv_sec);
+  p = put_chunk_uint32(p, 0x000a, (uint32_t)tv.tv_usec);
+  p = put_chunk_uint8(p, 0x000b, HEP3_PROTOCOL_TYPE_SIP);
+
+  /* Payload chunk. */
+  memset(p, 0, 2);
+  n = htons(0x000f);
+  memcpy(p + 2, &n, 2);
+  n = htons(payload_len + HEP3_CHUNK_HEADER_LEN);
+  memcpy(p + 4, &n, 2);
+  p += HEP3_CHUNK_HEADER_LEN;
+  memcpy(p, RSTRING_PTR(msg), msg_len);
+  if (body_len)
+    memcpy(p + msg_len, RSTRING_PTR(body), body_len);
+
+  capture_header->head = head + packet_len;
+  capture_header->num_packets++;
+
+  return Qtrue;
+}
+
+
+VALUE Capture_num_packets(VALUE self)
+{
+  TRACE();
+
+  return capture_header ? ULL2NUM(capture_header->num_packets) : INT2FIX(0);
+}
+
+
+VALUE Capture_num_truncated(VALUE self)
+{
+  TRACE();
+
+  return ULONG2NUM(num_truncated);
+}
+
+
+void Init_capture()
+{
+  TRACE();
+
+  mOverSIP = rb_define_module("OverSIP");
+  mCapture = rb_define_module_under(mOverSIP, "Capture");
+
+  rb_define_const(mCapture, "MAGIC", rb_obj_freeze(rb_str_new2(CAPTURE_MAGIC)));
+  rb_define_const(mCapture, "HEADER_SIZE", INT2FIX(sizeof(struct capture_file_header)));
+
+  rb_define_module_function(mCapture, "open", Capture_open, 2);
+  rb_define_module_function(mCapture, "close", Capture_close, 0);
+  rb_define_module_function(mCapture, "open?", Capture_is_open, 0);
+  rb_define_module_function(mCapture, "write", Capture_write, 7);
+  rb_define_module_function(mCapture, "num_packets", Capture_num_packets, 0);
+  rb_define_module_function(mCapture, "num_truncated", Capture_num_truncated, 0);
+
+  symbol_udp = ID2SYM(rb_intern("udp"));
+}
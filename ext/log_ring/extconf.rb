@@ -0,0 +1,5 @@
+require "mkmf"
+
+have_library("pthread") or abort "pthread library not found"
+
+create_makefile("oversip/log_ring")
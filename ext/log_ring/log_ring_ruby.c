@@ -0,0 +1,403 @@
+#include <ruby.h>
+#include <pthread.h>
+#include <signal.h>
+#include <syslog.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "ext_help.h"
+
+
+/*
+ * Asynchronous logging.
+ *
+ * The reactor thread (with the GVL held) copies raw log records (level, log_id
+ * and message) into a single-producer/single-consumer lock-free ring, and a
+ * native thread (which never touches the Ruby API) formats and sends them to
+ * syslog(3) and, in foreground mode, to stdout/stderr. When the ring is full
+ * records are dropped and a rate-limited "N log messages suppressed" summary is
+ * logged instead.
+ */
+
+
+/* Number of records in the ring (must be power of 2). */
+#define LOG_RING_SIZE 1024
+/* Max size of log_id plus message (longer messages are truncated). */
+#define LOG_RING_DATA_SIZE 4096
+/* Min interval (seconds) between "messages suppressed" summaries. */
+#define LOG_RING_SUPPRESSED_INTERVAL 1
+/* Interval (milliseconds) the idle consumer thread sleeps for. */
+#define LOG_RING_IDLE_WAIT 200
+/* Max time (milliseconds) fork() waits for the ring to get empty. */
+#define LOG_RING_FORK_MAX_WAIT 2000
+
+#define TRUNCATED_MARK "..."
+
+
+struct log_record {
+  unsigned char level;
+  unsigned char user;
+  unsigned short log_id_len;
+  unsigned int msg_len;
+  char data[LOG_RING_DATA_SIZE];
+};
+
+
+static VALUE mOverSIP;
+static VALUE mLogRing;
+
+static struct log_record ring[LOG_RING_SIZE];
+/* Written just by the producer. */
+static unsigned long ring_head = 0;
+/* Written just by the consumer. */
+static unsigned long ring_tail = 0;
+
+static unsigned long num_logged = 0;
+static unsigned long num_dropped = 0;
+/* Written just by the consumer. */
+static unsigned long num_dropped_reported = 0;
+
+static int consumer_running = 0;
+static int consumer_waiting = 0;
+static int foreground = 1;
+static pthread_t consumer_thread;
+static pthread_mutex_t consumer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t consumer_cond = PTHREAD_COND_INITIALIZER;
+static int atfork_registered = 0;
+
+
+static const struct {
+  int priority;
+  const char *syslog_prefix;
+  const char *fg_prefix;
+  int fg_fd;
+} levels[] = {
+  { LOG_DEBUG,   "DEBUG:",   "DEBUG",   STDOUT_FILENO },
+  { LOG_INFO,    "INFO:",    "INFO",    STDOUT_FILENO },
+  { LOG_NOTICE,  "NOTICE:",  "NOTICE",  STDOUT_FILENO },
+  { LOG_WARNING, "WARN:",    "WARN",    STDERR_FILENO },
+  { LOG_ERR,     "ERROR:",   "ERROR",   STDERR_FILENO },
+  { LOG_CRIT,    "CRIT:",    "CRIT",    STDERR_FILENO },
+  { LOG_ALERT,   "ALERT:",   "ALERT",   STDERR_FILENO },
+  { LOG_EMERG,   "EMERG:",   "EMERG",   STDERR_FILENO }
+};
+
+#define NUM_LEVELS (sizeof(levels)/sizeof(levels[0]))
+#define LEVEL_WARN 3
+
+
+/*
+ * Consumer thread functions (no Ruby API allowed here).
+ */
+
+static void write_fd(int fd, const char *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    buf += n;
+    len -= n;
+  }
+}
+
+
+static void emit(int level, int user, const char *log_id, size_t log_id_len, const char *msg, size_t msg_len)
+{
+  char line[LOG_RING_DATA_SIZE + 64];
+  int len;
+
+  if (level < 0 || level >= (int)NUM_LEVELS)
+    level = 4;  /* error. */
+
+  /* The message is passed as argument so '%' chars need no escaping. */
+  syslog(levels[level].priority, "%7s <%.*s>%s%.*s", levels[level].syslog_prefix,
+         (int)log_id_len, log_id, user ? " [user] " : " ", (int)msg_len, msg);
+
+  /* User logs are not printed in foreground mode. */
+  if (foreground && ! user) {
+    len = snprintf(line, sizeof(line) - 1, "%s: <%.*s> %.*s", levels[level].fg_prefix,
+                   (int)log_id_len, log_id, (int)msg_len, msg);
+    if (len < 0)
+      return;
+    if (len > (int)sizeof(line) - 2)
+      len = sizeof(line) - 2;
+    line[len++] = '\n';
+    write_fd(levels[level].fg_fd, line, len);
+  }
+}
+
+
+static void emit_suppressed(time_t *last_report)
+{
+  unsigned long dropped = __atomic_load_n(&num_dropped, __ATOMIC_RELAXED);
+  char msg[96];
+  int len;
+  time_t now;
+
+  if (dropped == num_dropped_reported)
+    return;
+
+  now = time(NULL);
+  if (now - *last_report < LOG_RING_SUPPRESSED_INTERVAL)
+    return;
+
+  len = snprintf(msg, sizeof(msg), "%lu log messages suppressed (log buffer full)", dropped - num_dropped_reported);
+  emit(LEVEL_WARN, 0, "LogRing", 7, msg, len);
+  num_dropped_reported = dropped;
+  *last_report = now;
+}
+
+
+static void *consumer(void *arg)
+{
+  struct log_record *record;
+  unsigned long tail;
+  time_t last_report = 0;
+  struct timeval tv;
+  struct timespec ts;
+  sigset_t sigset;
+
+  /* Signals must be handled by the Ruby process thread. */
+  sigfillset(&sigset);
+  pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+  for (;;) {
+    tail = ring_tail;
+
+    while (tail != __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE)) {
+      record = &ring[tail & (LOG_RING_SIZE - 1)];
+      emit(record->level, record->user, record->data, record->log_id_len,
+           record->data + record->log_id_len, record->msg_len);
+      tail++;
+      __atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    emit_suppressed(&last_report);
+
+    /* Sleep until the producer wakes us up (or a while for the suppressed summary). */
+    pthread_mutex_lock(&consumer_mutex);
+    __atomic_store_n(&consumer_waiting, 1, __ATOMIC_SEQ_CST);
+    if (tail == __atomic_load_n(&ring_head, __ATOMIC_SEQ_CST)) {
+      gettimeofday(&tv, NULL);
+      ts.tv_sec = tv.tv_sec;
+      ts.tv_nsec = tv.tv_usec * 1000 + LOG_RING_IDLE_WAIT * 1000000L;
+      if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec += ts.tv_nsec / 1000000000L;
+        ts.tv_nsec %= 1000000000L;
+      }
+      pthread_cond_timedwait(&consumer_cond, &consumer_mutex, &ts);
+    }
+    __atomic_store_n(&consumer_waiting, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&consumer_mutex);
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Producer functions (Ruby thread with the GVL held).
+ */
+
+/* Returns 1 if the ring got empty before timeout milliseconds. */
+static int wait_empty(long timeout)
+{
+  struct timespec ts = { 0, 1000000L };  /* 1 ms. */
+
+  while (__atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) != ring_head) {
+    if (! consumer_running || timeout-- <= 0)
+      return 0;
+    nanosleep(&ts, NULL);
+  }
+  return 1;
+}
+
+
+/* Don't leave records in the ring when forking (they would be logged twice). */
+static void atfork_prepare(void)
+{
+  wait_empty(LOG_RING_FORK_MAX_WAIT);
+}
+
+
+/* The consumer thread does not exist in the child process. */
+static void atfork_child(void)
+{
+  consumer_running = 0;
+  consumer_waiting = 0;
+  ring_tail = ring_head;
+  num_dropped_reported = num_dropped;
+  pthread_mutex_init(&consumer_mutex, NULL);
+  pthread_cond_init(&consumer_cond, NULL);
+}
+
+
+static void start_consumer(void)
+{
+  int err;
+
+  if (! atfork_registered) {
+    pthread_atfork(atfork_prepare, NULL, atfork_child);
+    atfork_registered = 1;
+  }
+
+  if ((err = pthread_create(&consumer_thread, NULL, consumer, NULL)) != 0)
+    rb_raise(rb_eRuntimeError, "cannot create logging thread: %s", strerror(err));
+
+  pthread_detach(consumer_thread);
+  consumer_running = 1;
+}
+
+
+
+/*
+ * Ruby functions.
+ */
+
+/*
+ * Starts the logging thread (if not running). In foreground mode (daemonized
+ * is false) system logs are also printed into stdout/stderr.
+ */
+VALUE LogRing_start(VALUE self, VALUE daemonized)
+{
+  TRACE();
+
+  foreground = ! RTEST(daemonized);
+
+  if (! consumer_running)
+    start_consumer();
+
+  return Qnil;
+}
+
+
+/*
+ * Enqueues a log record. level is the OverSIP severity value (0 for debug up
+ * to 7 for emerg). Returns false if the record is dropped (full ring).
+ */
+VALUE LogRing_log(VALUE self, VALUE level, VALUE log_id, VALUE msg, VALUE user)
+{
+  TRACE();
+  struct log_record *record;
+  unsigned long head;
+  long log_id_len, msg_len;
+  char *src, *dst, *end;
+
+  if (TYPE(log_id) != T_STRING)
+    log_id = rb_obj_as_string(log_id);
+  if (TYPE(msg) != T_STRING)
+    msg = rb_obj_as_string(msg);
+
+  if (! consumer_running)
+    start_consumer();
+
+  head = ring_head;
+  if (head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) >= LOG_RING_SIZE) {
+    __atomic_add_fetch(&num_dropped, 1, __ATOMIC_RELAXED);
+    return Qfalse;
+  }
+
+  record = &ring[head & (LOG_RING_SIZE - 1)];
+  record->level = (unsigned char)NUM2INT(level);
+  record->user = RTEST(user) ? 1 : 0;
+
+  log_id_len = RSTRING_LEN(log_id);
+  if (log_id_len > 64)
+    log_id_len = 64;
+  memcpy(record->data, RSTRING_PTR(log_id), log_id_len);
+  record->log_id_len = log_id_len;
+
+  /* Copy the message removing NUL chars (and truncate it if needed). */
+  src = RSTRING_PTR(msg);
+  end = src + RSTRING_LEN(msg);
+  dst = record->data + log_id_len;
+  msg_len = LOG_RING_DATA_SIZE - log_id_len;
+  if (end - src > msg_len) {
+    end = src + msg_len - (sizeof(TRUNCATED_MARK) - 1);
+    msg_len = -1;
+  }
+  for (; src < end; src++)
+    if (*src)
+      *dst++ = *src;
+  if (msg_len == -1) {
+    memcpy(dst, TRUNCATED_MARK, sizeof(TRUNCATED_MARK) - 1);
+    dst += sizeof(TRUNCATED_MARK) - 1;
+  }
+  record->msg_len = dst - (record->data + log_id_len);
+
+  __atomic_store_n(&ring_head, head + 1, __ATOMIC_SEQ_CST);
+  num_logged++;
+
+  if (__atomic_load_n(&consumer_waiting, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&consumer_mutex);
+    pthread_cond_signal(&consumer_cond);
+    pthread_mutex_unlock(&consumer_mutex);
+  }
+
+  return Qtrue;
+}
+
+
+/*
+ * Waits (up to timeout seconds, 2 by default) until all the enqueued records
+ * have been logged. Returns true if so.
+ */
+VALUE LogRing_flush(int argc, VALUE *argv, VALUE self)
+{
+  TRACE();
+  long timeout = 2000;
+
+  if (argc > 1)
+    rb_raise(rb_eArgError, "wrong number of arguments (%d for 0..1)", argc);
+  if (argc == 1 && ! NIL_P(argv[0]))
+    timeout = (long)(NUM2DBL(argv[0]) * 1000);
+
+  return wait_empty(timeout) ? Qtrue : Qfalse;
+}
+
+
+VALUE LogRing_num_logged(VALUE self)
+{
+  TRACE();
+  return ULONG2NUM(num_logged);
+}
+
+
+VALUE LogRing_num_dropped(VALUE self)
+{
+  TRACE();
+  return ULONG2NUM(__atomic_load_n(&num_dropped, __ATOMIC_RELAXED));
+}
+
+
+VALUE LogRing_num_pending(VALUE self)
+{
+  TRACE();
+  return ULONG2NUM(ring_head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE));
+}
+
+
+void Init_log_ring()
+{
+  TRACE();
+
+  mOverSIP = rb_define_module("OverSIP");
+  mLogRing = rb_define_module_under(mOverSIP, "LogRing");
+
+  rb_define_const(mLogRing, "SIZE", INT2FIX(LOG_RING_SIZE));
+
+  rb_define_module_function(mLogRing, "start", LogRing_start, 1);
+  rb_define_module_function(mLogRing, "log", LogRing_log, 4);
+  rb_define_module_function(mLogRing, "flush", LogRing_flush, -1);
+  rb_define_module_function(mLogRing, "num_logged", LogRing_num_logged, 0);
+  rb_define_module_function(mLogRing, "num_dropped", LogRing_num_dropped, 0);
+  rb_define_module_function(mLogRing, "num_pending", LogRing_num_pending, 0);
+}
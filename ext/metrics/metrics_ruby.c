@@ -0,0 +1,357 @@
+#include <ruby.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ext_help.h"
+
+
+/*
+ * Metrics registry.
+ *
+ * Metrics (counters, gauges and fixed-bucket histograms) are registered at
+ * startup, so every series gets an integer id and its slots in a flat array of
+ * values. Updating a series is just an indexed (atomic) update, with no lookups
+ * nor allocations. The registry is rendered in Prometheus text format.
+ */
+
+
+#define METRIC_COUNTER    0
+#define METRIC_GAUGE      1
+#define METRIC_HISTOGRAM  2
+
+
+struct metric_family {
+  char *name;
+  char *help;
+  int type;
+  int num_buckets;
+  double *buckets;
+  int *series;
+  int num_series;
+};
+
+struct metric_series {
+  int family;
+  char *labels;
+  /* Index of the first slot in values. */
+  long slot;
+};
+
+
+static VALUE mOverSIP;
+static VALUE mMetrics;
+
+static VALUE symbol_counter;
+static VALUE symbol_gauge;
+static VALUE symbol_histogram;
+
+static struct metric_family *families = NULL;
+static int num_families = 0;
+static struct metric_series *series = NULL;
+static int num_series = 0;
+
+/* Counters, gauges and histogram bucket counts (plus the count). */
+static int64_t *values = NULL;
+static long num_values = 0;
+/* Histogram sums (indexed by series id). */
+static double *sums = NULL;
+
+
+static char *dup_string(VALUE string)
+{
+  char *s = ALLOC_N(char, RSTRING_LEN(string) + 1);
+
+  memcpy(s, RSTRING_PTR(string), RSTRING_LEN(string));
+  s[RSTRING_LEN(string)] = '\0';
+  return s;
+}
+
+
+static inline int check_id(VALUE id, int type)
+{
+  int i = NUM2INT(id);
+
+  if (i < 0 || i >= num_series || families[series[i].family].type != type)
+    rb_raise(rb_eArgError, "invalid metric id %d", i);
+  return i;
+}
+
+
+#ifdef __GNUC__
+static void append(VALUE str, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+#endif
+
+static void append(VALUE str, const char *fmt, ...)
+{
+  char buf[512];
+  va_list ap;
+  int len;
+
+  va_start(ap, fmt);
+  len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+
+  if (len >= (int)sizeof(buf))
+    len = sizeof(buf) - 1;
+  rb_str_cat(str, buf, len);
+}
+
+
+/* Formats a double with the shortest representation that round-trips. */
+static void format_double(char *buf, size_t size, double value)
+{
+  int precision;
+
+  for (precision = 1; precision < 17; precision++) {
+    snprintf(buf, size, "%.*g", precision, value);
+    if (strtod(buf, NULL) == value)
+      return;
+  }
+  snprintf(buf, size, "%.17g", value);
+}
+
+
+
+/*
+ * Ruby functions.
+ */
+
+/*
+ * Registers a series and returns its id. type is :counter, :gauge or :histogram.
+ * labels is the already formatted labels String (i.e. 'transport="udp"') or nil.
+ * buckets (histograms) is an Array with the upper bounds (ascending).
+ * Series of the same metric must be registered with the same type, help and
+ * buckets (the ones given in the first registration are used).
+ */
+VALUE Metrics_register(int argc, VALUE *argv, VALUE self)
+{
+  TRACE();
+  VALUE type, name, help, labels, buckets;
+  struct metric_family *family = NULL;
+  struct metric_series *s;
+  int i, t, num_slots;
+
+  rb_scan_args(argc, argv, "32", &type, &name, &help, &labels, &buckets);
+
+  if (type == symbol_counter)
+    t = METRIC_COUNTER;
+  else if (type == symbol_gauge)
+    t = METRIC_GAUGE;
+  else if (type == symbol_histogram)
+    t = METRIC_HISTOGRAM;
+  else
+    rb_raise(rb_eArgError, "invalid metric type");
+
+  StringValue(name);
+  StringValue(help);
+  if (! NIL_P(labels))
+    StringValue(labels);
+
+  for (i = 0; i < num_families; i++) {
+    if (strcmp(families[i].name, RSTRING_PTR(name)) == 0) {
+      family = &families[i];
+      if (family->type != t)
+        rb_raise(rb_eArgError, "metric %s already registered with other type", family->name);
+      break;
+    }
+  }
+
+  if (! family) {
+    if (t == METRIC_HISTOGRAM) {
+      Check_Type(buckets, T_ARRAY);
+      if (RARRAY_LEN(buckets) == 0)
+        rb_raise(rb_eArgError, "histogram buckets required");
+    }
+
+    REALLOC_N(families, struct metric_family, num_families + 1);
+    family = &families[num_families];
+    family->name = dup_string(name);
+    family->help = dup_string(help);
+    family->type = t;
+    family->num_buckets = 0;
+    family->buckets = NULL;
+    family->series = NULL;
+    family->num_series = 0;
+
+    if (t == METRIC_HISTOGRAM) {
+      family->num_buckets = (int)RARRAY_LEN(buckets);
+      family->buckets = ALLOC_N(double, family->num_buckets);
+      for (i = 0; i < family->num_buckets; i++)
+        family->buckets[i] = NUM2DBL(rb_ary_entry(buckets, i));
+    }
+    num_families++;
+  }
+
+  /* Histograms: a slot per bucket plus +Inf bucket plus count. */
+  num_slots = (t == METRIC_HISTOGRAM) ? family->num_buckets + 2 : 1;
+
+  REALLOC_N(values, int64_t, num_values + num_slots);
+  memset(values + num_values, 0, num_slots * sizeof(int64_t));
+
+  REALLOC_N(series, struct metric_series, num_series + 1);
+  REALLOC_N(sums, double, num_series + 1);
+  sums[num_series] = 0;
+  s = &series[num_series];
+  s->family = (int)(family - families);
+  s->labels = NIL_P(labels) ? NULL : dup_string(labels);
+  s->slot = num_values;
+  num_values += num_slots;
+
+  REALLOC_N(family->series, int, family->num_series + 1);
+  family->series[family->num_series++] = num_series;
+
+  return INT2FIX(num_series++);
+}
+
+
+/* Increments a counter or gauge by 1. */
+VALUE Metrics_inc(VALUE self, VALUE id)
+{
+  int i = NUM2INT(id);
+
+  if (i < 0 || i >= num_series || families[series[i].family].type == METRIC_HISTOGRAM)
+    rb_raise(rb_eArgError, "invalid metric id %d", i);
+
+  __atomic_add_fetch(&values[series[i].slot], 1, __ATOMIC_RELAXED);
+  return Qnil;
+}
+
+
+/* Adds the given Integer to a counter or gauge. */
+VALUE Metrics_add(VALUE self, VALUE id, VALUE n)
+{
+  int i = NUM2INT(id);
+
+  if (i < 0 || i >= num_series || families[series[i].family].type == METRIC_HISTOGRAM)
+    rb_raise(rb_eArgError, "invalid metric id %d", i);
+
+  __atomic_add_fetch(&values[series[i].slot], NUM2LL(n), __ATOMIC_RELAXED);
+  return Qnil;
+}
+
+
+/* Sets the value of a gauge (or of a counter mirroring a counter kept elsewhere). */
+VALUE Metrics_set(VALUE self, VALUE id, VALUE n)
+{
+  int i = NUM2INT(id);
+
+  if (i < 0 || i >= num_series || families[series[i].family].type == METRIC_HISTOGRAM)
+    rb_raise(rb_eArgError, "invalid metric id %d", i);
+
+  __atomic_store_n(&values[series[i].slot], NUM2LL(n), __ATOMIC_RELAXED);
+  return Qnil;
+}
+
+
+/* Value of a counter or gauge, or count of a histogram. */
+VALUE Metrics_get(VALUE self, VALUE id)
+{
+  int i = NUM2INT(id);
+  struct metric_family *family;
+
+  if (i < 0 || i >= num_series)
+    rb_raise(rb_eArgError, "invalid metric id %d", i);
+
+  family = &families[series[i].family];
+  if (family->type == METRIC_HISTOGRAM)
+    return LL2NUM(values[series[i].slot + family->num_buckets + 1]);
+  else
+    return LL2NUM(values[series[i].slot]);
+}
+
+
+/* Adds an observation to a histogram. */
+VALUE Metrics_observe(VALUE self, VALUE id, VALUE value)
+{
+  int i = check_id(id, METRIC_HISTOGRAM);
+  struct metric_family *family = &families[series[i].family];
+  double v = NUM2DBL(value);
+  int b;
+
+  for (b = 0; b < family->num_buckets; b++)
+    if (v <= family->buckets[b])
+      break;
+
+  __atomic_add_fetch(&values[series[i].slot + b], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&values[series[i].slot + family->num_buckets + 1], 1, __ATOMIC_RELAXED);
+  sums[i] += v;
+  return Qnil;
+}
+
+
+/* Returns the registry in Prometheus text exposition format (version 0.0.4). */
+VALUE Metrics_render(VALUE self)
+{
+  TRACE();
+  VALUE str = rb_str_buf_new(num_series * 64);
+  struct metric_family *family;
+  struct metric_series *s;
+  char num[64];
+  int f, i, b;
+  int64_t cumulative;
+
+  for (f = 0; f < num_families; f++) {
+    family = &families[f];
+
+    append(str, "# HELP %s %s\n", family->name, family->help);
+    append(str, "# TYPE %s %s\n", family->name,
+           family->type == METRIC_COUNTER ? "counter" : (family->type == METRIC_GAUGE ? "gauge" : "histogram"));
+
+    for (i = 0; i < family->num_series; i++) {
+      s = &series[family->series[i]];
+
+      if (family->type != METRIC_HISTOGRAM) {
+        if (s->labels)
+          append(str, "%s{%s} %lld\n", family->name, s->labels, (long long)values[s->slot]);
+        else
+          append(str, "%s %lld\n", family->name, (long long)values[s->slot]);
+        continue;
+      }
+
+      cumulative = 0;
+      for (b = 0; b <= family->num_buckets; b++) {
+        cumulative += values[s->slot + b];
+        if (b < family->num_buckets)
+          format_double(num, sizeof(num), family->buckets[b]);
+        else
+          strcpy(num, "+Inf");
+        append(str, "%s_bucket{%s%sle=\"%s\"} %lld\n", family->name, s->labels ? s->labels : "",
+               s->labels ? "," : "", num, (long long)cumulative);
+      }
+      format_double(num, sizeof(num), sums[family->series[i]]);
+      if (s->labels) {
+        append(str, "%s_sum{%s} %s\n", family->name, s->labels, num);
+        append(str, "%s_count{%s} %lld\n", family->name, s->labels, (long long)values[s->slot + family->num_buckets + 1]);
+      }
+      else {
+        append(str, "%s_sum %s\n", family->name, num);
+        append(str, "%s_count %lld\n", family->name, (long long)values[s->slot + family->num_buckets + 1]);
+      }
+    }
+  }
+
+  return str;
+}
+
+
+void Init_metrics()
+{
+  TRACE();
+
+  mOverSIP = rb_define_module("OverSIP");
+  mMetrics = rb_define_module_under(mOverSIP, "Metrics");
+
+  rb_define_module_function(mMetrics, "register", Metrics_register, -1);
+  rb_define_module_function(mMetrics, "inc", Metrics_inc, 1);
+  rb_define_module_function(mMetrics, "add", Metrics_add, 2);
+  rb_define_module_function(mMetrics, "set", Metrics_set, 2);
+  rb_define_module_function(mMetrics, "get", Metrics_get, 1);
+  rb_define_module_function(mMetrics, "observe", Metrics_observe, 2);
+  rb_define_module_function(mMetrics, "render", Metrics_render, 0);
+
+  symbol_counter = ID2SYM(rb_intern("counter"));
+  symbol_gauge = ID2SYM(rb_intern("gauge"));
+  symbol_histogram = ID2SYM(rb_intern("histogram"));
+}
@@ -1,4 +1,5 @@
 #include <ruby.h>
+#include <stdio.h>
 #include "ext_help.h"
 #include "sip_parser.h"
 #include "common_headers.h"
@@ -58,6 +59,7 @@ static ID id_hdr_via;
 static ID id_hdr_from;
 static ID id_hdr_to;
 static ID id_hdr_route;
+static ID id_internal_to_tag;
 
 static ID id_display_name;
 static ID id_uri;
@@ -116,6 +118,11 @@ static VALUE string_Call_ID;
 static VALUE string_Max_Forwards;
 static VALUE string_Content_Length;
 
+/* Templates for Request#build_reply (set by init_reply_templates()). */
+static VALUE reply_status_lines;
+static VALUE reply_reason_phrase_not_set;
+static VALUE reply_hdr_server;
+
 /* A single and global SIP URI parser. */
 static sip_uri_parser *global_sip_uri_parser;
 
@@ -1222,6 +1229,215 @@ VALUE SipMessageParser_Class_parse_uri(VALUE self, VALUE string, VALUE allow_nam
 
 
 
+/*
+ * Fills the templates for Request#build_reply: the status lines of the status
+ * codes with known reason phrase ("SIP/2.0 100 Trying\r\n") indexed by status code,
+ * and the Server header plus the end of headers. It's done on the first reply
+ * since the constants are defined after loading this extension.
+ */
+static void init_reply_templates(void)
+{
+  TRACE();
+  VALUE reason_phrases, status_codes, status_code, status_line;
+  long i;
+
+  reason_phrases = rb_const_get(mSIP, rb_intern("REASON_PHRASE"));
+  status_codes = rb_funcall(reason_phrases, rb_intern("keys"), 0);
+
+  reply_status_lines = rb_ary_new2(700);
+  for (i = 0; i < RARRAY_LEN(status_codes); i++) {
+    status_code = rb_ary_entry(status_codes, i);
+    if (! FIXNUM_P(status_code) || FIX2LONG(status_code) < 100 || FIX2LONG(status_code) > 699)
+      continue;
+
+    status_line = rb_str_new2("SIP/2.0 ");
+    rb_str_append(status_line, rb_obj_as_string(status_code));
+    rb_str_cat(status_line, " ", 1);
+    rb_str_append(status_line, rb_hash_aref(reason_phrases, status_code));
+    rb_str_cat(status_line, "\r\n", 2);
+    rb_ary_store(reply_status_lines, FIX2LONG(status_code), rb_obj_freeze(status_line));
+  }
+  rb_obj_freeze(reply_status_lines);
+
+  reply_reason_phrase_not_set = rb_obj_freeze(rb_str_dup(rb_const_get(mSIP, rb_intern("REASON_PHRASE_NOT_SET"))));
+
+  reply_hdr_server = rb_str_dup(rb_const_get(mSIP, rb_intern("HDR_SERVER")));
+  rb_str_cat(reply_hdr_server, "\r\n\r\n", 4);
+  rb_obj_freeze(reply_hdr_server);
+}
+
+
+#define REPLY_APPEND(p, str, len)  memcpy(p, str, len); p += len;
+#define REPLY_APPEND_STRING(p, v)  REPLY_APPEND(p, RSTRING_PTR(v), RSTRING_LEN(v))
+
+
+/**
+ * call-seq:
+ *    request.build_reply(status_code, reason_phrase, first_via, extra_headers, body) -> String
+ *
+ * Builds a response to the request from the values captured by the parser (Via,
+ * From, To, Call-ID and CSeq) and @internal_to_tag. If reason_phrase is nil the
+ * precomputed status line of the status code is used. If first_via is not nil it
+ * replaces the top Via. The response is allocated once with its exact size.
+ */
+VALUE SipRequest_build_reply(VALUE self, VALUE status_code, VALUE reason_phrase, VALUE first_via, VALUE extra_headers, VALUE body)
+{
+  TRACE();
+  VALUE hdr_via, hdr_from, hdr_to, call_id, sip_method, to_tag, status_line, via, response;
+  long code, num_vias, i, len;
+  char code_str[24], cseq_str[24], content_length_str[24];
+  int code_len = 0, cseq_len, content_length_len;
+  char *p;
+
+  if (NIL_P(reply_status_lines))
+    init_reply_templates();
+
+  code = NUM2LONG(status_code);
+
+  hdr_via = rb_ivar_get(self, id_hdr_via);
+  hdr_from = rb_ivar_get(self, id_hdr_from);
+  hdr_to = rb_ivar_get(self, id_hdr_to);
+  call_id = rb_ivar_get(self, id_call_id);
+  to_tag = rb_ivar_get(self, id_internal_to_tag);
+  sip_method = rb_ivar_get(self, id_sip_method);
+  if (SYMBOL_P(sip_method))
+    sip_method = rb_id2str(SYM2ID(sip_method));
+
+  REQUIRE_TYPE(hdr_via, T_ARRAY);
+  REQUIRE_TYPE(hdr_from, T_STRING);
+  REQUIRE_TYPE(hdr_to, T_STRING);
+  REQUIRE_TYPE(call_id, T_STRING);
+  REQUIRE_TYPE(sip_method, T_STRING);
+  if (! NIL_P(to_tag))
+    REQUIRE_TYPE(to_tag, T_STRING);
+  if (! NIL_P(first_via))
+    REQUIRE_TYPE(first_via, T_STRING);
+  if (! NIL_P(body))
+    REQUIRE_TYPE(body, T_STRING);
+
+  /* Extra headers can be any Enumerable (converted with to_a) of objects responding to to_s. */
+  if (! NIL_P(extra_headers)) {
+    if (TYPE(extra_headers) != T_ARRAY)
+      extra_headers = rb_convert_type(extra_headers, T_ARRAY, "Array", "to_a");
+    for (i = 0; i < RARRAY_LEN(extra_headers); i++) {
+      if (TYPE(rb_ary_entry(extra_headers, i)) != T_STRING) {
+        VALUE strings = rb_ary_new2(RARRAY_LEN(extra_headers));
+        for (i = 0; i < RARRAY_LEN(extra_headers); i++)
+          rb_ary_push(strings, rb_obj_as_string(rb_ary_entry(extra_headers, i)));
+        extra_headers = strings;
+        break;
+      }
+    }
+  }
+
+  /* Compute the exact length of the response. */
+
+  status_line = NIL_P(reason_phrase) && code >= 100 && code <= 699 ? rb_ary_entry(reply_status_lines, code) : Qnil;
+  if (NIL_P(status_line)) {
+    if (NIL_P(reason_phrase))
+      reason_phrase = reply_reason_phrase_not_set;
+    else
+      reason_phrase = rb_obj_as_string(reason_phrase);
+    code_len = snprintf(code_str, sizeof(code_str), "%ld", code);
+    len = 8 + code_len + 1 + RSTRING_LEN(reason_phrase) + 2;
+  }
+  else
+    len = RSTRING_LEN(status_line);
+
+  num_vias = RARRAY_LEN(hdr_via);
+  for (i = 0; i < num_vias; i++) {
+    via = (i == 0 && ! NIL_P(first_via)) ? first_via : rb_ary_entry(hdr_via, i);
+    REQUIRE_TYPE(via, T_STRING);
+    len += 5 + RSTRING_LEN(via) + 2;
+  }
+
+  len += 6 + RSTRING_LEN(hdr_from) + 2;
+  len += 4 + RSTRING_LEN(hdr_to) + 2;
+  if (! NIL_P(to_tag))
+    len += 5 + RSTRING_LEN(to_tag);
+  len += 9 + RSTRING_LEN(call_id) + 2;
+
+  cseq_len = snprintf(cseq_str, sizeof(cseq_str), "%ld", NUM2LONG(rb_ivar_get(self, id_cseq)));
+  len += 6 + cseq_len + 1 + RSTRING_LEN(sip_method) + 2;
+
+  content_length_len = snprintf(content_length_str, sizeof(content_length_str), "%ld", NIL_P(body) ? 0L : RSTRING_LEN(body));
+  len += 16 + content_length_len + 2;
+
+  if (! NIL_P(extra_headers))
+    for (i = 0; i < RARRAY_LEN(extra_headers); i++)
+      len += RSTRING_LEN(rb_ary_entry(extra_headers, i)) + 2;
+
+  len += RSTRING_LEN(reply_hdr_server);
+  if (! NIL_P(body))
+    len += RSTRING_LEN(body);
+
+  /* Write it. */
+
+  response = rb_enc_str_new(NULL, len, rb_utf8_encoding());
+  p = RSTRING_PTR(response);
+
+  if (NIL_P(status_line)) {
+    REPLY_APPEND(p, "SIP/2.0 ", 8);
+    REPLY_APPEND(p, code_str, code_len);
+    REPLY_APPEND(p, " ", 1);
+    REPLY_APPEND_STRING(p, reason_phrase);
+    REPLY_APPEND(p, "\r\n", 2);
+  }
+  else {
+    REPLY_APPEND_STRING(p, status_line);
+  }
+
+  for (i = 0; i < num_vias; i++) {
+    via = (i == 0 && ! NIL_P(first_via)) ? first_via : rb_ary_entry(hdr_via, i);
+    REPLY_APPEND(p, "Via: ", 5);
+    REPLY_APPEND_STRING(p, via);
+    REPLY_APPEND(p, "\r\n", 2);
+  }
+
+  REPLY_APPEND(p, "From: ", 6);
+  REPLY_APPEND_STRING(p, hdr_from);
+  REPLY_APPEND(p, "\r\n", 2);
+
+  REPLY_APPEND(p, "To: ", 4);
+  REPLY_APPEND_STRING(p, hdr_to);
+  if (! NIL_P(to_tag)) {
+    REPLY_APPEND(p, ";tag=", 5);
+    REPLY_APPEND_STRING(p, to_tag);
+  }
+  REPLY_APPEND(p, "\r\n", 2);
+
+  REPLY_APPEND(p, "Call-ID: ", 9);
+  REPLY_APPEND_STRING(p, call_id);
+  REPLY_APPEND(p, "\r\n", 2);
+
+  REPLY_APPEND(p, "CSeq: ", 6);
+  REPLY_APPEND(p, cseq_str, cseq_len);
+  REPLY_APPEND(p, " ", 1);
+  REPLY_APPEND_STRING(p, sip_method);
+  REPLY_APPEND(p, "\r\n", 2);
+
+  REPLY_APPEND(p, "Content-Length: ", 16);
+  REPLY_APPEND(p, content_length_str, content_length_len);
+  REPLY_APPEND(p, "\r\n", 2);
+
+  if (! NIL_P(extra_headers)) {
+    for (i = 0; i < RARRAY_LEN(extra_headers); i++) {
+      REPLY_APPEND_STRING(p, rb_ary_entry(extra_headers, i));
+      REPLY_APPEND(p, "\r\n", 2);
+    }
+  }
+
+  REPLY_APPEND_STRING(p, reply_hdr_server);
+
+  if (! NIL_P(body)) {
+    REPLY_APPEND_STRING(p, body);
+  }
+
+  return response;
+}
+
+
+
 void Init_sip_parser()
 {
   TRACE();
@@ -1255,6 +1471,8 @@ void Init_sip_parser()
   rb_define_module_function(cSIPMessageParser, "headerize", SipMessageParser_Class_headerize,1);
   rb_define_module_function(cSIPMessageParser, "parse_uri", SipMessageParser_Class_parse_uri,2);
 
+  rb_define_private_method(cSIPRequest, "build_reply", SipRequest_build_reply,5);
+
   init_common_headers();
   init_short_headers();
 
@@ -1295,6 +1513,7 @@ void Init_sip_parser()
   id_hdr_from = rb_intern("@hdr_from");
   id_hdr_to = rb_intern("@hdr_to");
   id_hdr_route = rb_intern("@hdr_route");
+  id_internal_to_tag = rb_intern("@internal_to_tag");
 
   id_display_name = rb_intern("@display_name");
   id_uri = rb_intern("@uri");
@@ -1365,6 +1584,11 @@ void Init_sip_parser()
   string_Content_Length = rb_obj_freeze(string_Content_Length);
   rb_global_variable(&string_Content_Length);
 
+  reply_status_lines = Qnil;
+  rb_global_variable(&reply_status_lines);
+  rb_global_variable(&reply_reason_phrase_not_set);
+  rb_global_variable(&reply_hdr_server);
+
   /* Initialize global_sip_uri_parser struct to NULL. */
   global_sip_uri_parser = NULL;
 }
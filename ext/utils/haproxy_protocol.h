@@ -22,6 +22,56 @@ typedef struct struct_haproxy_protocol {
 } struct_haproxy_protocol;
 
 
+/* Max length of a version 1 line ("PROXY TCP6" with the longest addresses and ports). */
+#define HAPROXY_PROTOCOL_V1_MAX_LEN  107
+
+
 struct_haproxy_protocol struct_haproxy_protocol_parser_execute(const char *str, size_t len);
 
+
+/*
+ * HAProxy PROXY Protocol version 2 (binary header).
+ */
+
+#define HAPROXY_PROTOCOL_V2_SIGNATURE      "\r\n\r\n\0\r\nQUIT\n"
+#define HAPROXY_PROTOCOL_V2_SIGNATURE_LEN  12
+#define HAPROXY_PROTOCOL_V2_HEADER_LEN     16
+
+/* Bits of the "client" field in the SSL TLV. */
+#define HAPROXY_PROTOCOL_V2_CLIENT_SSL        0x01
+#define HAPROXY_PROTOCOL_V2_CLIENT_CERT_CONN  0x02
+#define HAPROXY_PROTOCOL_V2_CLIENT_CERT_SESS  0x04
+
+
+enum enum_haproxy_protocol_v2_status {
+  haproxy_protocol_v2_status_invalid = -1,
+  haproxy_protocol_v2_status_incomplete = 0,
+  haproxy_protocol_v2_status_valid = 1
+};
+
+
+typedef struct struct_haproxy_protocol_v2 {
+  enum enum_haproxy_protocol_v2_status      status;
+  size_t                                    total_len;
+  /* 0 for LOCAL command or non IP addresses (so the address of the proxy must be kept). */
+  unsigned short int                        has_address;
+  enum enum_haproxy_protocol_ip_type        ip_type;
+  unsigned char                             ip[16];
+  unsigned int                              port;
+  const char                               *unique_id;
+  size_t                                    unique_id_len;
+  unsigned short int                        has_ssl;
+  unsigned char                             ssl_client;
+  unsigned long                             ssl_verify;
+  const char                               *ssl_version;
+  size_t                                    ssl_version_len;
+  const char                               *ssl_cn;
+  size_t                                    ssl_cn_len;
+  const char                               *ssl_cipher;
+  size_t                                    ssl_cipher_len;
+} struct_haproxy_protocol_v2;
+
+
+struct_haproxy_protocol_v2 struct_haproxy_protocol_v2_parser_execute(const char *str, size_t len);
+
 #endif
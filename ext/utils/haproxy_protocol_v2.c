@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <string.h>
+#include "haproxy_protocol.h"
+
+
+/* Address families and lengths of the addresses block. */
+#define PP2_AF_UNSPEC      0x0
+#define PP2_AF_INET        0x1
+#define PP2_AF_INET6       0x2
+#define PP2_AF_UNIX        0x3
+#define PP2_INET_LEN       12
+#define PP2_INET6_LEN      36
+#define PP2_UNIX_LEN       216
+
+#define PP2_CMD_LOCAL      0x0
+#define PP2_CMD_PROXY      0x1
+
+/* TLV types. */
+#define PP2_TYPE_UNIQUE_ID    0x05
+#define PP2_TYPE_SSL          0x20
+#define PP2_SUBTYPE_SSL_VERSION  0x21
+#define PP2_SUBTYPE_SSL_CN       0x22
+#define PP2_SUBTYPE_SSL_CIPHER   0x23
+
+/* Length of the fixed part of the SSL TLV value (client and verify fields). */
+#define PP2_SSL_FIXED_LEN  5
+
+
+#define READ_UINT16(p)  ((size_t)(((unsigned char)(p)[0] << 8) | (unsigned char)(p)[1]))
+
+
+/*
+ * Parse the SSL TLV sub-TLVs. Returns 0 if they are malformed.
+ */
+static int parse_ssl_tlv(struct_haproxy_protocol_v2 *hp, const char *p, size_t len)
+{
+  const unsigned char *u = (const unsigned char *)p;
+  const char *pe;
+  size_t tlv_len;
+
+  if (len < PP2_SSL_FIXED_LEN)
+    return 0;
+
+  hp->has_ssl = 1;
+  hp->ssl_client = u[0];
+  hp->ssl_verify = ((unsigned long)u[1] << 24) | ((unsigned long)u[2] << 16) | ((unsigned long)u[3] << 8) | u[4];
+
+  pe = p + len;
+  p += PP2_SSL_FIXED_LEN;
+
+  while (p < pe) {
+    if (pe - p < 3)
+      return 0;
+    tlv_len = READ_UINT16(p + 1);
+    if ((size_t)(pe - p - 3) < tlv_len)
+      return 0;
+
+    switch((unsigned char)p[0]) {
+      case PP2_SUBTYPE_SSL_VERSION:
+        hp->ssl_version = p + 3;
+        hp->ssl_version_len = tlv_len;
+        break;
+      case PP2_SUBTYPE_SSL_CN:
+        hp->ssl_cn = p + 3;
+        hp->ssl_cn_len = tlv_len;
+        break;
+      case PP2_SUBTYPE_SSL_CIPHER:
+        hp->ssl_cipher = p + 3;
+        hp->ssl_cipher_len = tlv_len;
+        break;
+      default:
+        break;
+    }
+
+    p += 3 + tlv_len;
+  }
+
+  return 1;
+}
+
+
+/*
+ * Expects the binary header of the HAProxy Protocol version 2:
+ *   - 12 bytes signature.
+ *   - 1 byte version (0x2) and command (LOCAL or PROXY).
+ *   - 1 byte address family and transport protocol.
+ *   - 2 bytes (network order) length of the remaining header.
+ *   - Addresses block (source and destination address and port).
+ *   - TLVs.
+ * The header has fixed offsets so it's parsed without scanning. Unknown TLVs are
+ * ignored.
+ */
+struct_haproxy_protocol_v2 struct_haproxy_protocol_v2_parser_execute(const char *str, size_t len)
+{
+  struct_haproxy_protocol_v2 hp;
+  const unsigned char *u = (const unsigned char *)str;
+  const char *p, *pe;
+  size_t remaining_len, addresses_len, tlv_len;
+  unsigned char command, family;
+
+  memset(&hp, 0, sizeof(hp));
+  hp.status = haproxy_protocol_v2_status_invalid;
+
+  /* Check the signature (maybe not fully received yet). */
+  if (memcmp(str, HAPROXY_PROTOCOL_V2_SIGNATURE, len < HAPROXY_PROTOCOL_V2_SIGNATURE_LEN ? len : HAPROXY_PROTOCOL_V2_SIGNATURE_LEN) != 0)
+    return hp;
+
+  if (len < HAPROXY_PROTOCOL_V2_HEADER_LEN) {
+    hp.status = haproxy_protocol_v2_status_incomplete;
+    return hp;
+  }
+
+  if ((u[12] & 0xF0) != 0x20)
+    return hp;
+  command = u[12] & 0x0F;
+  family = u[13] >> 4;
+  remaining_len = READ_UINT16(str + 14);
+
+  if (len < HAPROXY_PROTOCOL_V2_HEADER_LEN + remaining_len) {
+    hp.status = haproxy_protocol_v2_status_incomplete;
+    return hp;
+  }
+
+  switch(command) {
+    case PP2_CMD_LOCAL:
+      break;
+    case PP2_CMD_PROXY:
+      break;
+    default:
+      return hp;
+  }
+
+  switch(family) {
+    case PP2_AF_INET:
+      addresses_len = PP2_INET_LEN;
+      break;
+    case PP2_AF_INET6:
+      addresses_len = PP2_INET6_LEN;
+      break;
+    case PP2_AF_UNIX:
+      addresses_len = PP2_UNIX_LEN;
+      break;
+    case PP2_AF_UNSPEC:
+      addresses_len = 0;
+      break;
+    default:
+      return hp;
+  }
+
+  p = str + HAPROXY_PROTOCOL_V2_HEADER_LEN;
+  pe = p + remaining_len;
+  hp.total_len = HAPROXY_PROTOCOL_V2_HEADER_LEN + remaining_len;
+
+  /* LOCAL command (i.e. health checks from the proxy): ignore the whole block. */
+  if (command == PP2_CMD_LOCAL) {
+    hp.status = haproxy_protocol_v2_status_valid;
+    return hp;
+  }
+
+  if (remaining_len < addresses_len)
+    return hp;
+
+  /* Source address and port. */
+  if (family == PP2_AF_INET) {
+    hp.has_address = 1;
+    hp.ip_type = haproxy_protocol_ip_type_ipv4;
+    memcpy(hp.ip, p, 4);
+    hp.port = READ_UINT16(p + 8);
+  }
+  else if (family == PP2_AF_INET6) {
+    hp.has_address = 1;
+    hp.ip_type = haproxy_protocol_ip_type_ipv6;
+    memcpy(hp.ip, p, 16);
+    hp.port = READ_UINT16(p + 32);
+  }
+
+  /* TLVs. */
+  p += addresses_len;
+  while (p < pe) {
+    if (pe - p < 3)
+      return hp;
+    tlv_len = READ_UINT16(p + 1);
+    if ((size_t)(pe - p - 3) < tlv_len)
+      return hp;
+
+    switch((unsigned char)p[0]) {
+      case PP2_TYPE_UNIQUE_ID:
+        hp.unique_id = p + 3;
+        hp.unique_id_len = tlv_len;
+        break;
+      case PP2_TYPE_SSL:
+        if (! parse_ssl_tlv(&hp, p + 3, tlv_len))
+          return hp;
+        break;
+      default:
+        break;
+    }
+
+    p += 3 + tlv_len;
+  }
+
+  hp.status = haproxy_protocol_v2_status_valid;
+  return hp;
+}
@@ -11,6 +11,13 @@ static VALUE mUtils;
 static VALUE symbol_ipv4;
 static VALUE symbol_ipv6;
 static VALUE symbol_ipv6_reference;
+static VALUE symbol_unique_id;
+static VALUE symbol_ssl;
+static VALUE symbol_ssl_client_cert;
+static VALUE symbol_ssl_client_cert_verified;
+static VALUE symbol_ssl_version;
+static VALUE symbol_ssl_cn;
+static VALUE symbol_ssl_cipher;
 
 
 
@@ -277,6 +284,58 @@ VALUE Utils_to_pure_ip(VALUE self, VALUE string)
 }
 
 
+/*
+ * Returns a compact binary key (a frozen String) for the given IP and port
+ * (the IP in network order followed by the port in network order, 6 bytes for
+ * IPv4 and 18 bytes for IPv6). The IPv6 can be given in any form (also as IPv6
+ * reference) and no normalization is needed as the binary form is unique.
+ * Returns nil if the given IP is not valid.
+ */
+VALUE Utils_connection_key(VALUE self, VALUE ip, VALUE port)
+{
+  TRACE();
+  char *str;
+  long len;
+  char ip_str[INET6_ADDRSTRLEN + 1];
+  unsigned char key[18];
+  int port_int;
+  VALUE connection_key;
+
+  if (TYPE(ip) != T_STRING)
+    rb_raise(rb_eTypeError, "First argument must be a String");
+
+  port_int = NUM2INT(port);
+  str = RSTRING_PTR(ip);
+  len = RSTRING_LEN(ip);
+
+  /* Remove the brackets of a IPv6 reference. */
+  if (len > 2 && str[0] == '[' && str[len-1] == ']') {
+    str++;
+    len -= 2;
+  }
+  if (len > INET6_ADDRSTRLEN)
+    return Qnil;
+  memcpy(ip_str, str, len);
+  ip_str[len] = '\0';
+
+  if (inet_pton(AF_INET, ip_str, key) == 1) {
+    key[4] = (port_int >> 8) & 0xFF;
+    key[5] = port_int & 0xFF;
+    connection_key = rb_str_new((char *)key, 6);
+  }
+  else if (inet_pton(AF_INET6, ip_str, key) == 1) {
+    key[16] = (port_int >> 8) & 0xFF;
+    key[17] = port_int & 0xFF;
+    connection_key = rb_str_new((char *)key, 18);
+  }
+  else
+    return Qnil;
+
+  /* Frozen so it's not duplicated when used as Hash key. */
+  return rb_obj_freeze(connection_key);
+}
+
+
 /*
  * TODO: We lack a simple "normalice_host(ip)" method that parses the given ip and so on...
  */
@@ -325,14 +384,58 @@ VALUE Utils_parser_outbound_udp_flow_token(VALUE self, VALUE string)
 
 
 /*
- * Expects a string like "PROXY TCP4 192.168.0.1 192.168.0.11 56324 443\r\n" and returns
- * an Array as follows:
- *   [ num_bytes, ip_type, ip, port ]
+ * Returns the Hash with the TLVs of a HAProxy Protocol v2 header (or nil if
+ * there is no one of interest).
+ */
+static VALUE haproxy_protocol_v2_tlvs(struct_haproxy_protocol_v2 *hp)
+{
+  TRACE();
+  VALUE tlvs;
+  int client_cert;
+
+  if (! hp->unique_id && ! hp->has_ssl)
+    return Qnil;
+
+  tlvs = rb_hash_new();
+
+  if (hp->unique_id)
+    rb_hash_aset(tlvs, symbol_unique_id, rb_str_new(hp->unique_id, hp->unique_id_len));
+
+  if (hp->has_ssl) {
+    rb_hash_aset(tlvs, symbol_ssl, (hp->ssl_client & HAPROXY_PROTOCOL_V2_CLIENT_SSL) ? Qtrue : Qfalse);
+    /* The certificate is presented in this connection or, for resumed TLS sessions, earlier in the session. */
+    client_cert = hp->ssl_client & (HAPROXY_PROTOCOL_V2_CLIENT_CERT_CONN | HAPROXY_PROTOCOL_V2_CLIENT_CERT_SESS);
+    rb_hash_aset(tlvs, symbol_ssl_client_cert, client_cert ? Qtrue : Qfalse);
+    /* verify is 0 if the client presented a certificate and it was successfully verified. */
+    rb_hash_aset(tlvs, symbol_ssl_client_cert_verified, (client_cert && hp->ssl_verify == 0) ? Qtrue : Qfalse);
+    if (hp->ssl_version)
+      rb_hash_aset(tlvs, symbol_ssl_version, rb_str_new(hp->ssl_version, hp->ssl_version_len));
+    if (hp->ssl_cn)
+      rb_hash_aset(tlvs, symbol_ssl_cn, rb_str_new(hp->ssl_cn, hp->ssl_cn_len));
+    if (hp->ssl_cipher)
+      rb_hash_aset(tlvs, symbol_ssl_cipher, rb_str_new(hp->ssl_cipher, hp->ssl_cipher_len));
+  }
+
+  return tlvs;
+}
+
+
+/*
+ * Expects a string starting with a HAProxy Protocol header, either version 1
+ * (a line like "PROXY TCP4 192.168.0.1 192.168.0.11 56324 443\r\n") or version 2
+ * (binary header, detected by its signature), and returns an Array as follows:
+ *   [ num_bytes, ip_type, ip, port, tlvs ]
  * where:
- *   - num_bytes is the length of the HAProxy Protocol line (to be removed), a Fixnum.
+ *   - num_bytes is the length of the HAProxy Protocol header (to be removed), a Fixnum.
  *   - ip_type is :ipv4 or :ipv6,
  *   - ip is a String,
  *   - port is a Fixnum
+ *   - tlvs is a Hash with the TLVs of a version 2 header (:unique_id, :ssl,
+ *     :ssl_client_cert, :ssl_client_cert_verified, :ssl_version, :ssl_cn and
+ *     :ssl_cipher), nil otherwise.
+ * ip_type, ip and port are nil for a version 2 header with LOCAL command or non
+ * IP addresses (the connection must keep the address of the proxy).
+ * If the string does not contain the whole header yet it returns nil.
  * If the string is invalid it returns false.
  */
 VALUE Utils_parser_haproxy_protocol(VALUE self, VALUE string)
@@ -341,6 +444,8 @@ VALUE Utils_parser_haproxy_protocol(VALUE self, VALUE string)
   char *str = NULL;
   long len = 0;
   struct_haproxy_protocol haproxy_protocol;
+  struct_haproxy_protocol_v2 haproxy_protocol_v2;
+  char ip_str[INET6_ADDRSTRLEN];
   VALUE num_bytes, ip_type, ip, port;
 
   if (TYPE(string) != T_STRING)
@@ -349,10 +454,49 @@ VALUE Utils_parser_haproxy_protocol(VALUE self, VALUE string)
   str = RSTRING_PTR(string);
   len = RSTRING_LEN(string);
 
+  if (len == 0)
+    return Qnil;
+
+  /* Version 2 (the signature starts with CR while version 1 starts with "PROXY"). */
+  if (str[0] == '\r') {
+    haproxy_protocol_v2 = struct_haproxy_protocol_v2_parser_execute(str, len);
+
+    switch(haproxy_protocol_v2.status) {
+      case haproxy_protocol_v2_status_incomplete:
+        return Qnil;
+      case haproxy_protocol_v2_status_invalid:
+        return Qfalse;
+      default:
+        break;
+    }
+
+    num_bytes = INT2FIX(haproxy_protocol_v2.total_len);
+
+    if (! haproxy_protocol_v2.has_address)
+      return rb_ary_new3(5, num_bytes, Qnil, Qnil, Qnil, haproxy_protocol_v2_tlvs(&haproxy_protocol_v2));
+
+    if (haproxy_protocol_v2.ip_type == haproxy_protocol_ip_type_ipv4) {
+      ip_type = symbol_ipv4;
+      inet_ntop(AF_INET, haproxy_protocol_v2.ip, ip_str, INET6_ADDRSTRLEN);
+    }
+    else {
+      ip_type = symbol_ipv6;
+      inet_ntop(AF_INET6, haproxy_protocol_v2.ip, ip_str, INET6_ADDRSTRLEN);
+    }
+
+    return rb_ary_new3(5, num_bytes, ip_type, rb_str_new_cstr(ip_str), INT2FIX(haproxy_protocol_v2.port),
+                       haproxy_protocol_v2_tlvs(&haproxy_protocol_v2));
+  }
+
   haproxy_protocol = struct_haproxy_protocol_parser_execute(str, len);
 
-  if (haproxy_protocol.valid == 0)
+  if (haproxy_protocol.valid == 0) {
+    /* The line is not complete yet (a version 1 line has at most 107 bytes). */
+    if (len < HAPROXY_PROTOCOL_V1_MAX_LEN && ! memchr(str, '\n', len) &&
+        haproxy_protocol.total_len == (unsigned short int)len)
+      return Qnil;
     return Qfalse;
+  }
   else {
     if (haproxy_protocol.ip_type == haproxy_protocol_ip_type_ipv4)
       ip_type = symbol_ipv4;
@@ -363,7 +507,7 @@ VALUE Utils_parser_haproxy_protocol(VALUE self, VALUE string)
     port = INT2FIX(str_to_int((char *)haproxy_protocol.port_s, haproxy_protocol.port_len));
     num_bytes = INT2FIX(haproxy_protocol.total_len);
 
-    return rb_ary_new3(4, num_bytes, ip_type, ip, port);
+    return rb_ary_new3(5, num_bytes, ip_type, ip, port, Qnil);
   }
 }
 
@@ -383,10 +527,18 @@ void Init_utils()
   rb_define_module_function(mUtils, "normalize_ipv6", Utils_normalize_ipv6, -1);
   rb_define_module_function(mUtils, "normalize_host", Utils_normalize_host, -1);
   rb_define_module_function(mUtils, "to_pure_ip", Utils_to_pure_ip, 1);
+  rb_define_module_function(mUtils, "connection_key", Utils_connection_key, 2);
   rb_define_module_function(mUtils, "parse_outbound_udp_flow_token", Utils_parser_outbound_udp_flow_token, 1);
   rb_define_module_function(mUtils, "parse_haproxy_protocol", Utils_parser_haproxy_protocol, 1);
 
   symbol_ipv4 = ID2SYM(rb_intern("ipv4"));
   symbol_ipv6 = ID2SYM(rb_intern("ipv6"));
   symbol_ipv6_reference = ID2SYM(rb_intern("ipv6_reference"));
+  symbol_unique_id = ID2SYM(rb_intern("unique_id"));
+  symbol_ssl = ID2SYM(rb_intern("ssl"));
+  symbol_ssl_client_cert = ID2SYM(rb_intern("ssl_client_cert"));
+  symbol_ssl_client_cert_verified = ID2SYM(rb_intern("ssl_client_cert_verified"));
+  symbol_ssl_version = ID2SYM(rb_intern("ssl_version"));
+  symbol_ssl_cn = ID2SYM(rb_intern("ssl_cn"));
+  symbol_ssl_cipher = ID2SYM(rb_intern("ssl_cipher"));
 }
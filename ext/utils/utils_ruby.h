@@ -22,6 +22,7 @@ VALUE Utils_compare_pure_ips(VALUE self, VALUE string1, VALUE string2);
 VALUE Utils_normalize_ipv6(int argc, VALUE *argv, VALUE self);
 VALUE Utils_normalize_host(int argc, VALUE *argv, VALUE self);
 VALUE Utils_to_pure_ip(VALUE self, VALUE string);
+VALUE Utils_connection_key(VALUE self, VALUE ip, VALUE port);
 VALUE Utils_parser_outbound_udp_flow_token(VALUE self, VALUE string);
 VALUE Utils_parser_haproxy_protocol(VALUE self, VALUE string);
 
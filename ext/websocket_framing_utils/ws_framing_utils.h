@@ -3,6 +3,13 @@
 
 
 #include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
 
 
 /* Extracted from http://bjoern.hoehrmann.de/utf-8/decoder/dfa/ */
@@ -38,10 +45,254 @@ uint32_t utf8_decode(uint32_t* state, uint32_t* codep, uint32_t byte) {
 }
 
 
+/*
+ * ws_unmask: XORs len bytes of src with the 4 bytes WebSocket masking key and
+ * writes the result into dst (dst and src can be the same pointer for in place
+ * unmasking).
+ *
+ * Bytes are first processed one by one until dst is 8 bytes aligned, then the
+ * mask is rotated so it matches that offset and the bulk of the payload is
+ * processed in 32/16 bytes vectors (AVX2/SSE2/NEON when the compiler enables
+ * them) and in 64 bits words, and finally the remaining tail bytes one by one.
+ * Unaligned loads/stores are always used so src alignment does not matter.
+ */
+static inline
+void ws_unmask(uint8_t *dst, const uint8_t *src, size_t len, const uint8_t *mask)
+{
+  size_t i = 0;
+  uint8_t rotated_mask[4];
+  uint32_t mask32;
+  uint64_t mask64, word;
+
+  /* Unaligned head. */
+  while (i < len && ((uintptr_t)(dst + i) & 7)) {
+    dst[i] = src[i] ^ mask[i & 3];
+    i++;
+  }
+
+  if (len - i < 8) {
+    for (; i < len; i++)
+      dst[i] = src[i] ^ mask[i & 3];
+    return;
+  }
+
+  /* Mask as it should be applied starting at offset i (in memory order, so it is endianness agnostic). */
+  rotated_mask[0] = mask[i & 3];
+  rotated_mask[1] = mask[(i + 1) & 3];
+  rotated_mask[2] = mask[(i + 2) & 3];
+  rotated_mask[3] = mask[(i + 3) & 3];
+  memcpy(&mask32, rotated_mask, 4);
+  mask64 = ((uint64_t)mask32 << 32) | mask32;
+
+#if defined(__AVX2__)
+  {
+    __m256i vmask = _mm256_set1_epi32((int)mask32);
+
+    for (; len - i >= 32; i += 32)
+      _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(src + i)), vmask));
+  }
+#endif
+#if defined(__SSE2__)
+  {
+    __m128i vmask = _mm_set1_epi32((int)mask32);
+
+    for (; len - i >= 16; i += 16)
+      _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(_mm_loadu_si128((const __m128i *)(src + i)), vmask));
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  {
+    uint8x16_t vmask = vreinterpretq_u8_u32(vdupq_n_u32(mask32));
+
+    for (; len - i >= 16; i += 16)
+      vst1q_u8(dst + i, veorq_u8(vld1q_u8(src + i), vmask));
+  }
+#endif
+
+  for (; len - i >= 8; i += 8) {
+    memcpy(&word, src + i, 8);
+    word ^= mask64;
+    memcpy(dst + i, &word, 8);
+  }
+
+  /* Tail. Every block above is a multiple of 4 bytes so the mask phase is still (i & 3). */
+  for (; i < len; i++)
+    dst[i] = src[i] ^ mask[i & 3];
+}
+
+
+#define WS_FRAME_HEADER_MAX_SIZE 10
+
+
+/*
+ * ws_frame_header: Writes into header the header of an unmasked WebSocket frame
+ * (server to client) with the given first byte (FIN, RSV1-3 and opcode) and
+ * payload length. header must have room for WS_FRAME_HEADER_MAX_SIZE bytes.
+ * Returns the header length (2, 4 or 10 bytes).
+ */
+static inline
+size_t ws_frame_header(uint8_t *header, uint8_t byte1, uint64_t payload_len)
+{
+  header[0] = byte1;
+
+  if (payload_len <= 125) {
+    header[1] = (uint8_t)payload_len;
+    return 2;
+  }
+  else if (payload_len < 65536) {
+    header[1] = 126;
+    header[2] = (uint8_t)(payload_len >> 8);
+    header[3] = (uint8_t)payload_len;
+    return 4;
+  }
+  else {
+    header[1] = 127;
+    header[2] = (uint8_t)(payload_len >> 56);
+    header[3] = (uint8_t)(payload_len >> 48);
+    header[4] = (uint8_t)(payload_len >> 40);
+    header[5] = (uint8_t)(payload_len >> 32);
+    header[6] = (uint8_t)(payload_len >> 24);
+    header[7] = (uint8_t)(payload_len >> 16);
+    header[8] = (uint8_t)(payload_len >> 8);
+    header[9] = (uint8_t)payload_len;
+    return 10;
+  }
+}
+
+
 typedef struct utf8_validator {
   uint32_t codepoint;
   uint32_t state;
 } utf8_validator;
 
 
+#define UTF8_NON_ASCII_MASK_64 0x8080808080808080ULL
+
+
+static inline
+uint32_t utf8_validate_bytes(utf8_validator *validator, const uint8_t *str, size_t len)
+{
+  size_t i;
+
+  for(i=0; i < len; i++)
+    if (utf8_decode(&validator->state, &validator->codepoint, str[i]) == UTF8_REJECT)
+      return UTF8_REJECT;
+
+  return validator->state;
+}
+
+
+/*
+ * utf8_validate: Feeds len bytes into the validator and returns its state
+ * (UTF8_REJECT as soon as an invalid sequence is found).
+ *
+ * While the validator is not in the middle of a multibyte sequence, whole
+ * blocks of pure ASCII (32/16 bytes vectors or 64 bits words) are skipped and
+ * the DFA only runs over blocks containing non ASCII bytes.
+ */
+static inline
+uint32_t utf8_validate(utf8_validator *validator, const uint8_t *str, size_t len)
+{
+  size_t i = 0;
+  uint64_t word;
+
+#if defined(__AVX2__)
+  for (; len - i >= 32; i += 32) {
+    if (validator->state == UTF8_ACCEPT && _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(str + i))) == 0)
+      continue;
+    if (utf8_validate_bytes(validator, str + i, 32) == UTF8_REJECT)
+      return UTF8_REJECT;
+  }
+#endif
+#if defined(__SSE2__)
+  for (; len - i >= 16; i += 16) {
+    if (validator->state == UTF8_ACCEPT && _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(str + i))) == 0)
+      continue;
+    if (utf8_validate_bytes(validator, str + i, 16) == UTF8_REJECT)
+      return UTF8_REJECT;
+  }
+#endif
+
+  for (; len - i >= 8; i += 8) {
+    memcpy(&word, str + i, 8);
+    if (validator->state == UTF8_ACCEPT && (word & UTF8_NON_ASCII_MASK_64) == 0)
+      continue;
+    if (utf8_validate_bytes(validator, str + i, 8) == UTF8_REJECT)
+      return UTF8_REJECT;
+  }
+
+  return utf8_validate_bytes(validator, str + i, len - i);
+}
+
+
+/*
+ * ws_unmask_utf8_validate: Unmasks len bytes of data in place and feeds them
+ * into the validator in a single pass. Each block is validated right after
+ * being unmasked (while it is still in a register or in L1 cache), skipping
+ * the DFA for pure ASCII blocks as utf8_validate() does.
+ *
+ * Returns the validator state (UTF8_REJECT as soon as an invalid sequence is
+ * found, in which case the rest of data remains masked).
+ */
+static inline
+uint32_t ws_unmask_utf8_validate(utf8_validator *validator, uint8_t *data, size_t len, const uint8_t *mask)
+{
+  size_t i = 0;
+  uint32_t mask32;
+  uint64_t mask64, word;
+
+  /* Every block below is a multiple of 4 bytes so the mask phase is always (i & 3). */
+  memcpy(&mask32, mask, 4);
+  mask64 = ((uint64_t)mask32 << 32) | mask32;
+
+#if defined(__AVX2__)
+  {
+    __m256i vmask = _mm256_set1_epi32((int)mask32);
+    __m256i block;
+
+    for (; len - i >= 32; i += 32) {
+      block = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(data + i)), vmask);
+      _mm256_storeu_si256((__m256i *)(data + i), block);
+      if (validator->state == UTF8_ACCEPT && _mm256_movemask_epi8(block) == 0)
+        continue;
+      if (utf8_validate_bytes(validator, data + i, 32) == UTF8_REJECT)
+        return UTF8_REJECT;
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  {
+    __m128i vmask = _mm_set1_epi32((int)mask32);
+    __m128i block;
+
+    for (; len - i >= 16; i += 16) {
+      block = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(data + i)), vmask);
+      _mm_storeu_si128((__m128i *)(data + i), block);
+      if (validator->state == UTF8_ACCEPT && _mm_movemask_epi8(block) == 0)
+        continue;
+      if (utf8_validate_bytes(validator, data + i, 16) == UTF8_REJECT)
+        return UTF8_REJECT;
+    }
+  }
+#endif
+
+  for (; len - i >= 8; i += 8) {
+    memcpy(&word, data + i, 8);
+    word ^= mask64;
+    memcpy(data + i, &word, 8);
+    if (validator->state == UTF8_ACCEPT && (word & UTF8_NON_ASCII_MASK_64) == 0)
+      continue;
+    if (utf8_validate_bytes(validator, data + i, 8) == UTF8_REJECT)
+      return UTF8_REJECT;
+  }
+
+  for (; i < len; i++) {
+    data[i] ^= mask[i & 3];
+    if (utf8_decode(&validator->state, &validator->codepoint, data[i]) == UTF8_REJECT)
+      return UTF8_REJECT;
+  }
+
+  return validator->state;
+}
+
+
 #endif
@@ -14,13 +14,13 @@ static VALUE cUtf8Validator;
  * Ruby functions.
  */
 
+/*
+ * Returns a new String with the given payload unmasked.
+ */
 VALUE WsFramingUtils_unmask(VALUE self, VALUE payload, VALUE mask)
 {
-  char *payload_str, *mask_str;
-  long payload_len;  /* mask length is always 4 bytes. */
-  char *unmasked_payload_str;
   VALUE rb_unmasked_payload;
-  int i;
+  long payload_len;  /* mask length is always 4 bytes. */
 
   if (TYPE(payload) != T_STRING)
     rb_raise(rb_eTypeError, "Argument must be a String");
@@ -31,25 +31,81 @@ VALUE WsFramingUtils_unmask(VALUE self, VALUE payload, VALUE mask)
   if (RSTRING_LEN(mask) != 4)
     rb_raise(rb_eTypeError, "mask size must be 4 bytes");
 
-  payload_str = RSTRING_PTR(payload);
   payload_len = RSTRING_LEN(payload);
-  mask_str = RSTRING_PTR(mask);
 
-  /* NOTE: In Ruby C extensions always use:
-   *    pointer = ALLOC_N(type, n)
-   * which means: pointer = (type*)xmalloc(sizeof(type)*(n))
-   * and:
-   *    xfree()
-   */
+  /* Unmask directly into the memory of the new Ruby String (no intermediate buffer). */
+  rb_unmasked_payload = rb_str_new(NULL, payload_len);
+  ws_unmask((uint8_t *)RSTRING_PTR(rb_unmasked_payload), (uint8_t *)RSTRING_PTR(payload), payload_len, (uint8_t *)RSTRING_PTR(mask));
 
-  unmasked_payload_str = ALLOC_N(char, payload_len);
+  return(rb_unmasked_payload);
+}
 
-  for(i=0; i < payload_len; i++)
-    unmasked_payload_str[i] = payload_str[i] ^ mask_str[i % 4];
 
-  rb_unmasked_payload = rb_str_new(unmasked_payload_str, payload_len);
-  xfree(unmasked_payload_str);
-  return(rb_unmasked_payload);
+/*
+ * Unmasks the given payload in place and returns it. Intended for Strings
+ * owned by the caller (i.e. the result of IO::Buffer#read).
+ */
+VALUE WsFramingUtils_unmask_bang(VALUE self, VALUE payload, VALUE mask)
+{
+  if (TYPE(payload) != T_STRING)
+    rb_raise(rb_eTypeError, "Argument must be a String");
+
+  if (TYPE(mask) != T_STRING)
+    rb_raise(rb_eTypeError, "Argument must be a String");
+
+  if (RSTRING_LEN(mask) != 4)
+    rb_raise(rb_eTypeError, "mask size must be 4 bytes");
+
+  rb_str_modify(payload);
+  ws_unmask((uint8_t *)RSTRING_PTR(payload), (uint8_t *)RSTRING_PTR(payload), RSTRING_LEN(payload), (uint8_t *)RSTRING_PTR(mask));
+
+  return(payload);
+}
+
+
+/*
+ * Returns the header (2, 4 or 10 bytes String) of a WebSocket frame with the
+ * given first byte (FIN, RSV1-3 and opcode) and payload length.
+ */
+VALUE WsFramingUtils_frame_header(VALUE self, VALUE byte1, VALUE payload_len)
+{
+  uint8_t header[WS_FRAME_HEADER_MAX_SIZE];
+  size_t header_len;
+
+  header_len = ws_frame_header(header, (uint8_t)NUM2UINT(byte1), NUM2ULL(payload_len));
+
+  return(rb_str_new((char *)header, header_len));
+}
+
+
+/*
+ * Returns a full WebSocket frame (header and payload) with the given first byte
+ * (FIN, RSV1-3 and opcode). The payload can be nil. The frame is written into a
+ * single String of the exact size.
+ */
+VALUE WsFramingUtils_frame(VALUE self, VALUE byte1, VALUE payload)
+{
+  uint8_t header[WS_FRAME_HEADER_MAX_SIZE];
+  size_t header_len;
+  long payload_len = 0;
+  VALUE rb_frame;
+  char *frame_str;
+
+  if (! NIL_P(payload)) {
+    if (TYPE(payload) != T_STRING)
+      rb_raise(rb_eTypeError, "payload must be a String or nil");
+    payload_len = RSTRING_LEN(payload);
+  }
+
+  header_len = ws_frame_header(header, (uint8_t)NUM2UINT(byte1), payload_len);
+
+  rb_frame = rb_str_new(NULL, header_len + payload_len);
+  frame_str = RSTRING_PTR(rb_frame);
+  memcpy(frame_str, header, header_len);
+  if (payload_len)
+    memcpy(frame_str + header_len, RSTRING_PTR(payload), payload_len);
+
+  return(rb_frame);
 }
 
 
@@ -97,22 +153,57 @@ VALUE Utf8Validator_validate(VALUE self, VALUE string)
 {
   TRACE();
   utf8_validator *validator = NULL;
-  uint8_t *str = NULL;
-  int i;
 
   REQUIRE_TYPE(string, T_STRING);
-  str = (uint8_t *)RSTRING_PTR(string);
 
   DATA_GET(self, utf8_validator, validator);
 
-  for(i=0; i < RSTRING_LEN(string); i++)
-    if (utf8_decode(&validator->state, &validator->codepoint, str[i]) == UTF8_REJECT)
+  switch(utf8_validate(validator, (uint8_t *)RSTRING_PTR(string), RSTRING_LEN(string))) {
+    case UTF8_ACCEPT:
+      return Qtrue;
+      break;
+    case UTF8_REJECT:
       return Qfalse;
+      break;
+    default:
+      return Qnil;
+      break;
+  }
+}
+
 
-  switch(validator->state) {
+/*
+ * Unmasks the given payload in place and validates it as UTF-8 in a single pass
+ * (the validator state is kept so fragmented messages can be validated frame by
+ * frame).
+ *
+ * Returns:
+ * - true: Valid UTF-8 string.
+ * - nil: Valid but not terminated UTF-8 string.
+ * - false: Invalid UTF-8 string (the payload may remain partially masked).
+ */
+VALUE Utf8Validator_unmask_and_validate(VALUE self, VALUE payload, VALUE mask)
+{
+  TRACE();
+  utf8_validator *validator = NULL;
+
+  REQUIRE_TYPE(payload, T_STRING);
+  REQUIRE_TYPE(mask, T_STRING);
+
+  if (RSTRING_LEN(mask) != 4)
+    rb_raise(rb_eTypeError, "mask size must be 4 bytes");
+
+  DATA_GET(self, utf8_validator, validator);
+
+  rb_str_modify(payload);
+
+  switch(ws_unmask_utf8_validate(validator, (uint8_t *)RSTRING_PTR(payload), RSTRING_LEN(payload), (uint8_t *)RSTRING_PTR(mask))) {
     case UTF8_ACCEPT:
       return Qtrue;
       break;
+    case UTF8_REJECT:
+      return Qfalse;
+      break;
     default:
       return Qnil;
       break;
@@ -128,8 +219,12 @@ void Init_ws_framing_utils()
   cUtf8Validator = rb_define_class_under(mFramingUtils, "Utf8Validator", rb_cObject);
 
   rb_define_module_function(mFramingUtils, "unmask", WsFramingUtils_unmask,2);
+  rb_define_module_function(mFramingUtils, "unmask!", WsFramingUtils_unmask_bang,2);
+  rb_define_module_function(mFramingUtils, "frame_header", WsFramingUtils_frame_header,2);
+  rb_define_module_function(mFramingUtils, "frame", WsFramingUtils_frame,2);
 
   rb_define_alloc_func(cUtf8Validator, Utf8Validator_alloc);
   rb_define_method(cUtf8Validator, "reset", Utf8Validator_reset,0);
   rb_define_method(cUtf8Validator, "validate", Utf8Validator_validate,1);
+  rb_define_method(cUtf8Validator, "unmask_and_validate!", Utf8Validator_unmask_and_validate,2);
 }
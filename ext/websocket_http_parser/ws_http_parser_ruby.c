@@ -32,6 +32,7 @@ static ID id_hdr_upgrade;
 static ID id_hdr_sec_websocket_version;
 static ID id_hdr_sec_websocket_key;
 static ID id_hdr_sec_websocket_protocol;
+static ID id_hdr_sec_websocket_extensions;
 static ID id_hdr_origin;
 
 static VALUE symbol_GET;
@@ -42,6 +43,45 @@ static VALUE symbol_https;
 
 
 
+/*
+ * Stores the next comma separated extension offer (without surrounding spaces)
+ * found between ch and end into the @hdr_sec_websocket_extensions Array and
+ * returns a pointer to the position after it.
+ */
+static char *req_hdr_sec_websocket_extension_offer(VALUE parsed, char *ch, char *end)
+{
+  TRACE();
+  char *offer_end, *last;
+  VALUE v;
+  VALUE array;
+
+  while (ch < end && (*ch == ' ' || *ch == '\t'))
+    ch++;
+
+  if (! (offer_end = strnchr(ch, end - ch, ',')))
+    offer_end = end;
+
+  last = offer_end;
+  while (last > ch && (*(last-1) == ' ' || *(last-1) == '\t'))
+    last--;
+
+  if (last > ch) {
+    v = rb_str_new(ch, last - ch);
+    array = rb_ivar_get(parsed, id_hdr_sec_websocket_extensions);
+    switch(TYPE(array)) {
+      case T_ARRAY:
+        rb_ary_push(array, v);
+        break;
+      default:
+        rb_ivar_set(parsed, id_hdr_sec_websocket_extensions, rb_ary_new3(1, v));
+        break;
+    }
+  }
+
+  return offer_end + 1;
+}
+
+
 static void header(void *data, const char *hdr_field, size_t hdr_field_len, const char *hdr_value, size_t hdr_value_len)
 {
   TRACE();
@@ -65,6 +105,17 @@ static void header(void *data, const char *hdr_field, size_t hdr_field_len, cons
       rb_hash_aset(parsed, f, rb_ary_new3(1, v));
       break;
   }
+
+  /*
+   * Sec-WebSocket-Extensions is not a defined header in the grammar, so split its
+   * value into extension offers here (parameters are parsed by the extension itself).
+   */
+  if (hdr_field_len == 24 && ! strncasecmp(hdr_field, "Sec-WebSocket-Extensions", 24)) {
+    ch = (char *)hdr_value;
+    end = (char *)hdr_value + hdr_value_len;
+    while (ch < end)
+      ch = req_hdr_sec_websocket_extension_offer(parsed, ch, end);
+  }
 }
 
 
@@ -620,6 +671,7 @@ void Init_ws_http_parser()
   id_hdr_sec_websocket_version = rb_intern("@hdr_sec_websocket_version");
   id_hdr_sec_websocket_key = rb_intern("@hdr_sec_websocket_key");
   id_hdr_sec_websocket_protocol = rb_intern("@hdr_sec_websocket_protocol");
+  id_hdr_sec_websocket_extensions = rb_intern("@hdr_sec_websocket_extensions");
   id_hdr_origin = rb_intern("@hdr_origin");
 
   symbol_GET = ID2SYM(rb_intern("GET"));
@@ -19,6 +19,7 @@ require "digest/sha1"
 require "securerandom"
 require "fiber"
 require "openssl"
+require "zlib"
 
 
 # Ruby external gems.
@@ -43,7 +44,12 @@ require "em-synchrony"
 # OverSIP files.
 
 require "oversip/version.rb"
+require "oversip/log_ring.#{RbConfig::CONFIG["DLEXT"]}"
 require "oversip/syslog.rb"
+require "oversip/capture.#{RbConfig::CONFIG["DLEXT"]}"
+require "oversip/capture.rb"
+require "oversip/metrics.#{RbConfig::CONFIG["DLEXT"]}"
+require "oversip/metrics.rb"
 require "oversip/logger.rb"
 require "oversip/config.rb"
 require "oversip/config_validators.rb"
@@ -70,8 +76,12 @@ require "oversip/sip/launcher.rb"
 require "oversip/sip/server_transaction.rb"
 require "oversip/sip/client_transaction.rb"
 require "oversip/sip/transport_manager.rb"
+require "oversip/sip/connection_pool.rb"
 require "oversip/sip/timers.rb"
 require "oversip/sip/tags.rb"
+require "oversip/sip/latency.rb"
+require "oversip/sip/overload_control.rb"
+require "oversip/sip/allocations.rb"
 require "oversip/sip/rfc3263.rb"
 require "oversip/sip/client.rb"
 require "oversip/sip/proxy.rb"
@@ -85,10 +95,14 @@ require "oversip/websocket/http_request.rb"
 require "oversip/websocket/listeners.rb"
 require "oversip/websocket/launcher.rb"
 require "oversip/websocket/ws_framing_utils.#{RbConfig::CONFIG["DLEXT"]}"
+require "oversip/websocket/permessage_deflate.rb"
 require "oversip/websocket/ws_framing.rb"
 require "oversip/websocket/ws_sip_app.rb"
 
 require "oversip/fiber_pool.rb"
+require "oversip/keepalive_scheduler.rb"
+require "oversip/deadline_wheel.rb"
+require "oversip/reactor_probe.rb"
 require "oversip/tls.rb"
 require "oversip/stun.#{RbConfig::CONFIG["DLEXT"]}"
 
@@ -108,7 +122,8 @@ module OverSIP
                   :stud_pids,
                   :is_ready,  # true, false
                   :status,  # :loading, :running, :terminating
-                  :root_fiber
+                  :root_fiber,
+                  :fiber_pool  # Runs OverSIP::SipEvents.on_request() and TLS handshake callbacks.
 
     def daemonized?
       @daemonized
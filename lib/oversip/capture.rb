@@ -0,0 +1,31 @@
+module OverSIP
+
+  # SIP message capture (see ext/capture). When core[capture_file] is set every SIP
+  # message received or sent (UDP, TCP, TLS, WS and WSS) is stored as a HEP3 packet
+  # into a fixed size memory-mapped ring file, and $oversip_capture is true.
+  # Use bin/oversip_capture for extracting the captured messages.
+  module Capture
+
+    extend ::OverSIP::Logger
+
+    @log_id = "Capture"
+
+    def self.module_init
+      conf = ::OverSIP.configuration[:core]
+      $oversip_capture = false
+
+      return  unless conf[:capture_file]
+
+      begin
+        kept = open conf[:capture_file], conf[:capture_file_size] * 1048576
+      rescue ::SystemCallError => e
+        ::OverSIP::Launcher.fatal "cannot create capture file '#{conf[:capture_file]}': #{e.message}"
+      end
+
+      log_system_notice "capturing SIP messages into '#{conf[:capture_file]}' (#{conf[:capture_file_size]} MB#{", keeping the previous capture"  if kept})"
+      $oversip_capture = true
+    end
+
+  end
+
+end
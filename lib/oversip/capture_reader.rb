@@ -0,0 +1,107 @@
+module OverSIP
+
+  # Reader of the SIP capture files written by OverSIP (see OverSIP::Capture), used
+  # by bin/oversip_capture and bin/oversip_replay.
+  class CaptureReader
+
+    MAGIC = "OVSCAP01"
+    HEADER_FORMAT = "a8LLQQQQ"
+    HEP3_MAGIC = "HEP3"
+    CALL_ID_REGEXP = /^(?:Call-ID|i)[ \t]*:[ \t]*([^\r\n]+?)[ \t]*\r?$/i
+    TRANSPORTS = { 6 => "TCP", 17 => "UDP" }
+
+    Packet = ::Struct.new(:raw, :time, :ip_protocol, :src_ip, :src_port, :dst_ip, :dst_port, :payload) do
+      def call_id
+        headers = payload.split(/\r?\n\r?\n/, 2).first
+        headers =~ CALL_ID_REGEXP ? $1 : nil
+      end
+
+      def src
+        src_ip.include?(":") ? "[#{src_ip}]:#{src_port}" : "#{src_ip}:#{src_port}"
+      end
+
+      def dst
+        dst_ip.include?(":") ? "[#{dst_ip}]:#{dst_port}" : "#{dst_ip}:#{dst_port}"
+      end
+    end
+
+    # file can be a capture ring file or a file with HEP3 packets (as written by
+    # "oversip_capture --hep").
+    def initialize file
+      @file = file
+      data = ::File.binread file
+
+      if data.start_with? HEP3_MAGIC
+        @data = data
+        @data_size = @head = data.bytesize
+        @wraps = 0
+        return
+      end
+
+      magic, header_size, _, @data_size, @head, @wraps, @num_packets = data.unpack(HEADER_FORMAT)
+      raise ::ArgumentError, "#{file} is not an OverSIP capture file"  unless magic == MAGIC
+
+      @data = data.byteslice(header_size, @data_size)
+    end
+
+    # Yields the captured packets from the oldest to the newest.
+    def each_packet
+      if @wraps > 0
+        # The oldest packet is the first valid one after head.
+        pos = @head
+        while (pos = @data.index(HEP3_MAGIC, pos))
+          break  if parse_packet(pos)
+          pos += 1
+        end
+
+        while pos and (packet = parse_packet(pos))
+          yield packet
+          pos += packet.raw.bytesize
+        end
+      end
+
+      pos = 0
+      while pos < @head and (packet = parse_packet(pos))
+        yield packet
+        pos += packet.raw.bytesize
+      end
+    end
+
+    private
+
+    def parse_packet pos
+      return nil  unless @data.byteslice(pos, 4) == HEP3_MAGIC
+      length = @data.byteslice(pos + 4, 2).unpack("n").first
+      return nil  if length.nil? or length < 6 or pos + length > @data.bytesize
+
+      raw = @data.byteslice(pos, length)
+      packet = Packet.new raw
+      offset = 6
+
+      while offset < length
+        return nil  if offset + 6 > length
+        _, type, chunk_length = raw.byteslice(offset, 6).unpack("nnn")
+        return nil  if chunk_length < 6 or offset + chunk_length > length
+        value = raw.byteslice(offset + 6, chunk_length - 6)
+
+        case type
+        when 0x0002 ; packet.ip_protocol = value.unpack("C").first
+        when 0x0003, 0x0005 ; packet.src_ip = ::IPAddr.new_ntoh(value).to_s
+        when 0x0004, 0x0006 ; packet.dst_ip = ::IPAddr.new_ntoh(value).to_s
+        when 0x0007 ; packet.src_port = value.unpack("n").first
+        when 0x0008 ; packet.dst_port = value.unpack("n").first
+        when 0x0009 ; packet.time = ::Time.at(value.unpack("N").first)
+        when 0x000a ; packet.time += value.unpack("N").first / 1000000.0  if packet.time
+        when 0x000f ; packet.payload = value
+        end
+
+        offset += chunk_length
+      end
+
+      return nil  unless packet.payload and packet.src_ip and packet.dst_ip
+      packet
+    end
+
+  end
+
+end
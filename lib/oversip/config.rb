@@ -24,7 +24,16 @@ module OverSIP
       :core => {
         :nameservers              => nil,
         :syslog_facility          => "user",
-        :syslog_level             => "info"
+        :syslog_level             => "info",
+        :capture_file             => nil,
+        :capture_file_size        => 64,
+        :metrics_port             => nil,
+        :metrics_socket           => nil,
+        :latency_trace_size       => nil,
+        :slow_callback_threshold  => nil,
+        :fiber_pool_size          => 100,
+        :fiber_pool_max_queue     => 1000,
+        :allocation_tracking      => false
       },
       :sip => {
         :sip_udp                  => true,
@@ -43,6 +52,14 @@ module OverSIP
         :callback_on_client_tls_handshake => true,
         :local_domains            => nil,
         :tcp_keepalive_interval   => nil,
+        :crlf_keepalive_interval  => nil,
+        :idle_connection_timeout  => nil,
+        :connection_pool          => nil,
+        :connection_pool_size     => 2,
+        :connection_pool_callback_on_server_tls_handshake => true,
+        :overload_max_lag         => nil,
+        :overload_max_transactions => nil,
+        :overload_retry_after     => 5,
         :record_route_hostname_tls_ipv4 => nil,
         :record_route_hostname_tls_ipv6 => nil
       },
@@ -62,7 +79,11 @@ module OverSIP
         :callback_on_client_tls_handshake => true,
         :max_ws_message_size      => 65536,
         :max_ws_frame_size        => 65536,
-        :ws_keepalive_interval    => nil
+        :ws_keepalive_interval    => nil,
+        :permessage_deflate       => false,
+        :permessage_deflate_window_bits => 12,
+        :permessage_deflate_mem_level => 5,
+        :permessage_deflate_context_takeover => true
       },
       :tls => {
         :public_cert              => nil,
@@ -82,6 +103,15 @@ module OverSIP
           [ :choices,
             %w{ debug info notice warn error crit } ]
         ],
+        :capture_file                    => :string,
+        :capture_file_size               => [ :fixnum, [ :greater_equal_than, 1 ] ],
+        :metrics_port                    => :port,
+        :metrics_socket                  => :string,
+        :latency_trace_size              => [ :fixnum, [ :greater_equal_than, 1 ] ],
+        :slow_callback_threshold         => [ :fixnum, [ :greater_equal_than, 1 ] ],
+        :fiber_pool_size                 => [ :fixnum, [ :greater_equal_than, 1 ] ],
+        :fiber_pool_max_queue            => [ :fixnum, [ :greater_equal_than, 0 ] ],
+        :allocation_tracking             => :boolean,
       },
       :sip => {
         :sip_udp                         => :boolean,
@@ -100,6 +130,14 @@ module OverSIP
         :callback_on_client_tls_handshake => :boolean,
         :local_domains                   => [ :domain, :multi_value ],
         :tcp_keepalive_interval          => [ :fixnum, [ :greater_equal_than, 180 ] ],
+        :crlf_keepalive_interval         => [ :fixnum, [ :greater_equal_than, 10 ] ],
+        :idle_connection_timeout         => [ :fixnum, [ :greater_equal_than, 30 ] ],
+        :connection_pool                 => [ :connection_pool_destination, :multi_value ],
+        :connection_pool_size            => [ :fixnum, [ :greater_equal_than, 1 ], [ :minor_equal_than, 16 ] ],
+        :connection_pool_callback_on_server_tls_handshake => :boolean,
+        :overload_max_lag                => [ :fixnum, [ :greater_equal_than, 10 ] ],
+        :overload_max_transactions       => [ :fixnum, [ :greater_equal_than, 1 ] ],
+        :overload_retry_after            => [ :fixnum, [ :greater_equal_than, 1 ] ],
         :record_route_hostname_tls_ipv4  => :domain,
         :record_route_hostname_tls_ipv6  => :domain,
       },
@@ -119,7 +157,11 @@ module OverSIP
         :callback_on_client_tls_handshake => :boolean,
         :max_ws_message_size             => [ :fixnum, [ :minor_than, 1048576 ] ],
         :max_ws_frame_size               => [ :fixnum, [ :minor_than, 1048576 ] ],
-        :ws_keepalive_interval           => [ :fixnum, [ :greater_equal_than, 180 ] ]
+        :ws_keepalive_interval           => [ :fixnum, [ :greater_equal_than, 180 ] ],
+        :permessage_deflate              => :boolean,
+        :permessage_deflate_window_bits  => [ :fixnum, [ :greater_equal_than, 9 ], [ :minor_equal_than, 15 ] ],
+        :permessage_deflate_mem_level    => [ :fixnum, [ :greater_equal_than, 1 ], [ :minor_equal_than, 9 ] ],
+        :permessage_deflate_context_takeover => :boolean
       },
       :tls => {
         :public_cert                     => [ :readable_file, :tls_pem_chain ],
@@ -419,7 +461,7 @@ module OverSIP
         end
 
         if @configuration[:websocket][:sip_wss]
-          unless @configuration[:sip][:use_tls_tunnel]
+          unless @configuration[:websocket][:use_tls_tunnel]
             binds[:tcp] << [ ipv4, @configuration[:websocket][:listen_port_tls] ]
           else
             binds[:tcp] << [ "127.0.0.1", @configuration[:websocket][:listen_port_tls_tunnel] ]
@@ -435,7 +477,7 @@ module OverSIP
         end
 
         if @configuration[:websocket][:sip_wss]
-          unless @configuration[:sip][:use_tls_tunnel]
+          unless @configuration[:websocket][:use_tls_tunnel]
             binds[:tcp] << [ ipv6, @configuration[:websocket][:listen_port_tls] ]
           else
             binds[:tcp] << [ "::1", @configuration[:websocket][:listen_port_tls_tunnel] ]
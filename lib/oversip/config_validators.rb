@@ -48,6 +48,14 @@ module OverSIP
         ::OverSIP::Utils.ip_type(value) == :ipv6
       end
 
+      # A destination like "tls:1.2.3.4:5061" or "tcp:[2001:db8::1]:5060".
+      def connection_pool_destination value
+        return false  unless value.is_a? ::String
+        return false  unless value =~ /\A(tcp|tls):(.+):(\d+)\z/i
+        ip, port = $2, $3.to_i
+        [ :ipv4, :ipv6 ].include? ::OverSIP::Utils.ip_type(::OverSIP::Utils.to_pure_ip(ip)) and port.between?(1,65535)
+      end
+
       def domain value
         value =~ DOMAIN_REGEXP
       end
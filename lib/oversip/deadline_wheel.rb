@@ -0,0 +1,90 @@
+module OverSIP
+
+  # Single timing wheel with the deadlines of all the TCP, TLS and WebSocket
+  # connections (rather than an EM::Timer per connection): TLS handshake, headers
+  # and body completion and idle timeouts.
+  #
+  # Each connection has at most one deadline (arming a new one replaces the previous
+  # one) and both arm and disarm are O(1). A single periodic timer processes one slot
+  # per tick and calls connection.deadline_expired(reason) for expired connections
+  # (which returns true if it closes the connection).
+  module DeadlineWheel
+
+    extend ::OverSIP::Logger
+
+    @log_id = "DeadlineWheel"
+
+    # Granularity (seconds) of the wheel.
+    TICK = 1
+    # Number of slots (so max deadline is (SIZE - 1) * TICK seconds).
+    SIZE = 4096
+
+    @slots = ::Array.new SIZE
+    # Slot of every connection with an armed deadline.
+    @connections = {}.compare_by_identity
+    @current = 0
+    @num_reaped = ::Hash.new 0
+
+    class << self
+      # Hash with the number of connections closed by an expired deadline, by reason.
+      attr_reader :num_reaped
+    end
+
+
+    def self.arm connection, seconds, reason
+      @timer ||= ::EM::PeriodicTimer.new(TICK) { tick }
+
+      if (slot = @connections[connection])
+        @slots[slot].delete connection
+      end
+
+      ticks = ( seconds.to_f / TICK ).ceil
+      ticks = 1  if ticks < 1
+      ticks = SIZE - 1  if ticks >= SIZE
+
+      slot = ( @current + ticks ) % SIZE
+      ( @slots[slot] ||= {}.compare_by_identity )[connection] = reason
+      @connections[connection] = slot
+    end
+
+
+    def self.disarm connection
+      if (slot = @connections.delete connection)
+        @slots[slot].delete connection
+      end
+    end
+
+
+    # Reason of the armed deadline of the given connection (nil if none).
+    def self.armed connection
+      if (slot = @connections[connection])
+        @slots[slot][connection]
+      end
+    end
+
+
+    def self.tick
+      @current = ( @current + 1 ) % SIZE
+      return  unless (slot = @slots[@current]) and not slot.empty?
+
+      # Connections can arm new deadlines within deadline_expired().
+      @slots[@current] = nil
+
+      slot.each do |connection, reason|
+        @connections.delete connection
+
+        begin
+          @num_reaped[reason] += 1  if connection.deadline_expired reason
+        rescue => e
+          log_system_error "error reaping connection:"
+          log_system_error e
+        end
+      end
+
+      log_system_debug "#{slot.size} deadlines expired"  if $oversip_debug
+    end
+    private_class_method :tick
+
+  end
+
+end
@@ -1,56 +1,174 @@
-# NOTE: Extracted from https://github.com/schmurfy/fiber_pool.
+# NOTE: Based on https://github.com/schmurfy/fiber_pool.
 
 module OverSIP
   class FiberPool
 
+    include ::OverSIP::Logger
+
+    LOG_ID = "FiberPool"
+    def log_id
+      LOG_ID
+    end
+
+    QUEUE_WAIT_BUCKETS = [ 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 ]
+
+    # Initial capacity of the queue when it has no max size.
+    QUEUE_INITIAL_CAPACITY = 64
+
+    attr_reader :name, :size, :max_queue
+    attr_reader :num_busy, :queue_size
+    attr_reader :num_spawned, :num_queued, :num_rejected, :num_died
+
+    # Called (with no arguments) every time a block is rejected due to full queue.
+    attr_accessor :on_reject
+
     # Prepare a list of fibers that are able to run different blocks of code
     # every time. Once a fiber is done with its block, it attempts to fetch
     # another one from the queue.
-    def initialize count = 100
-      @fibers,@busy_fibers,@queue = [],{},[]
+    #
+    # When all the fibers are busy blocks are queued (up to max_queue blocks, nil
+    # means no limit) in a ring buffer. Pools with name export their occupancy,
+    # queue size and queue wait time as metrics.
+    #
+    # Every operation is O(1): idle fibers are kept in a stack, and a fiber dying
+    # (its block raised an exception, which is propagated to whoever resumed it)
+    # is replaced by a new one in that moment.
+    def initialize count = 100, max_queue = nil, name = nil
+      @size = count
+      @max_queue = max_queue
+      @name = name
+
+      @fibers = []
+      @num_busy = 0
+
+      # Ring buffer with the queued blocks and the time in which they were queued.
+      capacity = max_queue || QUEUE_INITIAL_CAPACITY
+      @queue = ::Array.new capacity
+      @queued_at = ::Array.new capacity
+      @queue_head = 0
+      @queue_size = 0
 
-      count.times do |i|
-        add_fiber()
+      @num_spawned = 0
+      @num_queued = 0
+      @num_rejected = 0
+      @num_died = 0
+
+      if name
+        @busy_metric = ::OverSIP::Metrics.register :gauge, "oversip_fiber_pool_busy", "Busy fibers in the pool", %{pool="#{name}"}
+        @queued_metric = ::OverSIP::Metrics.register :gauge, "oversip_fiber_pool_queued", "Blocks waiting for a free fiber", %{pool="#{name}"}
+        @rejected_metric = ::OverSIP::Metrics.register :counter, "oversip_fiber_pool_rejected_total", "Blocks rejected due to full queue", %{pool="#{name}"}
+        @died_metric = ::OverSIP::Metrics.register :counter, "oversip_fiber_pool_died_total", "Fibers terminated by an exception", %{pool="#{name}"}
+        @queue_wait_metric = ::OverSIP::Metrics.register :histogram, "oversip_fiber_pool_queue_wait_seconds", "Time waited by queued blocks", %{pool="#{name}"}, QUEUE_WAIT_BUCKETS
+      end
+
+      count.times do
+        @fibers << new_fiber
+      end
+    end
+
+
+    # If there is an available fiber use it, otherwise, leave it to linger
+    # in a queue. Returns false (and the block is not run) if the queue is full.
+    def spawn &block
+      @num_spawned += 1
+
+      if (fiber = @fibers.pop)
+        @num_busy += 1
+        ::OverSIP::Metrics.set @busy_metric, @num_busy  if @name
+        fiber.resume block
+      elsif enqueue block
+        @num_queued += 1
+      else
+        @num_rejected += 1
+        ::OverSIP::Metrics.inc @rejected_metric  if @name
+        log_system_debug "#{@name} fiber pool queue full (#{@max_queue} blocks), rejecting"  if $oversip_debug
+        @on_reject.call  if @on_reject
+        return false
       end
+
+      true
     end
 
-    def add_fiber
-      fiber = ::Fiber.new do |block|
-        loop do
-          block.call
-          unless @queue.empty?
-            block = @queue.shift
-          else
-            @busy_fibers.delete ::Fiber.current.object_id
-            @fibers.unshift ::Fiber.current
+
+    private
+
+
+    def new_fiber
+      ::Fiber.new do |block|
+        begin
+          loop do
+            block.call
+            next  if (block = dequeue)
+
+            @num_busy -= 1
+            ::OverSIP::Metrics.set @busy_metric, @num_busy  if @name
+            @fibers << ::Fiber.current
             block = ::Fiber.yield
           end
+        ensure
+          # Just reached if the block raised an exception (which terminates the fiber).
+          fiber_died
         end
       end
+    end
 
-      @fibers << fiber
-      fiber
+
+    def fiber_died
+      @num_died += 1
+      ::OverSIP::Metrics.inc @died_metric  if @name
+
+      fiber = new_fiber
+      # Run the next queued block (if any) in the new fiber once this one has terminated.
+      # The block is dequeued now, otherwise another fiber could take it in the meanwhile.
+      if (block = dequeue)
+        ::EM.next_tick { fiber.resume block }
+      else
+        @num_busy -= 1
+        ::OverSIP::Metrics.set @busy_metric, @num_busy  if @name
+        @fibers << fiber
+      end
     end
-    private :add_fiber
 
-    # If there is an available fiber use it, otherwise, leave it to linger
-    # in a queue.
-    def spawn &block
-      # resurrect dead fibers
-      @busy_fibers.values.reject(&:alive?).each do |f|
-        @busy_fibers.delete f.object_id
-        add_fiber()
+
+    def enqueue block
+      capacity = @queue.size
+      if @queue_size == capacity
+        return false  if @max_queue
+        grow_queue
+        capacity = @queue.size
       end
 
-      if (fiber = @fibers.shift)
-        @busy_fibers[fiber.object_id] = fiber
-        fiber.resume block
-      else
-        @queue << block
+      index = ( @queue_head + @queue_size ) % capacity
+      @queue[index] = block
+      @queued_at[index] = ::Process.clock_gettime(::Process::CLOCK_MONOTONIC)  if @name
+      @queue_size += 1
+      ::OverSIP::Metrics.set @queued_metric, @queue_size  if @name
+      true
+    end
+
+
+    def dequeue
+      return nil  if @queue_size == 0
+
+      block = @queue[@queue_head]
+      @queue[@queue_head] = nil
+      if @name
+        ::OverSIP::Metrics.observe @queue_wait_metric, ::Process.clock_gettime(::Process::CLOCK_MONOTONIC) - @queued_at[@queue_head]
       end
+      @queue_head = ( @queue_head + 1 ) % @queue.size
+      @queue_size -= 1
+      ::OverSIP::Metrics.set @queued_metric, @queue_size  if @name
+      block
+    end
+
 
-      fiber
+    # Double the capacity of the ring buffer (just for pools with no max_queue).
+    def grow_queue
+      capacity = @queue.size
+      @queue = @queue.rotate(@queue_head) + ::Array.new(capacity)
+      @queued_at = @queued_at.rotate(@queue_head) + ::Array.new(capacity)
+      @queue_head = 0
     end
 
   end  # class FiberPool
-end
\ No newline at end of file
+end
@@ -0,0 +1,104 @@
+module OverSIP
+
+  # Single keepalive scheduler for all the connections using the same keepalive
+  # interval (rather than a periodic timer per connection).
+  #
+  # Connections are stored in a wheel of buckets (one per TICK seconds within the
+  # interval) and a single periodic timer processes one bucket per tick, so pings
+  # are sent in batches and each connection is visited once per interval.
+  #
+  # Scheduled connections must implement:
+  # - keepalive?           : false if the connection must be removed from the scheduler.
+  # - keepalive_activity   : true if data was received since the last visit (then no
+  #                          ping is sent in this round). The scheduler resets it.
+  # - keepalive_activity=
+  # - send_keepalive       : sends the keepalive ping.
+  class KeepAliveScheduler
+
+    include ::OverSIP::Logger
+
+    # Granularity (seconds) of the wheel.
+    TICK = 1
+
+    @schedulers = {}
+
+    # Returns the scheduler for the given interval (creating it if needed).
+    def self.for_interval interval
+      @schedulers[interval] ||= new interval
+    end
+
+    def self.schedulers
+      @schedulers
+    end
+
+
+    LOG_ID = "KeepAliveScheduler"
+    def log_id
+      LOG_ID
+    end
+
+
+    attr_reader :interval, :num_connections, :num_pings_sent, :num_pings_skipped
+
+    def initialize interval
+      @interval = interval
+      @num_buckets = ( interval / TICK ).ceil
+      @num_buckets = 1  if @num_buckets < 1
+      @buckets = ::Array.new(@num_buckets) { [] }
+      @current = 0
+      @num_connections = 0
+      @num_pings_sent = 0
+      @num_pings_skipped = 0
+    end
+
+
+    # The connection gets its first ping after a whole interval.
+    def add connection
+      @timer ||= ::EM::PeriodicTimer.new(TICK) { tick }
+
+      @buckets[@current] << connection
+      @num_connections += 1
+    end
+
+
+    def tick
+      @current = ( @current + 1 ) % @num_buckets
+      bucket = @buckets[@current]
+      return  if bucket.empty?
+
+      # Connections remaining scheduled are added again into the same bucket,
+      # so they are visited again after a whole interval.
+      @buckets[@current] = still_scheduled = []
+      sent = 0
+
+      bucket.each do |connection|
+        unless connection.keepalive?
+          @num_connections -= 1
+          next
+        end
+
+        # Skip connections that received data since the last visit.
+        if connection.keepalive_activity
+          connection.keepalive_activity = false
+          @num_pings_skipped += 1
+        else
+          begin
+            connection.send_keepalive
+            sent += 1
+          rescue => e
+            log_system_error "error sending keepalive:"
+            log_system_error e
+          end
+        end
+
+        still_scheduled << connection
+      end
+
+      @num_pings_sent += sent
+      log_system_debug "#{sent} keepalives sent (interval #{@interval} s, #{@num_connections} connections)"  if $oversip_debug and sent > 0
+    end
+    private :tick
+
+  end
+
+end
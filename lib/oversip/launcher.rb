@@ -97,12 +97,7 @@ module OverSIP::Launcher
       ready_pipe.write($$.to_s + "\n") if ready_pipe
 
       # Init modules.
-      ::OverSIP::TLS.module_init
-      ::OverSIP::SIP.module_init
-      ::OverSIP::SIP::RFC3263.module_init
-      ::OverSIP::WebSocket.module_init
-      ::OverSIP::WebSocket::WsFraming.class_init
-      ::OverSIP::WebSocket::WsSipApp.class_init
+      init_modules
 
       @log_id = "launcher (master)"
 
@@ -122,6 +117,24 @@ module OverSIP::Launcher
         # Run DNS resolver.
         ::OverSIP::SIP::RFC3263.run
 
+        # Open the pooled connections to the configured next hops.
+        ::OverSIP::SIP::ConnectionPool.run
+
+        # Serve the metrics.
+        ::OverSIP::Metrics.run
+
+        # Log the slowest requests (if enabled).
+        ::OverSIP::SIP::Latency.run
+
+        # Measure the reactor lag.
+        ::OverSIP::ReactorProbe.run
+
+        # Watch the reactor lag and shed new requests under overload.
+        ::OverSIP::SIP::OverloadControl.run
+
+        # Log the allocations per message (if enabled).
+        ::OverSIP::SIP::Allocations.run
+
         # Change process permissions if requested.
         set_user_group(options[:user], options[:group])
 
@@ -172,7 +185,8 @@ module OverSIP::Launcher
             ready_pipe = nil
           end
 
-          # Stop writting into standard output/error.
+          # Stop writting into standard output/error (once pending logs are printed).
+          ::OverSIP::LogRing.flush
           $stdout.reopen("/dev/null")
           $stderr.reopen("/dev/null")
           ::OverSIP.daemonized = true
@@ -200,6 +214,26 @@ module OverSIP::Launcher
   end # def self.run
 
 
+  # Also used by bin/oversip_replay.
+  def self.init_modules
+    ::OverSIP::Capture.module_init
+    ::OverSIP::TLS.module_init
+    ::OverSIP::SIP.module_init
+    ::OverSIP::SIP::RFC3263.module_init
+    ::OverSIP::SIP::ConnectionPool.module_init
+    ::OverSIP::WebSocket.module_init
+    ::OverSIP::WebSocket::WsFraming.class_init
+    ::OverSIP::WebSocket::PermessageDeflate.class_init
+    ::OverSIP::WebSocket::WsSipApp.class_init
+    ::OverSIP::Metrics.module_init
+    ::OverSIP.fiber_pool = ::OverSIP::FiberPool.new ::OverSIP.configuration[:core][:fiber_pool_size], ::OverSIP.configuration[:core][:fiber_pool_max_queue], "events"
+    ::OverSIP::SIP::Latency.module_init
+    ::OverSIP::ReactorProbe.module_init
+    ::OverSIP::SIP::OverloadControl.module_init
+    ::OverSIP::SIP::Allocations.module_init
+  end
+
+
   def self.fatal msg
     log_system_crit msg
     log_system_crit "exiting with error status"
@@ -390,7 +424,7 @@ module OverSIP::Launcher
         end
 
         # WebSocket IPv6 TLS SIP server (Stud).
-        if configuration[:sip][:enable_ipv6]
+        if configuration[:websocket][:enable_ipv6]
           ::OverSIP::WebSocket::Launcher.run true, :ipv6, "::1",
                                         configuration[:websocket][:listen_port_tls_tunnel], :wss_tunnel,
                                         configuration[:websocket][:listen_ipv6],
@@ -540,8 +574,10 @@ module OverSIP::Launcher
       ::File.delete ::OverSIP.configuration[:tls][:full_cert]  rescue nil
 
       delete_pid_file
+      ::OverSIP::Metrics.terminate
 
-      # Exit by preventing any exception.
+      # Exit by preventing any exception (but let the pending logs be written).
+      ::OverSIP::LogRing.flush
       exit!( error ? false : true )
 
     end.resume
@@ -6,6 +6,8 @@ module OverSIP
   module Logger
 
     def self.load_methods
+      # Don't close syslog while there are pending log records.
+      ::OverSIP::LogRing.flush
       ::Syslog.close  if ::Syslog.opened?
 
       syslog_options = ::Syslog::LOG_PID | ::Syslog::LOG_NDELAY
@@ -20,30 +22,18 @@ module OverSIP
 
       $oversip_debug = ( @@threshold == 0 ? true : false )
 
+      # The logging thread also prints system logs into stdout/stderr when not daemonized.
+      ::OverSIP::LogRing.start ::OverSIP.daemonized?
+
       ::OverSIP::Syslog::SYSLOG_SEVERITY_MAPPING.each do |level_str, level_value|
+        # System logs.
         method_str = "
           def log_system_#{level_str}(msg)
-        "
-
-        method_str << "
-          return false if @@threshold > #{level_value}
-
-          ::OverSIP::Syslog.log #{level_value}, msg, log_id, false
-        "
+            return false if @@threshold > #{level_value}
 
-        if not ::OverSIP.daemonized?
-          if %w{debug info notice}.include? level_str
-            method_str << "
-              puts ::OverSIP::Logger.fg_system_msg2str('#{level_str}', msg, log_id)
-              "
-          else
-            method_str << "
-              $stderr.puts ::OverSIP::Logger.fg_system_msg2str('#{level_str}', msg, log_id)
-            "
+            ::OverSIP::Syslog.log #{level_value}, msg, log_id, false
           end
-        end
-
-        method_str << "end"
+        "
 
         self.module_eval method_str
 
@@ -62,17 +52,6 @@ module OverSIP
       end  # .each
     end
 
-    def self.fg_system_msg2str(level_str, msg, log_id)
-      case msg
-      when ::String
-        "#{level_str.upcase}: <#{log_id}> " << msg
-      when ::Exception
-        "#{level_str.upcase}: <#{log_id}> #{msg.message} (#{msg.class })\n#{(msg.backtrace || [])[0..3].join("\n")}"
-      else
-        "#{level_str.upcase}: <#{log_id}> " << msg.inspect
-      end
-    end
-
     # Default logging identifier is the class name. If log_id() method is redefined by the
     # class including this module, or it sets @log_id, then such a value takes preference.
     def log_id
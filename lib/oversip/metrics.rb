@@ -0,0 +1,250 @@
+module OverSIP
+
+  # Metrics registry (see ext/metrics). Series are registered once, so updating them
+  # from the SIP stack is just a Hash/Array lookup plus an indexed increment (no
+  # allocations). Gauges mirroring the state of OverSIP (live transactions,
+  # connections...) are collected when the registry is rendered.
+  #
+  # The registry is served in Prometheus text format by a loopback HTTP listener
+  # (core[metrics_port]) and/or a UNIX socket (core[metrics_socket]).
+  module Metrics
+
+    extend ::OverSIP::Logger
+
+    @log_id = "Metrics"
+
+    TRANSPORTS = [ :udp, :tcp, :tls, :ws, :wss ]
+    METHODS = [ :INVITE, :ACK, :CANCEL, :BYE, :OPTIONS, :REGISTER, :SUBSCRIBE, :NOTIFY,
+                :PUBLISH, :MESSAGE, :INFO, :PRACK, :UPDATE, :REFER ]
+    DNS_TYPES = [ :NAPTR, :SRV, :A, :AAAA ]
+    TRANSACTION_TABLES = [ :invite_server, :non_invite_server, :invite_client, :non_invite_client ]
+    DEADLINE_REASONS = [ :tls_handshake, :headers, :body, :idle ]
+
+    # Max size of the HTTP request.
+    HTTP_REQUEST_MAX_SIZE = 4096
+
+
+    # Returns a Hash (by transport) of Hashes (by method) of series ids.
+    def self.register_by_transport_and_method name, help
+      ::Hash[TRANSPORTS.map do |transport|
+        ids = ::Hash.new register(:counter, name, help, %{transport="#{transport}",method="other"})
+        METHODS.each do |sip_method|
+          ids[sip_method] = register :counter, name, help, %{transport="#{transport}",method="#{sip_method}"}
+        end
+        [ transport, ids ]
+      end]
+    end
+    private_class_method :register_by_transport_and_method
+
+    # Returns a Hash (by transport) of Arrays (by status code class) of series ids.
+    def self.register_by_transport_and_class name, help
+      ::Hash[TRANSPORTS.map do |transport|
+        [ transport, [ nil ] + (1..6).map {|klass| register :counter, name, help, %{transport="#{transport}",class="#{klass}xx"}} ]
+      end]
+    end
+    private_class_method :register_by_transport_and_class
+
+    def self.register_by_transport type, name, help
+      ::Hash[TRANSPORTS.map {|transport| [ transport, register(type, name, help, %{transport="#{transport}"}) ]}]
+    end
+    private_class_method :register_by_transport
+
+
+    @requests_received = register_by_transport_and_method "oversip_sip_requests_received_total", "SIP requests received"
+    @requests_sent = register_by_transport_and_method "oversip_sip_requests_sent_total", "SIP requests sent"
+    @responses_received = register_by_transport_and_class "oversip_sip_responses_received_total", "SIP responses received"
+    @responses_sent = register_by_transport_and_class "oversip_sip_responses_sent_total", "SIP responses sent"
+    @retransmissions_received = register_by_transport :counter, "oversip_sip_retransmissions_received_total", "SIP request retransmissions received"
+    @retransmissions_sent = register_by_transport :counter, "oversip_sip_retransmissions_sent_total", "SIP requests and responses retransmitted"
+    @parse_errors = register_by_transport :counter, "oversip_sip_parse_errors_total", "SIP messages with parsing errors"
+
+    @dns_queries = ::Hash[DNS_TYPES.map do |type|
+      [ type, {
+        true => register(:counter, "oversip_dns_queries_total", "DNS queries", %{type="#{type}",result="ok"}),
+        false => register(:counter, "oversip_dns_queries_total", "DNS queries", %{type="#{type}",result="error"})
+      } ]
+    end]
+
+    @dns_cache_lookups = {
+      true => register(:counter, "oversip_dns_cache_lookups_total", "DNS cache lookups (proxies with use_dns_cache)", %{result="hit"}),
+      false => register(:counter, "oversip_dns_cache_lookups_total", "DNS cache lookups (proxies with use_dns_cache)", %{result="miss"})
+    }
+
+    class << self
+      # Listener classes holding transaction tables (once module_init is called).
+      attr_reader :transaction_classes
+    end
+
+    # Mirrors of the counters kept by other modules (set when rendering).
+    @transactions = ::Hash[TRANSACTION_TABLES.map {|table| [ table, register(:gauge, "oversip_sip_transactions", "Live SIP transactions", %{table="#{table}"}) ]}]
+    @tls_handshakes = {
+      :server => register(:counter, "oversip_tls_handshakes_total", "Completed in-process TLS handshakes", %{side="server"}),
+      :client => register(:counter, "oversip_tls_handshakes_total", "Completed in-process TLS handshakes", %{side="client"})
+    }
+    @tls_validation_cache = {
+      :hit => register(:counter, "oversip_tls_validation_cache_total", "TLS certificate chain validation cache lookups", %{result="hit"}),
+      :miss => register(:counter, "oversip_tls_validation_cache_total", "TLS certificate chain validation cache lookups", %{result="miss"})
+    }
+    @deadlines_expired = ::Hash[DEADLINE_REASONS.map {|reason| [ reason, register(:counter, "oversip_connection_deadlines_expired_total", "Connections closed due to expired deadlines", %{reason="#{reason}"}) ]}]
+    @tcp_writes = register :counter, "oversip_tcp_writes_total", "Coalesced TCP/TLS writes"
+    @tcp_written_messages = register :counter, "oversip_tcp_written_messages_total", "SIP messages written into TCP/TLS connections"
+    @log_messages_dropped = register :counter, "oversip_log_messages_dropped_total", "Log messages dropped (full log buffer)"
+
+
+    def self.module_init
+      conf = ::OverSIP.configuration[:core]
+      @port = conf[:metrics_port]
+      @socket = conf[:metrics_socket]
+
+      # Connections of every listener class (client classes share them with their server class).
+      @listener_classes = [
+        ::OverSIP::SIP::IPv4TcpServer, ::OverSIP::SIP::IPv6TcpServer,
+        ::OverSIP::SIP::IPv4TlsServer, ::OverSIP::SIP::IPv6TlsServer,
+        ::OverSIP::SIP::IPv4TlsTunnelServer, ::OverSIP::SIP::IPv6TlsTunnelServer,
+        ::OverSIP::WebSocket::IPv4WsServer, ::OverSIP::WebSocket::IPv6WsServer,
+        ::OverSIP::WebSocket::IPv4WssServer, ::OverSIP::WebSocket::IPv6WssServer,
+        ::OverSIP::WebSocket::IPv4WssTunnelServer, ::OverSIP::WebSocket::IPv6WssTunnelServer
+      ]
+      @connections = ::Hash[@listener_classes.map do |klass|
+        [ klass, register(:gauge, "oversip_connections", "Open connections", %{listener="#{klass.name.split("::").last}"}) ]
+      end]
+
+      # Transaction tables of every listener class.
+      @transaction_classes = @listener_classes + [ ::OverSIP::SIP::IPv4UdpServer, ::OverSIP::SIP::IPv6UdpServer ]
+    end
+
+
+    # Start the metrics listeners (called once the reactor is running).
+    def self.run
+      if @port
+        ::EM.start_server "127.0.0.1", @port, Server
+        log_system_info "serving metrics on http://127.0.0.1:#{@port}/metrics"
+      end
+
+      if @socket
+        ::File.delete @socket  rescue nil
+        ::EM.start_unix_domain_server @socket, Server
+        log_system_info "serving metrics on UNIX socket #{@socket}"
+      end
+    end
+
+
+    def self.terminate
+      ::File.delete @socket  rescue nil  if @socket
+    end
+
+
+    def self.request_received transport, sip_method
+      inc @requests_received[transport][sip_method]
+    end
+
+    def self.request_sent transport, sip_method
+      inc @requests_sent[transport][sip_method]
+    end
+
+    def self.response_received transport, status_code
+      inc @responses_received[transport][status_code / 100]
+    end
+
+    def self.response_sent transport, status_code
+      inc @responses_sent[transport][status_code / 100]
+    end
+
+    def self.retransmission_received transport
+      inc @retransmissions_received[transport]
+    end
+
+    def self.retransmission_sent transport
+      inc @retransmissions_sent[transport]
+    end
+
+    def self.parse_error transport
+      inc @parse_errors[transport]
+    end
+
+    def self.dns_query type, ok
+      inc @dns_queries[type][ok]
+    end
+
+    def self.dns_cache_lookup hit
+      inc @dns_cache_lookups[hit]
+    end
+
+
+    # Returns the registry in Prometheus text format.
+    def self.to_prometheus
+      collect
+      render
+    end
+
+
+    def self.collect
+      if @transaction_classes
+        num_transactions = ::Hash.new 0
+        @transaction_classes.each do |klass|
+          TRANSACTION_TABLES.each do |table|
+            transactions = klass.send :"#{table}_transactions"
+            num_transactions[table] += transactions.size  if transactions
+          end
+        end
+        num_transactions.each {|table, num| set @transactions[table], num}
+
+        @connections.each do |klass, id|
+          set id, ( klass.connections ? klass.connections.size : 0 )
+        end
+      end
+
+      set @tls_handshakes[:server], ::OverSIP::TLS.num_server_handshakes
+      set @tls_handshakes[:client], ::OverSIP::TLS.num_client_handshakes
+      set @tls_validation_cache[:hit], ::OverSIP::TLS.num_validation_cache_hits
+      set @tls_validation_cache[:miss], ::OverSIP::TLS.num_validation_cache_misses
+      @deadlines_expired.each {|reason, id| set id, ::OverSIP::DeadlineWheel.num_reaped[reason]}
+      set @tcp_writes, ::OverSIP::SIP::TcpConnection.num_writes
+      set @tcp_written_messages, ::OverSIP::SIP::TcpConnection.num_written_messages
+      set @log_messages_dropped, ::OverSIP::LogRing.num_dropped
+    end
+    private_class_method :collect
+
+
+    # Minimal HTTP/1.x server replying the metrics to any GET request.
+    class Server < ::EM::Connection
+
+      include ::OverSIP::Logger
+
+      LOG_ID = "Metrics server"
+      def log_id
+        LOG_ID
+      end
+
+      def post_init
+        @request = ""
+      end
+
+      def receive_data data
+        return  unless @request
+
+        @request << data
+        if @request.bytesize > HTTP_REQUEST_MAX_SIZE
+          close_connection
+          @request = nil
+          return
+        end
+        return  unless @request.include? "\n\r\n" or @request.include? "\n\n"
+
+        if @request.start_with? "GET " or @request.start_with? "HEAD "
+          body = ::OverSIP::Metrics.to_prometheus
+          send_data "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: #{body.bytesize}\r\nConnection: close\r\n\r\n"
+          send_data body  unless @request.start_with? "HEAD "
+        else
+          send_data "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET, HEAD\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+        end
+
+        close_connection_after_writing
+        @request = nil
+      end
+
+    end  # class Server
+
+  end
+
+end
@@ -0,0 +1,124 @@
+module OverSIP
+
+  # Reactor probe. All the SIP, WebSocket, DNS and timer work runs in the single
+  # EventMachine reactor, so the time it takes to run a timer after it was due
+  # (reactor lag) is the main sign of saturation.
+  #
+  # - A timer is scheduled every PROBE_INTERVAL seconds and its firing delay is
+  #   observed into the oversip_reactor_lag_seconds histogram.
+  # - The reactor callbacks doing the work are timed and observed into
+  #   oversip_reactor_callback_seconds by category: receive_data of the SIP and
+  #   WebSocket listeners, timers (EM.add_timer, EM::Timer and EM::PeriodicTimer)
+  #   and next_tick blocks (see ruby_ext/eventmachine.rb). The _count of that
+  #   histogram is the number of those callbacks run by the reactor. Other
+  #   callbacks (connection setup and teardown, TLS handshakes, DNS responses) are
+  #   not observed.
+  # - The first run of OverSIP::SipEvents.on_request() fibers is also observed
+  #   (category "user", already included in "receive_data").
+  # - Callbacks taking longer than core[slow_callback_threshold] milliseconds are
+  #   logged naming the connection class or the timer block.
+  module ReactorProbe
+
+    extend ::OverSIP::Logger
+
+    @log_id = "ReactorProbe"
+
+    # Interval (seconds) of the lag probe.
+    PROBE_INTERVAL = 0.5
+
+    BUCKETS = [ 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+                0.1, 0.25, 0.5, 1, 2.5, 5, 10 ]
+
+    CATEGORIES = [ :receive_data, :timer, :next_tick, :user ]
+
+    @lag = ::OverSIP::Metrics.register :histogram, "oversip_reactor_lag_seconds", "Delay of the reactor running a due timer", nil, BUCKETS
+    @callbacks = ::Hash[CATEGORIES.map do |category|
+      [ category, ::OverSIP::Metrics.register(:histogram, "oversip_reactor_callback_seconds", "Time spent in reactor callbacks", %{category="#{category}"}, BUCKETS) ]
+    end]
+
+    # Last measured reactor lag (seconds).
+    @last_lag = 0.0
+
+    class << self
+      attr_reader :last_lag
+    end
+
+
+    def self.module_init
+      threshold = ::OverSIP.configuration[:core][:slow_callback_threshold]
+      @slow_threshold = threshold ? threshold / 1000.0 : nil
+    end
+
+
+    # Start the lag probe (called once the reactor is running).
+    def self.run
+      schedule_probe
+    end
+
+
+    def self.schedule_probe
+      scheduled_at = ::Process.clock_gettime ::Process::CLOCK_MONOTONIC
+      ::EM.add_timer(PROBE_INTERVAL) do
+        lag = ::Process.clock_gettime(::Process::CLOCK_MONOTONIC) - scheduled_at - PROBE_INTERVAL
+        lag = 0.0  if lag < 0
+        @last_lag = lag
+        ::OverSIP::Metrics.observe @lag, lag
+        schedule_probe
+      end
+    end
+    private_class_method :schedule_probe
+
+
+    # Times a reactor callback of the given category (:receive_data, :timer or
+    # :next_tick). callback is the connection (or the timer or next_tick Proc or
+    # Method) which is just used for naming it in the log.
+    def self.callback category, callback
+      start = ::Process.clock_gettime ::Process::CLOCK_MONOTONIC
+      begin
+        yield
+      ensure
+        elapsed = ::Process.clock_gettime(::Process::CLOCK_MONOTONIC) - start
+        ::OverSIP::Metrics.observe @callbacks[category], elapsed
+        log_slow_callback category, callback, elapsed  if @slow_threshold and elapsed > @slow_threshold
+      end
+    end
+
+
+    # Times the first run of a OverSIP::SipEvents.on_request() fiber.
+    def self.user
+      start = ::Process.clock_gettime ::Process::CLOCK_MONOTONIC
+      begin
+        yield
+      ensure
+        ::OverSIP::Metrics.observe @callbacks[:user], ::Process.clock_gettime(::Process::CLOCK_MONOTONIC) - start
+      end
+    end
+
+
+    def self.log_slow_callback category, callback, elapsed
+      name = case callback
+        # EM::PeriodicTimer schedules its #fire method.
+        when ::Method
+          code = callback.receiver.instance_variable_get(:@code)  if callback.receiver.is_a? ::EM::PeriodicTimer
+          code ? "periodic timer at #{source_location code}" : "#{callback.owner}##{callback.name}"
+        when ::Proc
+          "block at #{source_location callback}"
+        when nil
+          category
+        else
+          callback.class
+        end
+
+      log_system_warn "slow reactor callback (#{category}): #{name} took #{"%.1f" % (elapsed * 1000)} ms"
+    end
+    private_class_method :log_slow_callback
+
+
+    def self.source_location code
+      ( location = code.source_location ) ? location.join(":") : "(unknown)"
+    end
+    private_class_method :source_location
+
+  end
+
+end
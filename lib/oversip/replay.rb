@@ -0,0 +1,733 @@
+module OverSIP
+
+  # Offline replay of captured SIP traffic (see bin/oversip_replay). It runs the
+  # OverSIP configuration and script without network and without EventMachine
+  # reactor:
+  #
+  # - The listeners are created by OverSIP::Launcher.run_servers as usual, but
+  #   EventMachine is replaced by a simulated reactor with a virtual clock: sockets
+  #   are fake (sent data is kept in memory) and timers fire in virtual time, so the
+  #   transaction timers behave as with the real traffic but a trace of minutes is
+  #   replayed in seconds.
+  # - Captured packets addressed to OverSIP are passed to receive_data() of the UDP
+  #   listener, or of the TCP/TLS/WebSocket connection of their flow (created the
+  #   first time). Packets sent by OverSIP in the capture are not replayed, but
+  #   they are used for mapping the Via branches of the captured responses to the
+  #   ones of the requests sent by the replayed OverSIP.
+  # - Connections initiated by OverSIP are "connected" in the next tick, and get
+  #   the captured data coming from their remote address.
+  # - DNS queries are answered from a static hosts table (A and AAAA records).
+  #
+  # Captured TLS traffic can just be replayed from OverSIP capture files (which
+  # contain the plain SIP messages): TLS handshakes are assumed completed without
+  # certificates. The WebSocket handshake and framing are generated for flows
+  # captured by OverSIP (rather than from the network).
+  module Replay
+
+    extend ::OverSIP::Logger
+
+    @log_id = "Replay"
+
+    Packet = ::Struct.new(:time, :protocol, :src_ip, :src_port, :dst_ip, :dst_port, :payload, :seq)
+
+    CALL_ID_REGEXP = ::OverSIP::CaptureReader::CALL_ID_REGEXP
+    CSEQ_REGEXP = /^CSeq[ \t]*:[ \t]*(\d+[ \t]+[A-Za-z]+)/i
+    BRANCH_REGEXP = /^(?:Via|v)[ \t]*:[^\r\n]*?;[ \t]*branch[ \t]*=[ \t]*([^;,\s]+)/i
+
+
+    # Reads the packets of a capture file: pcap, pcapng or OverSIP capture (ring
+    # file or HEP3 packets). Just UDP and TCP packets with payload are returned.
+    module TraceReader
+
+      PCAP_MAGICS = {
+        "\xd4\xc3\xb2\xa1".b => [ "V", 1e-6 ],
+        "\xa1\xb2\xc3\xd4".b => [ "N", 1e-6 ],
+        "\x4d\x3c\xb2\xa1".b => [ "V", 1e-9 ],
+        "\xa1\xb2\x3c\x4d".b => [ "N", 1e-9 ]
+      }
+      PCAPNG_SHB = "\x0a\x0d\x0d\x0a".b
+
+      LINKTYPE_NULL = 0
+      LINKTYPE_ETHERNET = 1
+      LINKTYPE_RAW = [ 12, 14, 101 ]
+      LINKTYPE_LINUX_SLL = 113
+      LINKTYPE_IPV4 = 228
+      LINKTYPE_IPV6 = 229
+      LINKTYPE_LINUX_SLL2 = 276
+
+      ETHERTYPE_IPV4 = 0x0800
+      ETHERTYPE_IPV6 = 0x86dd
+      ETHERTYPE_VLAN = [ 0x8100, 0x88a8, 0x9100 ]
+
+      IPPROTO_TCP = 6
+      IPPROTO_UDP = 17
+      # IPv6 extension headers skipped (fragments are not supported).
+      IPV6_EXTENSIONS = { 0 => true, 43 => true, 60 => true }
+
+
+      def self.read file
+        data = ::File.binread file
+        magic = data.byteslice(0, 4)
+
+        if (format = PCAP_MAGICS[magic])
+          read_pcap data, *format
+        elsif magic == PCAPNG_SHB
+          read_pcapng data
+        else
+          read_oversip_capture file
+        end
+      end
+
+
+      def self.read_oversip_capture file
+        packets = []
+        ::OverSIP::CaptureReader.new(file).each_packet do |p|
+          protocol = ( p.ip_protocol == IPPROTO_UDP ) ? :udp : :tcp
+          packets << Packet.new(p.time.to_f, protocol, p.src_ip, p.src_port, p.dst_ip, p.dst_port, p.payload)
+        end
+        packets
+      end
+      private_class_method :read_oversip_capture
+
+
+      def self.read_pcap data, endian, resolution
+        u32 = "#{endian}*"
+        linktype = data.byteslice(20, 4).unpack(u32)[0] & 0xffff
+        packets = []
+        pos = 24
+
+        while pos + 16 <= data.bytesize
+          ts_sec, ts_frac, incl_len, _ = data.byteslice(pos, 16).unpack(u32)
+          pos += 16
+          break  if pos + incl_len > data.bytesize
+
+          if (packet = decode_frame linktype, data.byteslice(pos, incl_len))
+            packet.time = ts_sec + ts_frac * resolution
+            packets << packet
+          end
+          pos += incl_len
+        end
+
+        packets
+      end
+      private_class_method :read_pcap
+
+
+      def self.read_pcapng data
+        packets = []
+        endian = "V"
+        interfaces = []
+        time = 0.0
+        pos = 0
+
+        while pos + 12 <= data.bytesize
+          type = data.byteslice(pos, 4).unpack("V")[0]
+
+          # Section Header Block: it sets the byte order of the section.
+          if type == 0x0a0d0d0a
+            endian = ( data.byteslice(pos + 8, 4).unpack("V")[0] == 0x1a2b3c4d ) ? "V" : "N"
+            interfaces = []
+          end
+
+          length = data.byteslice(pos + 4, 4).unpack(endian)[0]
+          break  if length < 12 or pos + length > data.bytesize
+          block = data.byteslice(pos + 8, length - 12)
+          packet = nil
+
+          case type
+          # Interface Description Block.
+          when 0x00000001
+            interfaces << [ block.unpack(endian == "V" ? "v" : "n")[0], pcapng_resolution(block, endian) ]
+          # Enhanced Packet Block.
+          when 0x00000006
+            interface_id, ts_high, ts_low, captured_len = block.unpack("#{endian}4")
+            linktype, resolution = interfaces[interface_id]
+            time = ( ( ts_high << 32 ) + ts_low ) * resolution  if resolution
+            packet = decode_frame(linktype, block.byteslice(20, captured_len))  if linktype
+          # Simple Packet Block (no timestamp).
+          when 0x00000003
+            linktype = interfaces[0] && interfaces[0][0]
+            packet = decode_frame(linktype, block.byteslice(4, block.bytesize - 4))  if linktype
+          end
+
+          if packet
+            packet.time = time
+            packets << packet
+          end
+
+          pos += length
+        end
+
+        packets
+      end
+      private_class_method :read_pcapng
+
+
+      # Timestamp resolution (if_tsresol option) of an Interface Description Block.
+      def self.pcapng_resolution block, endian
+        u16 = ( endian == "V" ) ? "v" : "n"
+        pos = 8
+
+        while pos + 4 <= block.bytesize
+          code, length = block.byteslice(pos, 4).unpack("#{u16}2")
+          break  if code == 0
+          if code == 9
+            value = block.getbyte(pos + 4)
+            return ( value & 0x80 == 0 ) ? 10.0 ** -value : 2.0 ** -(value & 0x7f)
+          end
+          pos += 4 + ( ( length + 3 ) & ~3 )
+        end
+
+        1e-6
+      end
+      private_class_method :pcapng_resolution
+
+
+      def self.decode_frame linktype, frame
+        case linktype
+        when LINKTYPE_ETHERNET
+          ethertype = frame.byteslice(12, 2).unpack("n")[0]
+          offset = 14
+          while ETHERTYPE_VLAN.include? ethertype
+            ethertype = frame.byteslice(offset + 2, 2).unpack("n")[0]
+            offset += 4
+          end
+          decode_ip frame, offset, ethertype
+        when LINKTYPE_LINUX_SLL
+          decode_ip frame, 16, frame.byteslice(14, 2).unpack("n")[0]
+        when LINKTYPE_LINUX_SLL2
+          decode_ip frame, 20, frame.byteslice(0, 2).unpack("n")[0]
+        when LINKTYPE_NULL
+          decode_ip frame, 4
+        when *LINKTYPE_RAW, LINKTYPE_IPV4, LINKTYPE_IPV6
+          decode_ip frame, 0
+        end
+      rescue ::NoMethodError, ::ArgumentError
+        # Truncated frame.
+        nil
+      end
+      private_class_method :decode_frame
+
+
+      def self.decode_ip frame, offset, ethertype=nil
+        version = frame.getbyte(offset) >> 4
+
+        if ethertype == ETHERTYPE_IPV4 or ( ethertype.nil? and version == 4 )
+          ihl = ( frame.getbyte(offset) & 0x0f ) * 4
+          total_length, fragment = frame.byteslice(offset + 2, 6).unpack("nx2n")
+          # Fragments (More Fragments flag or offset) are not supported.
+          return nil  if fragment & 0x3fff != 0
+          protocol = frame.getbyte(offset + 9)
+          src_ip = frame.byteslice(offset + 12, 4).unpack("C4").join(".")
+          dst_ip = frame.byteslice(offset + 16, 4).unpack("C4").join(".")
+          decode_transport frame.byteslice(offset + ihl, total_length - ihl), protocol, src_ip, dst_ip
+        elsif ethertype == ETHERTYPE_IPV6 or ( ethertype.nil? and version == 6 )
+          payload_length = frame.byteslice(offset + 4, 2).unpack("n")[0]
+          protocol = frame.getbyte(offset + 6)
+          src_ip = ::IPAddr.new_ntoh(frame.byteslice(offset + 8, 16)).to_s
+          dst_ip = ::IPAddr.new_ntoh(frame.byteslice(offset + 24, 16)).to_s
+          data = frame.byteslice(offset + 40, payload_length)
+          while IPV6_EXTENSIONS[protocol]
+            protocol = data.getbyte(0)
+            data = data.byteslice((data.getbyte(1) + 1) * 8, data.bytesize)
+          end
+          decode_transport data, protocol, src_ip, dst_ip
+        end
+      end
+      private_class_method :decode_ip
+
+
+      def self.decode_transport data, protocol, src_ip, dst_ip
+        case protocol
+        when IPPROTO_UDP
+          src_port, dst_port, length = data.unpack("n3")
+          payload = data.byteslice(8, length - 8)
+          Packet.new(nil, :udp, src_ip, src_port, dst_ip, dst_port, payload)  unless payload.empty?
+        when IPPROTO_TCP
+          src_port, dst_port, seq = data.unpack("nnN")
+          payload = data.byteslice((data.getbyte(12) >> 4) * 4, data.bytesize)
+          Packet.new(nil, :tcp, src_ip, src_port, dst_ip, dst_port, payload, seq)  unless payload.empty?
+        end
+      end
+      private_class_method :decode_transport
+
+    end  # module TraceReader
+
+
+    # Simulated reactor with a virtual clock.
+    class Reactor
+
+      attr_reader :now, :num_timers_fired, :num_errors
+
+      def initialize
+        @now = 0.0
+        @num_timers_fired = 0
+        @num_errors = 0
+        # Binary min-heap of [ due time, timer id ].
+        @heap = []
+        @timers = {}
+        @last_id = 0
+        @next_ticks = []
+      end
+
+      def add_timer interval, callback
+        id = ( @last_id += 1 )
+        @timers[id] = callback
+        heap_push [ @now + interval.to_f, id ]
+        id
+      end
+
+      def cancel_timer id
+        @timers.delete id
+      end
+
+      def next_tick callback
+        @next_ticks << callback
+      end
+
+      # Fire every timer due before the given time (and the next ticks scheduled
+      # by them) and set the clock to it.
+      def advance_to time
+        run_next_ticks
+
+        while (top = @heap[0]) and top[0] <= time
+          heap_pop
+          next  unless (callback = @timers.delete top[1])
+
+          @now = top[0]  if top[0] > @now
+          @num_timers_fired += 1
+          run callback
+          run_next_ticks
+        end
+
+        @now = time  if time > @now
+      end
+
+      def run_next_ticks
+        until @next_ticks.empty?
+          callbacks = @next_ticks
+          @next_ticks = []
+          callbacks.each {|callback| run callback}
+        end
+      end
+
+      # Runs a callback (or the given block) as the reactor would (errors are logged
+      # as the EM error handler does).
+      def run callback=nil
+        callback ? callback.call : yield
+      rescue ::Exception => e
+        @num_errors += 1
+        ::OverSIP::Replay.log_system_error "error raised during event loop:"
+        ::OverSIP::Replay.log_system_error e
+      end
+
+      private
+
+      def heap_push entry
+        @heap << entry
+        i = @heap.size - 1
+        while i > 0
+          parent = ( i - 1 ) / 2
+          break  if @heap[parent][0] <= entry[0]
+          @heap[i] = @heap[parent]
+          i = parent
+        end
+        @heap[i] = entry
+      end
+
+      def heap_pop
+        top = @heap[0]
+        last = @heap.pop
+        return top  if @heap.empty?
+
+        i = 0
+        size = @heap.size
+        loop do
+          child = 2 * i + 1
+          break  if child >= size
+          child += 1  if child + 1 < size and @heap[child + 1][0] < @heap[child][0]
+          break  if last[0] <= @heap[child][0]
+          @heap[i] = @heap[child]
+          i = child
+        end
+        @heap[i] = last
+        top
+      end
+
+    end  # class Reactor
+
+
+    # DNS resolver answering from a static table (replaces EM::Udns::Resolver).
+    class Resolver
+
+      class Query
+        def initialize
+          @callbacks = []
+          @errbacks = []
+        end
+
+        def callback &block ; @callbacks << block ; self ; end
+        def errback &block ; @errbacks << block ; self ; end
+
+        def answer result
+          if result
+            @callbacks.each {|block| block.call result}
+          else
+            @errbacks.each {|block| block.call :dns_error_nxdomain}
+          end
+        end
+      end
+
+      def initialize hosts
+        @hosts = hosts
+      end
+
+      def submit_A domain
+        submit( (ips = @hosts[domain.downcase]) && ips.reject {|ip| ip.include? ":"} )
+      end
+
+      def submit_AAAA domain
+        submit( (ips = @hosts[domain.downcase]) && ips.select {|ip| ip.include? ":"} )
+      end
+
+      def submit_SRV domain, service=nil, protocol=nil
+        submit nil
+      end
+
+      def submit_NAPTR domain
+        submit nil
+      end
+
+      private
+
+      def submit result
+        query = Query.new
+        result = nil  if result and result.empty?
+        ::EM.next_tick { query.answer result }
+        query
+      end
+
+    end  # class Resolver
+
+
+    # Replaces the EventMachine API used by OverSIP by the simulated reactor and
+    # fake sockets.
+    def self.install
+      @reactor = reactor = Reactor.new
+      @endpoints = {}
+      @closed = {}
+      @last_signature = 0
+      @udp_listeners = {}
+      @tcp_listeners = {}
+      @flows = {}
+      @clients = {}
+      @sent = []
+      @num_bytes_sent = 0
+
+      ::EM.singleton_class.class_eval do
+        define_method(:add_timer) {|interval, callback=nil, &block| reactor.add_timer interval, callback || block}
+        define_method(:cancel_timer) {|timer| timer.respond_to?(:cancel) ? timer.cancel : reactor.cancel_timer(timer)}
+        define_method(:next_tick) {|callback=nil, &block| reactor.next_tick callback || block}
+        define_method(:add_periodic_timer) {|interval, callback=nil, &block| ::EM::PeriodicTimer.new interval, callback || block}
+        define_method(:reactor_running?) { true }
+        define_method(:open_datagram_socket) {|ip, port, klass, *args, &block| ::OverSIP::Replay.open_datagram_socket ip, port, klass, *args, &block}
+        define_method(:start_server) {|ip, port, klass, *args, &block| ::OverSIP::Replay.start_server ip, port, klass, *args, &block}
+        define_method(:oversip_connect_tcp_server) {|bind_ip, ip, port, klass, *args, &block| ::OverSIP::Replay.connect bind_ip, ip, port, klass, *args, &block}
+      end
+
+      ::EM::Timer.class_eval do
+        def initialize interval, callback=nil, &block
+          @signature = ::EM.add_timer interval, callback || block
+        end
+
+        def cancel
+          ::EM.cancel_timer @signature
+        end
+      end
+
+      ::EM::PeriodicTimer.class_eval do
+        def initialize interval, callback=nil, &block
+          @interval = interval
+          @code = callback || block
+          @cancelled = false
+          @work = method(:fire)
+          schedule
+        end
+
+        def cancel
+          @cancelled = true
+        end
+
+        def schedule
+          ::EM.add_timer @interval, @work
+        end
+
+        def fire
+          return  if @cancelled
+          @code.call
+          schedule
+        end
+      end
+
+      ::EM::Connection.class_eval do
+        def send_data data
+          ::OverSIP::Replay.sent self, data
+        end
+
+        def send_datagram data, ip, port
+          ::OverSIP::Replay.sent self, data, ip, port
+        end
+
+        def get_peername
+          ::OverSIP::Replay.peername @signature
+        end
+
+        def get_sockname
+          ::OverSIP::Replay.sockname @signature
+        end
+
+        def close_connection after_writing=false
+          @local_closed = true
+          ::OverSIP::Replay.close self
+        end
+
+        def error?
+          ::OverSIP::Replay.closed? @signature
+        end
+
+        def start_tls options={}
+          ::EM.next_tick { ssl_handshake_completed  unless error? }
+        end
+
+        def get_peer_cert ; nil ; end
+        def set_comm_inactivity_timeout seconds ; end
+        def set_pending_connect_timeout seconds ; end
+        def set_sock_opt level, option, value ; end
+      end
+    end
+
+
+    class << self
+      attr_reader :reactor, :sent, :num_bytes_sent
+    end
+
+
+    def self.new_connection klass, args, local_ip, local_port, remote_ip=nil, remote_port=nil
+      signature = ( @last_signature += 1 )
+      @endpoints[signature] = [ local_ip, local_port, remote_ip, remote_port ]
+      klass.new signature, *args
+    end
+    private_class_method :new_connection
+
+
+    def self.ip_type ip
+      ip.include?(":") ? :ipv6 : :ipv4
+    end
+    private_class_method :ip_type
+
+
+    def self.open_datagram_socket ip, port, klass, *args
+      conn = new_connection klass, args, ip, port
+      @udp_listeners[[ ip_type(ip), port ]] = conn
+      yield conn  if block_given?
+      conn
+    end
+
+
+    def self.start_server ip, port, klass, *args, &block
+      @tcp_listeners[[ ip_type(ip), port ]] = [ ip, klass, args, block ]
+      nil
+    end
+
+
+    def self.connect bind_ip, ip, port, klass, *args
+      conn = new_connection klass, args, bind_ip, 0, ip, port
+      @clients["#{ip}|#{port}"] = conn
+      ::EM.next_tick { conn.connection_completed  unless conn.error? }
+      yield conn  if block_given?
+      conn
+    end
+
+
+    def self.peername signature
+      _, _, ip, port = @endpoints[signature]
+      ::Socket.sockaddr_in(port, ip)  if ip
+    end
+
+
+    def self.sockname signature
+      ip, port = @endpoints[signature]
+      ::Socket.sockaddr_in(port, ip)  if ip
+    end
+
+
+    def self.closed? signature
+      @closed.has_key? signature
+    end
+
+
+    def self.close conn
+      signature = conn.signature
+      return  if @closed.has_key? signature
+      @closed[signature] = true
+
+      @flows.delete_if {|_, c| c.equal? conn}
+      @clients.delete_if {|_, c| c.equal? conn}
+      ::EM.next_tick { conn.unbind }
+    end
+
+
+    def self.sent conn, data, ip=nil, port=nil
+      _, _, remote_ip, remote_port = @endpoints[conn.signature]
+      @sent << [ @reactor.now, ip || remote_ip, port || remote_port, data ]
+      @num_bytes_sent += data.bytesize
+      map_branch( conn.is_a?(::OverSIP::WebSocket::Connection) ? ws_payload(data) : data )
+      data.bytesize
+    end
+
+
+    # Payload of a WebSocket frame sent by OverSIP (not masked).
+    def self.ws_payload frame
+      length = frame.getbyte(1) & 0x7f
+      case length
+      when 126 ; frame.byteslice(4, frame.bytesize)
+      when 127 ; frame.byteslice(10, frame.bytesize)
+      else     ; frame.byteslice(2, frame.bytesize)
+      end
+    end
+    private_class_method :ws_payload
+
+
+    # Addresses of the captured OverSIP (packets to them are replayed).
+    def self.addresses= addresses
+      @addresses = ::Hash[addresses.map {|ip| [ ip, true ]}]
+    end
+
+
+    # Stores the Via branch of the requests sent by the captured OverSIP, so they
+    # can be mapped to the ones sent by the replayed OverSIP.
+    def self.load_branches packets
+      @trace_branches = ::Hash.new {|hash, key| hash[key] = []}
+      @branch_map = {}
+      @mapped_branches = {}
+      @tcp_next_seq = {}
+
+      packets.each do |packet|
+        next  unless @addresses[packet.src_ip] and not @addresses[packet.dst_ip]
+        next  unless (key = request_key packet.payload)
+        branches = @trace_branches[key[0]]
+        branches << key[1]  unless branches.include? key[1]
+      end
+    end
+
+
+    # Returns [ "Call-ID|CSeq", top Via branch ] of a request.
+    def self.request_key data
+      return nil  if data.start_with? "SIP/2.0 "
+      headers = data.split("\r\n\r\n", 2)[0]
+      return nil  unless headers =~ CALL_ID_REGEXP and (call_id = $1) and headers =~ CSEQ_REGEXP and (cseq = $1) and headers =~ BRANCH_REGEXP
+      [ "#{call_id}|#{cseq}", $1 ]
+    end
+    private_class_method :request_key
+
+
+    def self.map_branch data
+      return  unless (key = request_key data)
+      # Retransmissions.
+      return  if @mapped_branches[key[1]]
+      return  unless (branches = @trace_branches.fetch(key[0], nil)) and (original = branches.shift)
+      @branch_map[original] = key[1]
+      @mapped_branches[key[1]] = true
+    end
+    private_class_method :map_branch
+
+
+    # Replays a captured packet (if addressed to OverSIP).
+    def self.deliver packet
+      return false  unless @addresses[packet.dst_ip] and not @addresses[packet.src_ip]
+
+      return false  unless (payload = tcp_new_data packet)
+
+      if payload.start_with? "SIP/2.0 " and payload =~ BRANCH_REGEXP
+        original = $1
+        payload = payload.sub(original, @branch_map[original])  if @branch_map[original]
+      end
+
+      if packet.protocol == :udp
+        return false  unless (conn = @udp_listeners[[ ip_type(packet.dst_ip), packet.dst_port ]])
+        @endpoints[conn.signature][2, 2] = [ packet.src_ip, packet.src_port ]
+      else
+        return false  unless (conn = tcp_connection packet)
+        payload = ws_frame(payload)  if conn.instance_variable_get(:@replay_ws_framing)
+      end
+
+      @reactor.run { conn.receive_data payload }
+
+      @reactor.run_next_ticks
+      true
+    end
+
+
+    # Payload of the packet without the data already received in the TCP flow
+    # (retransmissions in pcap files), nil if there is no new data.
+    def self.tcp_new_data packet
+      payload = packet.payload
+      return payload  unless (seq = packet.seq)
+
+      flow = "#{packet.src_ip}|#{packet.src_port}|#{packet.dst_ip}|#{packet.dst_port}"
+      if (next_seq = @tcp_next_seq[flow]) and (duplicated = ( next_seq - seq ) & 0xffffffff) < 0x80000000
+        return nil  if duplicated >= payload.bytesize
+        payload = payload.byteslice(duplicated, payload.bytesize)
+      end
+      @tcp_next_seq[flow] = ( seq + packet.payload.bytesize ) & 0xffffffff
+      payload
+    end
+    private_class_method :tcp_new_data
+
+
+    # Connection of a TCP packet: the OverSIP client connection to its source, or
+    # the server connection of its flow (created if needed).
+    def self.tcp_connection packet
+      if (conn = @clients["#{packet.src_ip}|#{packet.src_port}"])
+        return conn
+      end
+
+      flow = "#{packet.src_ip}|#{packet.src_port}|#{packet.dst_port}"
+      return conn  if (conn = @flows[flow])
+      return nil  unless (listener = @tcp_listeners[[ ip_type(packet.dst_ip), packet.dst_port ]])
+
+      ip, klass, args, block = listener
+      conn = new_connection klass, args, ip, packet.dst_port, packet.src_ip, packet.src_port
+      @flows[flow] = conn
+      block.call conn  if block
+      @reactor.run_next_ticks
+
+      # WebSocket flows captured by OverSIP just contain the SIP messages.
+      if conn.is_a? ::OverSIP::WebSocket::Connection and not packet.payload.start_with? "GET "
+        conn.receive_data "GET / HTTP/1.1\r\nHost: #{ip}:#{packet.dst_port}\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: #{::Base64.strict_encode64 ::SecureRandom.random_bytes(16)}\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Protocol: sip\r\n\r\n"
+        conn.instance_variable_set :@replay_ws_framing, true
+      end
+
+      conn
+    end
+    private_class_method :tcp_connection
+
+
+    # Masked WebSocket text frame (as sent by clients).
+    def self.ws_frame payload
+      mask = ::SecureRandom.random_bytes 4
+      length = payload.bytesize
+      frame = if length < 126
+        [ 0x81, 0x80 | length ].pack("CC")
+      elsif length < 65536
+        [ 0x81, 0x80 | 126, length ].pack("CCn")
+      else
+        [ 0x81, 0x80 | 127, length ].pack("CCQ>")
+      end
+      frame << mask << ::OverSIP::WebSocket::FramingUtils.unmask(payload, mask)
+    end
+    private_class_method :ws_frame
+
+  end
+
+end
@@ -10,6 +10,26 @@ module EventMachine
   end
 
 
+  class << self
+    alias _em_add_timer add_timer
+    alias _em_next_tick next_tick
+  end
+
+  # Time timers (also EM::Timer and EM::PeriodicTimer, which use add_timer) and
+  # next_tick blocks (see OverSIP::ReactorProbe).
+  def self.add_timer interval, code=nil, &block
+    callback = code || block
+    raise ::ArgumentError, "no callback given"  unless callback
+    _em_add_timer(interval) { ::OverSIP::ReactorProbe.callback(:timer, callback) { callback.call } }
+  end
+
+  def self.next_tick pr=nil, &block
+    callback = pr || block
+    raise ::ArgumentError, "no proc or block given"  unless callback
+    _em_next_tick { ::OverSIP::ReactorProbe.callback(:next_tick, callback) { callback.call } }
+  end
+
+
   class Connection
 
     # We require Ruby 1.9 so don't check String#bytesize method.
@@ -0,0 +1,172 @@
+module OverSIP::SIP
+
+  # Allocation tracking. When enabled (core[allocation_tracking]) the main stages
+  # of the processing of SIP messages are wrapped for recording the Ruby objects
+  # allocated (GC.stat :total_allocated_objects) and the bytes malloc'ed
+  # (GC.stat :malloc_increase_bytes) while running them, aggregated by stage and
+  # message type (request method or "response"):
+  #
+  # - parse_message   : UdpConnection#parse_message.
+  # - parse_headers   : TcpConnection#parse_headers (TCP, TLS).
+  # - process_request : MessageProcessor#process_request (it includes the first run
+  #                     of OverSIP::SipEvents.on_request() and so the stages below).
+  # - to_s            : Request#to_s (requests being proxied).
+  # - reply           : Request#reply (responses generated by OverSIP).
+  #
+  # Totals are exported as metrics and per message averages are logged every
+  # LOG_INTERVAL seconds. test/test_allocations.rb checks the averages against the
+  # budget in test/allocation_budget.yml.
+  #
+  # Methods are just wrapped when enabled so there is no cost otherwise. The GC
+  # resets the malloc counter (and frees decrease it) so calls during which the GC
+  # runs add no bytes.
+  module Allocations
+
+    extend ::OverSIP::Logger
+
+    @log_id = "Allocations"
+
+    # Interval (seconds) for logging the averages.
+    LOG_INTERVAL = 60
+
+    # Wrapped classes and methods, and the message of each stage (evaluated in
+    # the instance once the method returns).
+    STAGES = [
+      [ :UdpConnection,    :parse_message,   proc { @parser.parsed } ],
+      [ :TcpConnection,    :parse_headers,   proc { @parser.parsed } ],
+      [ :MessageProcessor, :process_request, proc { @msg } ],
+      [ :Request,          :to_s,            proc { self } ],
+      [ :Request,          :reply,           proc { self } ]
+    ]
+
+    # Message types (methods not listed are aggregated as "other").
+    TYPES = ::Hash.new :other
+    ::OverSIP::Metrics::METHODS.each {|sip_method| TYPES[sip_method] = sip_method}
+
+    @enabled = false
+
+    class << self
+      attr_reader :enabled
+    end
+
+
+    def self.module_init
+      enable  if ::OverSIP.configuration[:core][:allocation_tracking]
+    end
+
+
+    # Start logging the averages (if enabled).
+    def self.run
+      return  unless @enabled
+
+      ::EM.add_periodic_timer(LOG_INTERVAL) { log_stats ; reset }
+    end
+
+
+    # Wraps the stages (just once).
+    def self.enable
+      return  if @enabled
+      @enabled = true
+
+      @metrics = {}
+      STAGES.each do |klass, method, message|
+        @metrics[method] = register_by_type method
+        wrap ::OverSIP::SIP.const_get(klass), method, message
+      end
+
+      reset
+    end
+
+
+    # Returns a Hash (by type) of the series ids (objects, malloc bytes and samples)
+    # of the given stage.
+    def self.register_by_type stage
+      ::Hash[(TYPES.keys + [ :other, :response ]).map do |type|
+        labels = %{stage="#{stage}",type="#{type}"}
+        [ type, [
+          ::OverSIP::Metrics.register(:counter, "oversip_sip_allocated_objects_total", "Ruby objects allocated processing SIP messages", labels),
+          ::OverSIP::Metrics.register(:counter, "oversip_sip_malloc_bytes_total", "Bytes malloc'ed processing SIP messages", labels),
+          ::OverSIP::Metrics.register(:counter, "oversip_sip_allocation_samples_total", "Measured SIP message processing stages", labels)
+        ] ]
+      end]
+    end
+    private_class_method :register_by_type
+
+
+    def self.wrap klass, method, message
+      original = :"#{method}_without_allocations"
+      is_private = klass.private_method_defined? method
+
+      klass.send :alias_method, original, method
+      klass.send :define_method, method do |*args, &block|
+        ::OverSIP::SIP::Allocations.measure(method, self, message) { __send__ original, *args, &block }
+      end
+      klass.send :private, original
+      klass.send :private, method  if is_private
+    end
+    private_class_method :wrap
+
+
+    # Runs the block and records its allocations for the given stage and the type
+    # of the message (given by calling the message Proc in the instance).
+    def self.measure stage, instance, message
+      gc_count = ::GC.count
+      objects = ::GC.stat :total_allocated_objects
+      malloc = ::GC.stat :malloc_increase_bytes
+      begin
+        yield
+      ensure
+        objects = ::GC.stat(:total_allocated_objects) - objects
+        malloc = ( ::GC.count == gc_count ) ? [ ::GC.stat(:malloc_increase_bytes) - malloc, 0 ].max : 0
+        record stage, instance.instance_exec(&message), objects, malloc
+      end
+    end
+
+
+    def self.record stage, msg, objects, malloc
+      type = case msg
+        when ::OverSIP::SIP::Request  ; TYPES[msg.sip_method]
+        when ::OverSIP::SIP::Response ; :response
+        # Keepalives and invalid data.
+        else ; return
+        end
+
+      totals = ( @stats[stage][type] ||= [ 0, 0, 0 ] )
+      totals[0] += objects
+      totals[1] += malloc
+      totals[2] += 1
+
+      ids = @metrics[stage][type]
+      ::OverSIP::Metrics.add ids[0], objects
+      ::OverSIP::Metrics.add ids[1], malloc
+      ::OverSIP::Metrics.inc ids[2]
+    end
+    private_class_method :record
+
+
+    # Averages per message since the last reset: a Hash (by stage) of Hashes (by
+    # type) of [ objects, malloc bytes, samples ].
+    def self.averages
+      ::Hash[@stats.map do |stage, types|
+        [ stage, ::Hash[types.map {|type, (objects, malloc, samples)| [ type, [ objects.fdiv(samples), malloc.fdiv(samples), samples ] ]}] ]
+      end]
+    end
+
+
+    def self.reset
+      @stats = ::Hash.new {|hash, stage| hash[stage] = {}}
+    end
+
+
+    def self.log_stats
+      averages.each do |stage, types|
+        types.each do |type, (objects, malloc, samples)|
+          log_system_notice "#{stage} #{type}: #{objects.round(1)} objects, #{malloc.round} malloc bytes per message (#{samples} messages)"
+        end
+      end
+    end
+    private_class_method :log_stats
+
+  end
+
+end
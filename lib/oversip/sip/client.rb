@@ -107,7 +107,7 @@ module OverSIP::SIP
         timeout = @conf[:blacklist_time]
       end
 
-      blacklist_entry = @current_target.to_s
+      blacklist_entry = @current_target.blacklist_key
       @conf[:blacklist][blacklist_entry] = [status_code, reason_phrase, nil, :destination_blacklisted]
       ::EM.add_timer(timeout) { @conf[:blacklist].delete blacklist_entry }
     end
@@ -118,7 +118,7 @@ module OverSIP::SIP
     def client_timeout
       # Store the target and error in the blacklist.
       if @conf[:use_blacklist]
-        blacklist_entry = @current_target.to_s
+        blacklist_entry = @current_target.blacklist_key
         @conf[:blacklist][blacklist_entry] = [408, "Client Timeout", nil, :client_timeout]
         ::EM.add_timer(@conf[:blacklist_time]) { @conf[:blacklist].delete blacklist_entry }
       end
@@ -129,7 +129,7 @@ module OverSIP::SIP
     def connection_failed
       # Store the target and error in the blacklist.
       if @conf[:use_blacklist]
-        blacklist_entry = @current_target.to_s
+        blacklist_entry = @current_target.blacklist_key
         @conf[:blacklist][blacklist_entry] = [500, "Connection Error", nil, :connection_error]
         ::EM.add_timer(@conf[:blacklist_time]) { @conf[:blacklist].delete blacklist_entry }
       end
@@ -140,7 +140,7 @@ module OverSIP::SIP
     def tls_validation_failed
       # Store the target and error in the blacklist.
       if @conf[:use_blacklist]
-        blacklist_entry = @current_target.to_s
+        blacklist_entry = @current_target.blacklist_key
         @conf[:blacklist][blacklist_entry] = [500, "TLS Validation Failed", nil, :tls_validation_failed]
         ::EM.add_timer(@conf[:blacklist_time]) { @conf[:blacklist].delete blacklist_entry }
       end
@@ -249,6 +249,7 @@ module OverSIP::SIP
         dns_cache_key = "#{dst_scheme}|#{dst_host}|#{dst_port}|#{dst_transport}"
         if (result = @conf[:dns_cache][dns_cache_key])
           log_system_debug "destination found in the DNS cache"  if $oversip_debug
+          ::OverSIP::Metrics.dns_cache_lookup true
           if result.is_a? ::Symbol
             rfc3263_failed result
           else
@@ -256,6 +257,7 @@ module OverSIP::SIP
           end
           return true
         else
+          ::OverSIP::Metrics.dns_cache_lookup false
           return dns_cache_key
         end
       else
@@ -305,6 +307,7 @@ module OverSIP::SIP
 
 
     def rfc3263_succeeded result
+      ::OverSIP::SIP::Latency.mark @request, ::OverSIP::SIP::Latency::DNS
       # After RFC 3263 (DNS) resolution we get N targets.
       @num_target = 0
       @target = @targets = nil  # Avoid conflicts if same Proxy is used for serial forking to a new destination.
@@ -353,7 +356,7 @@ module OverSIP::SIP
 
     def use_target target
       # Lookup the target in the blacklist.
-      if @conf[:blacklist].any? and (blacklist_entry = @conf[:blacklist][target.to_s])
+      if @conf[:blacklist].any? and (blacklist_entry = @conf[:blacklist][target.blacklist_key])
         log_system_notice "destination found in the blacklist"  if $oversip_debug
         try_next_target blacklist_entry[0], blacklist_entry[1], blacklist_entry[2], blacklist_entry[3]
         return
@@ -371,8 +374,9 @@ module OverSIP::SIP
         return
       end
 
-      @client_transaction = (::OverSIP::SIP::ClientTransaction.get_class @request).new self, @request, @conf, target.transport, target.ip, target.ip_type, target.port
+      @client_transaction = (::OverSIP::SIP::ClientTransaction.get_class @request).new self, @request, @conf, target.transport, target.ip, target.ip_type, target.port, target.connection_key
       add_routing_headers
+      ::OverSIP::SIP::Latency.mark @request, ::OverSIP::SIP::Latency::SENT
       @client_transaction.send_request
     end
 
@@ -382,6 +386,7 @@ module OverSIP::SIP
 
 
     def rfc3263_failed error
+      ::OverSIP::SIP::Latency.mark @request, ::OverSIP::SIP::Latency::DNS
       case error
       when :rfc3263_domain_not_found
         log_system_debug "no resolution"  if $oversip_debug
@@ -15,7 +15,8 @@ module OverSIP::SIP
     attr_reader :core, :request, :state, :connection
 
     # In case _transport_ is a String, it's an Outbound flow token.
-    def initialize core, request, transaction_conf, transport, ip=nil, ip_type=nil, port=nil
+    # connection_key is the cached key of the destination (see RFC3263::Target#connection_key).
+    def initialize core, request, transaction_conf, transport, ip=nil, ip_type=nil, port=nil, connection_key=nil
       @core = core
       @request = request
       @transaction_conf = transaction_conf || {}
@@ -55,7 +56,7 @@ module OverSIP::SIP
             end
           end
 
-        @connection = ::OverSIP::SIP::TransportManager.get_connection @server_klass, @ip, @port, self, transaction_conf[:callback_on_server_tls_handshake]
+        @connection = ::OverSIP::SIP::TransportManager.get_connection @server_klass, @ip, @port, self, transaction_conf[:callback_on_server_tls_handshake], connection_key
       end
 
       # Ensure the request has Content-Length. Add it otherwise.
@@ -75,7 +76,7 @@ module OverSIP::SIP
 
   class InviteClientTransaction < ClientTransaction
 
-    def initialize core, request, transaction_conf, transport, ip=nil, ip_type=nil, port=nil
+    def initialize core, request, transaction_conf, transport, ip=nil, ip_type=nil, port=nil, connection_key=nil
       super
       @log_id = "ICT #{@transaction_id}"
 
@@ -122,6 +123,7 @@ module OverSIP::SIP
       end
 
       @connection.send_sip_msg @outgoing_request_str, @ip, @port
+      ::OverSIP::Metrics.request_sent @transport, @request.sip_method
 
       start_timer_A  if @transport == :udp
       start_timer_B
@@ -178,6 +180,7 @@ module OverSIP::SIP
     end
 
     def retransmit_request
+      ::OverSIP::Metrics.retransmission_sent @transport
       @connection.send_sip_msg @outgoing_request_str, @ip, @port
     end
 
@@ -304,6 +307,7 @@ module OverSIP::SIP
 
       log_system_debug "sending ACK for [3456]XX response"  if $oversip_debug
       @connection.send_sip_msg @ack, @ip, @port
+      ::OverSIP::Metrics.request_sent @transport, :ACK
     end
 
     # It receives the received CANCEL request as parameter so it can check the existence of
@@ -340,6 +344,7 @@ module OverSIP::SIP
       log_system_debug "sending CANCEL"  if $oversip_debug
 
       @connection.send_sip_msg @cancel, @ip, @port
+      ::OverSIP::Metrics.request_sent @transport, :CANCEL
 
       start_timer_E_cancel  if @transport == :udp
       start_timer_F_cancel
@@ -365,6 +370,7 @@ module OverSIP::SIP
     end
 
     def retransmit_cancel
+      ::OverSIP::Metrics.retransmission_sent @transport
       @connection.send_sip_msg @cancel, @ip, @port
     end
 
@@ -385,7 +391,7 @@ module OverSIP::SIP
 
   class NonInviteClientTransaction < ClientTransaction
 
-    def initialize core, request, transaction_conf, transport, ip=nil, ip_type=nil, port=nil
+    def initialize core, request, transaction_conf, transport, ip=nil, ip_type=nil, port=nil, connection_key=nil
       super
       @log_id = "NICT #{@transaction_id}"
 
@@ -453,6 +459,7 @@ module OverSIP::SIP
       end
 
       @connection.send_sip_msg @outgoing_request_str, @ip, @port
+      ::OverSIP::Metrics.request_sent @transport, @request.sip_method
 
       start_timer_E  if @transport == :udp
       start_timer_F
@@ -494,6 +501,7 @@ module OverSIP::SIP
     end
 
     def retransmit_request
+      ::OverSIP::Metrics.retransmission_sent @transport
       @connection.send_sip_msg @outgoing_request_str, @ip, @port
     end
 
@@ -562,7 +570,7 @@ module OverSIP::SIP
 
   class Ack2xxForwarder < ClientTransaction
 
-    def initialize core, request, transaction_conf, transport, ip=nil, ip_type=nil, port=nil
+    def initialize core, request, transaction_conf, transport, ip=nil, ip_type=nil, port=nil, connection_key=nil
       super
       @log_id = "ICT #{@transaction_id}"
     end
@@ -571,6 +579,7 @@ module OverSIP::SIP
       @request.insert_header "Via", "#{@server_klass.via_core};branch=z9hG4bK#{@transaction_id}"
 
       @connection.send_sip_msg @request.to_s, @ip, @port
+      ::OverSIP::Metrics.request_sent @transport, :ACK
     end
 
     def connection_failed
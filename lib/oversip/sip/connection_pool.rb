@@ -0,0 +1,161 @@
+module OverSIP::SIP
+
+  # Pools of persistent TCP/TLS client connections to the next hops configured in
+  # sip[connection_pool]. The connections are opened at startup (and reopened when
+  # closed) so requests sent to those destinations do not wait for the TCP connection
+  # and TLS handshake. Requests are spread across the connected connections of the
+  # pool (round robin).
+  module ConnectionPool
+
+    extend ::OverSIP::Logger
+
+    @log_id = "ConnectionPool"
+
+    # CRLF keepalive interval (seconds) for pooled connections when sip[crlf_keepalive_interval]
+    # is not set.
+    KEEPALIVE_INTERVAL = 30
+
+    # Interval (seconds) before reopening a pooled connection. It's doubled after
+    # every connection failure up to RECONNECT_MAX_INTERVAL.
+    RECONNECT_MIN_INTERVAL = 1
+    RECONNECT_MAX_INTERVAL = 64
+
+    # Pools indexed by server class and connection key.
+    @pools = {}
+
+
+    class Pool
+
+      include ::OverSIP::Logger
+
+      LOG_ID = "ConnectionPool"
+      def log_id
+        LOG_ID
+      end
+
+      attr_reader :server_class, :client_class, :ip, :port, :connection_key, :callback_on_server_tls_handshake
+
+      def initialize server_class, client_class, local_ip, ip, port, size, callback_on_server_tls_handshake=false
+        @server_class = server_class
+        @client_class = client_class
+        @local_ip = local_ip
+        @ip = ip
+        @port = port
+        @connection_key = ::OverSIP::Utils.connection_key ip, port
+        @callback_on_server_tls_handshake = callback_on_server_tls_handshake
+        @connections = ::Array.new size
+        @reconnect_intervals = ::Array.new size, RECONNECT_MIN_INTERVAL
+        @next = 0
+      end
+
+      def to_s
+        "#{@server_class.transport}:#{@server_class.ip_type == :ipv6 ? "[#{@ip}]" : @ip}:#{@port}"
+      end
+
+      def connect slot
+        conn = ::EM.oversip_connect_tcp_server(@local_ip, @ip, @port, @client_class, @ip, @port, self)
+        # Run OverSIP::SipEvents.on_server_tls_handshake() for pooled TLS connections if
+        # sip[connection_pool_callback_on_server_tls_handshake] is set.
+        conn.callback_on_server_tls_handshake = @callback_on_server_tls_handshake  if @server_class.transport == :tls
+        @connections[slot] = conn
+      rescue => e
+        log_system_error "error connecting to #{self}: #{e.class}: #{e.message}"
+        @reconnect_intervals[slot] = [ @reconnect_intervals[slot] * 2, RECONNECT_MAX_INTERVAL ].min
+        ::EM.add_timer(@reconnect_intervals[slot]) { connect slot  unless @connections[slot] }
+      end
+
+      def connect_all
+        @connections.size.times {|slot| connect slot}
+      end
+
+      # Returns the next connected connection (round robin) or nil.
+      def get_connection
+        size = @connections.size
+        size.times do
+          conn = @connections[@next]
+          @next = ( @next + 1 ) % size
+          return conn  if conn and conn.connected and not conn.error?
+        end
+        nil
+      end
+
+      # Called by the pooled connection when closed. The connection is reopened after
+      # a while (which grows while the destination keeps failing).
+      def connection_closed conn
+        return  unless (slot = @connections.index conn)
+        @connections[slot] = nil
+
+        if conn.connected
+          @reconnect_intervals[slot] = RECONNECT_MIN_INTERVAL
+        else
+          @reconnect_intervals[slot] = [ @reconnect_intervals[slot] * 2, RECONNECT_MAX_INTERVAL ].min
+        end
+
+        ::EM.add_timer(@reconnect_intervals[slot]) { connect slot  unless @connections[slot] }
+      end
+
+    end  # class Pool
+
+
+    def self.module_init
+      conf = ::OverSIP.configuration[:sip]
+      @pools = {}
+
+      return  unless conf[:connection_pool]
+
+      conf[:connection_pool].each do |destination|
+        destination =~ /\A(tcp|tls):(.+):(\d+)\z/i
+        transport = $1.downcase.to_sym
+        ip = ::OverSIP::Utils.to_pure_ip $2
+        port = $3.to_i
+        ip_type = ::OverSIP::Utils.ip_type ip
+
+        unless conf[:"sip_#{transport}"] and conf[:"enable_#{ip_type}"]
+          log_system_warn "ignoring connection pool to #{destination} (#{transport} over #{ip_type} not enabled)"
+          next
+        end
+
+        server_class, client_class, local_ip = case transport
+          when :tcp
+            case ip_type
+              when :ipv4 ; [ ::OverSIP::SIP::IPv4TcpServer, ::OverSIP::SIP::IPv4TcpClient, ::OverSIP::SIP.local_ipv4 ]
+              when :ipv6 ; [ ::OverSIP::SIP::IPv6TcpServer, ::OverSIP::SIP::IPv6TcpClient, ::OverSIP::SIP.local_ipv6 ]
+            end
+          when :tls
+            case ip_type
+              when :ipv4 ; [ ::OverSIP::SIP::IPv4TlsServer, ::OverSIP::SIP::IPv4TlsClient, ::OverSIP::SIP.local_ipv4 ]
+              when :ipv6 ; [ ::OverSIP::SIP::IPv6TlsServer, ::OverSIP::SIP::IPv6TlsClient, ::OverSIP::SIP.local_ipv6 ]
+            end
+          end
+
+        pool = Pool.new server_class, client_class, local_ip, ip, port, conf[:connection_pool_size], conf[:connection_pool_callback_on_server_tls_handshake]
+        ( @pools[server_class] ||= {} )[pool.connection_key] = pool
+      end
+    end
+
+
+    # Open the connections of all the pools (called once the reactor is running).
+    def self.run
+      @pools.each_value do |pools|
+        pools.each_value do |pool|
+          log_system_info "opening #{::OverSIP.configuration[:sip][:connection_pool_size]} connections to #{pool}"
+          pool.connect_all
+        end
+      end
+    end
+
+
+    # Returns a connected pooled connection to the given destination, nil if there
+    # is no pool to it or no connection is currently connected. A TLS pooled connection
+    # is not returned if the proxy requires OverSIP::SipEvents.on_server_tls_handshake()
+    # (callback_on_server_tls_handshake in proxies.conf) but the pool does not run it.
+    def self.get_connection server_class, connection_key, callback_on_server_tls_handshake=false
+      return nil  if @pools.empty?
+      return nil  unless (pools = @pools[server_class]) and (pool = pools[connection_key])
+      return nil  if callback_on_server_tls_handshake and not pool.callback_on_server_tls_handshake
+      pool.get_connection
+    end
+
+  end  # module ConnectionPool
+
+end
@@ -0,0 +1,179 @@
+module OverSIP::SIP
+
+  # Per-stage latency of received requests.
+  #
+  # Every received request carries an Array with monotonic timestamps taken at
+  # the main points of its processing:
+  #
+  # - RECEIVED : data received from the network.
+  # - PARSED   : the message has been parsed.
+  # - CORE     : OverSIP::SipEvents.on_request() is called.
+  # - ROUTED   : the request is routed (Proxy#route).
+  # - DNS      : RFC 3263 resolution (or DNS cache lookup) done.
+  # - SENT     : the request is sent to the first target.
+  # - RESPONSE : the first response is sent upstream (forwarded or generated by OverSIP).
+  #
+  # SENT is taken when the request is passed to the client transaction, so when
+  # a new TCP/TLS connection must be established the asynchronous connection (and
+  # TLS handshake) time is not part of the "transport" stage but of the "response"
+  # one (the request is queued until the connection is ready).
+  #
+  # Timestamps are just taken when the metrics are served (core[metrics_port] or
+  # core[metrics_socket]) or the slowest requests are logged.
+  #
+  # When the first response is sent the elapsed time between every pair of
+  # consecutive timestamps is observed into a histogram (keyed by stage and
+  # method). Optionally the slowest requests are logged periodically
+  # (core[latency_trace_size]).
+  module Latency
+
+    extend ::OverSIP::Logger
+
+    @log_id = "Latency"
+
+    RECEIVED = 0
+    PARSED   = 1
+    CORE     = 2
+    ROUTED   = 3
+    DNS      = 4
+    SENT     = 5
+    RESPONSE = 6
+
+    # Stage ending at each timestamp.
+    STAGES = [ nil, :parse, :dispatch, :user, :dns, :transport, :response ]
+
+    # Log scale buckets (seconds) from 100 us to 30 s.
+    BUCKETS = [ 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+                0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30 ]
+
+    # Interval (seconds) for logging the slowest requests.
+    TRACE_INTERVAL = 60
+
+
+    # Returns a Hash (by method) of series ids for the given stage.
+    def self.register_by_method stage
+      ids = ::Hash.new ::OverSIP::Metrics.register(:histogram, "oversip_sip_request_stage_seconds", "SIP request latency by processing stage", %{stage="#{stage}",method="other"}, BUCKETS)
+      ::OverSIP::Metrics::METHODS.each do |sip_method|
+        ids[sip_method] = ::OverSIP::Metrics.register :histogram, "oversip_sip_request_stage_seconds", "SIP request latency by processing stage", %{stage="#{stage}",method="#{sip_method}"}, BUCKETS
+      end
+      ids
+    end
+    private_class_method :register_by_method
+
+    @histograms = ::Hash[(STAGES.compact + [ :total ]).map {|stage| [ stage, register_by_method(stage) ]}]
+
+
+    def self.module_init
+      conf = ::OverSIP.configuration[:core]
+      @trace_size = conf[:latency_trace_size]
+      @enabled = ( conf[:metrics_port] or conf[:metrics_socket] or @trace_size ) ? true : false
+      @slowest = []
+    end
+
+
+    def self.enabled?
+      @enabled
+    end
+
+
+    # Start logging the slowest requests (if enabled).
+    def self.run
+      return  unless @trace_size
+
+      ::EM.add_periodic_timer(TRACE_INTERVAL) { log_slowest }
+    end
+
+
+    def self.now
+      ::Process.clock_gettime ::Process::CLOCK_MONOTONIC
+    end
+
+
+    # Called once a received request has been parsed (if enabled). received_at
+    # is the time in which its data was received.
+    def self.received request, received_at
+      request.timestamps = [ received_at || now, now, nil, nil, nil, nil, nil ]
+    end
+
+
+    # Sets the given timestamp of the request (if not already set). Requests
+    # generated by OverSIP (UacRequest) are ignored.
+    def self.mark request, index
+      return  unless request.is_a? ::OverSIP::SIP::Request and (timestamps = request.timestamps)
+      timestamps[index] ||= now
+    end
+
+
+    # Called when a response is sent for the request. Just the first one is taken
+    # into account.
+    def self.response_sent request
+      return  unless (timestamps = request.timestamps) and not timestamps[RESPONSE]
+      timestamps[RESPONSE] = now
+
+      sip_method = request.sip_method
+      prev = timestamps[RECEIVED]
+      breakdown = {}  if @trace_size
+
+      PARSED.upto(RESPONSE) do |index|
+        next  unless (timestamp = timestamps[index])
+
+        stage = STAGES[index]
+        if index == RESPONSE
+          # Replied by OverSIP (no routing).
+          if not timestamps[ROUTED]
+            stage = :user
+          # Replied after a routing failure (no target, DNS error...).
+          elsif not timestamps[SENT]
+            break
+          end
+        end
+
+        elapsed = timestamp - prev
+        ::OverSIP::Metrics.observe @histograms[stage][sip_method], elapsed
+        breakdown[stage] = elapsed  if breakdown
+        prev = timestamp
+      end
+
+      total = timestamps[RESPONSE] - timestamps[RECEIVED]
+      ::OverSIP::Metrics.observe @histograms[:total][sip_method], total
+
+      trace request, total, breakdown  if breakdown
+    end
+
+
+    # Keeps the slowest requests of the current interval.
+    def self.trace request, total, breakdown
+      if @slowest.size == @trace_size
+        return  if total <= @slowest[-1][0]
+        @slowest.pop
+      end
+
+      entry = [ total, request.sip_method, request.call_id, breakdown ]
+      index = @slowest.index {|e| e[0] < total} || @slowest.size
+      @slowest.insert index, entry
+    end
+    private_class_method :trace
+
+
+    def self.log_slowest
+      return  if @slowest.empty?
+
+      log_system_notice "#{@slowest.size} slowest requests in the last #{TRACE_INTERVAL} seconds:"
+      @slowest.each do |total, sip_method, call_id, breakdown|
+        stages = breakdown.map {|stage, elapsed| "#{stage}=#{format_ms elapsed}"}.join(" ")
+        log_system_notice "#{sip_method} Call-ID: #{call_id}: total=#{format_ms total} (#{stages})"
+      end
+
+      @slowest = []
+    end
+    private_class_method :log_slowest
+
+
+    def self.format_ms seconds
+      "%.3fms" % (seconds * 1000)
+    end
+    private_class_method :format_ms
+
+  end
+
+end
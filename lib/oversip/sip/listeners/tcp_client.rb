@@ -9,7 +9,9 @@ module OverSIP::SIP
     attr_reader :connected
     attr_reader :pending_client_transactions
 
-    def initialize ip, port
+    # pool is the OverSIP::SIP::ConnectionPool::Pool in case of a pooled connection (which
+    # is not added to the connections collection).
+    def initialize ip, port, pool=nil
       # NOTE: The parent class implementing "initialize" method is Connection, and allows no arguments.
       # If we call just "super" from here it will fail since "ip" and "port" will be passed as
       # arguments. So we must use "super()" and we are done (no arguments are passed to parent).
@@ -17,7 +19,11 @@ module OverSIP::SIP
 
       @remote_ip = ip
       @remote_port = port
-      @connection_id = ::OverSIP::SIP::TransportManager.add_connection self, self.class, self.class.ip_type, @remote_ip, @remote_port
+      if pool
+        @pool = pool
+      else
+        @connection_id = ::OverSIP::SIP::TransportManager.add_connection self, self.class, self.class.ip_type, @remote_ip, @remote_port
+      end
       @connected = false
       @pending_client_transactions = []
 
@@ -31,6 +37,15 @@ module OverSIP::SIP
 
       @connected = true
       @pending_client_transactions.clear
+
+      start_crlf_keepalive
+      reset_idle_deadline
+    end
+
+
+    # Pooled connections are never closed due to inactivity.
+    def reset_idle_deadline
+      @pool ? disarm_deadline : super
     end
 
 
@@ -44,9 +59,10 @@ module OverSIP::SIP
 
     def unbind cause=nil
       @state = :ignore
+      disarm_deadline
 
       # Remove the connection.
-      self.class.connections.delete @connection_id
+      self.class.connections.delete @connection_id  if @connection_id
 
       @local_closed = true  if cause == ::Errno::ETIMEDOUT
 
@@ -67,6 +83,8 @@ module OverSIP::SIP
         @pending_client_transactions.clear
       end unless $!
 
+      @pool.connection_closed self  if @pool
+
       @connected = false
     end
 
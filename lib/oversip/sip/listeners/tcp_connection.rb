@@ -6,6 +6,35 @@ module OverSIP::SIP
     # (avoid DoS attacks).
     HEADERS_MAX_SIZE = 16384
 
+    # Max time (seconds) for receiving the whole headers or body of a message once
+    # started (avoid slowloris attacks).
+    HEADERS_MAX_TIME = 10
+    BODY_MAX_TIME = 10
+
+    attr_accessor :keepalive_activity
+
+    # Coalescing of outgoing SIP messages: messages sent over the same connection within
+    # the same reactor tick are queued and written with a single send_data at the end
+    # of the tick (so a burst becomes a single write and, in TLS, a single TLS record
+    # rather than one per message). A message sent alone is just delayed until the end
+    # of the current tick.
+    @@num_writes = 0
+    @@num_written_messages = 0
+
+    def self.num_writes
+      @@num_writes
+    end
+
+    def self.num_written_messages
+      @@num_written_messages
+    end
+
+    # Average number of SIP messages per write.
+    def self.messages_per_write
+      return 0.0  if @@num_writes == 0
+      @@num_written_messages.to_f / @@num_writes
+    end
+
     def remote_ip_type
       @remote_ip_type || self.class.ip_type
     end
@@ -20,10 +49,12 @@ module OverSIP::SIP
 
     def receive_data data
       @state == :ignore and return
+      @keepalive_activity = true
+      @received_at = ::OverSIP::SIP::Latency.now  if ::OverSIP::SIP::Latency.enabled?
       @buffer << data
       @state == :waiting_for_on_client_tls_handshake and return
 
-      process_received_data
+      ::OverSIP::ReactorProbe.callback(:receive_data, self) { process_received_data }
     end
 
     def process_received_data
@@ -33,17 +64,18 @@ module OverSIP::SIP
         when :init
           @parser.reset
           @parser_nbytes = 0
+          reset_idle_deadline
           @state = :headers
 
         when :headers
           parse_headers
-          # TODO: Add a timer for the case in which an attacker sends us slow headers that never end:
-          #   http://ha.ckers.org/slowloris/.
 
         when :body
           get_body
 
         when :finished
+          capture_received_msg  if $oversip_capture
+
           if @msg.request?
             process_request
           else
@@ -64,6 +96,17 @@ module OverSIP::SIP
     def parse_headers
       return false if @buffer.empty?
 
+      # A single CRLF is the reply to our Outbound keepalive (see send_keepalive). Consume
+      # it so it does not start a message (and arm the headers deadline).
+      if @parser_nbytes == 0 and @buffer.size == 2 and @buffer.to_str == CRLF
+        log_system_debug "Outbound keepalive reply received"  if $oversip_debug
+        @buffer.read 2
+        return false
+      end
+
+      # Time in which the first data of this message was received.
+      @msg_received_at = @received_at  if @parser_nbytes == 0
+
       # Parse the currently buffered data. If parsing fails @parser_nbytes gets nil value.
       unless @parser_nbytes = @parser.execute(@buffer.to_str, @parser_nbytes)
         # The parsed data is invalid, however some data could be parsed so @parsed.parsed
@@ -71,6 +114,7 @@ module OverSIP::SIP
         # - SIP::Request
         # - SIP::Response
         # - nil (the message is so wrong that cannot be neither a request or response).
+        ::OverSIP::Metrics.parse_error transport
         if wrong_message = @parser.parsed
           log_system_warn "parsing error for #{MSG_TYPE[wrong_message.class]}: \"#{@parser.error}\""
         else
@@ -93,19 +137,26 @@ module OverSIP::SIP
         return false
       end
 
-      # If the parsing has not finished, it is correct in TCP so return false and wait for more data under :headers state.
-      return false  unless @parser.finished?
+      # If the parsing has not finished, it is correct in TCP so return false and wait for more data under :headers state
+      # (but not forever).
+      unless @parser.finished?
+        arm_deadline :headers, HEADERS_MAX_TIME  unless @deadline == :headers
+        return false
+      end
 
       # At this point we've got a SIP::Request, SIP::Response or :outbound_keepalive symbol.
       @msg = @parser.parsed
 
-      # Clear parsed data from the buffer.
-      @buffer.read(@parser_nbytes)
+      # Clear parsed data from the buffer (keep it for the SIP capture).
+      @raw_headers = @buffer.read(@parser_nbytes)
 
       # Received data is a Outbound keealive.
       if @msg == :outbound_keepalive
         log_system_debug "Outbound keepalive received, replying single CRLF"  if $oversip_debug
-        # Reply a single CRLF over the same connection.
+        # Reply a single CRLF over the same connection. It's written right away
+        # rather than queued with send_coalesced_data (a keepalive reply must not
+        # wait for the end of the tick, and a CRLF between SIP messages is ignored
+        # by the peer so the order with queued messages does not matter).
         send_data CRLF
         # If TCP then go back to :init state so possible remaining data would be processed.
         @state = :init
@@ -172,8 +223,11 @@ module OverSIP::SIP
     end  # parse_headers
 
     def get_body
-      # Return false until the buffer gets all the body.
-      return false if @buffer.size < @body_length
+      # Return false until the buffer gets all the body (but not forever).
+      if @buffer.size < @body_length
+        arm_deadline :body, BODY_MAX_TIME  unless @deadline == :body
+        return false
+      end
 
       ### TODO: Creo que es mejor forzarlo a BINARY y no a UTF-8. Aunque IOBuffer ya lo saca siempre en BINARY.
       # ¿Por qué lo forcé a UTF-8?
@@ -186,16 +240,124 @@ module OverSIP::SIP
     end
 
 
+    # Connection deadlines (see OverSIP::DeadlineWheel).
+    def arm_deadline reason, seconds
+      @deadline = reason
+      ::OverSIP::DeadlineWheel.arm self, seconds, reason
+    end
+
+    def disarm_deadline
+      return  unless @deadline
+      @deadline = nil
+      ::OverSIP::DeadlineWheel.disarm self
+    end
+
+    # Wait for new messages up to sip[idle_connection_timeout] seconds (if set).
+    def reset_idle_deadline
+      if (idle_connection_timeout = ::OverSIP::SIP.idle_connection_timeout)
+        arm_deadline :idle, idle_connection_timeout
+      else
+        disarm_deadline
+      end
+    end
+
+    # Called by OverSIP::DeadlineWheel. Returns true if the connection is closed.
+    def deadline_expired reason
+      @deadline = nil
+      return false  if @state == :ignore
+
+      log_system_notice "#{reason} deadline expired, closing connection with #{remote_desc}"
+      close_connection
+      @state = :ignore
+      true
+    end
+
+
+    # Schedule Outbound (RFC 5626) CRLF keepalives in the shared OverSIP::KeepAliveScheduler
+    # (if enabled, and always for pooled connections).
+    def start_crlf_keepalive
+      if (interval = ::OverSIP::SIP.crlf_keepalive_interval || ( @pool && ::OverSIP::SIP::ConnectionPool::KEEPALIVE_INTERVAL ))
+        ::OverSIP::KeepAliveScheduler.for_interval(interval).add self
+      end
+    end
+
+    def keepalive?
+      @state != :ignore and ! error?
+    end
+
+    # NOTE: The peer replies a single CRLF which is consumed in parse_headers.
+    def send_keepalive
+      log_system_debug "sending Outbound CRLF keepalive"  if $oversip_debug
+      # Not queued with send_coalesced_data on purpose (see the single CRLF reply in
+      # process_received_data).
+      send_data DOUBLE_CRLF
+    end
+
+
     # Parameters ip and port are just included because they are needed in UDP, so the API remains equal.
     def send_sip_msg msg, ip=nil, port=nil
       if self.error?
         log_system_notice "SIP message could not be sent, connection is closed"
         return false
       end
-      send_data msg
+      capture_sent_msg msg  if $oversip_capture
+      send_coalesced_data msg
       true
     end
 
+
+    def capture_received_msg
+      local_ip, local_port = local_ip_port
+      ::OverSIP::Capture.write remote_ip, remote_port, local_ip, local_port, transport, @raw_headers, @msg.body
+    end
+
+    def capture_sent_msg msg
+      local_ip, local_port = local_ip_port
+      ::OverSIP::Capture.write local_ip, local_port, remote_ip, remote_port, transport, msg, nil
+    end
+
+
+    def send_coalesced_data data
+      if @outgoing_data
+        # Second message within this tick, so create the buffer.
+        if @num_outgoing_messages == 1
+          @outgoing_data = "".force_encoding(::Encoding::BINARY) << @outgoing_data
+        end
+        # Same encoding so concatenation never fails (bytes are what matter).
+        @outgoing_data.force_encoding(data.encoding) << data
+        @num_outgoing_messages += 1
+      else
+        @outgoing_data = data
+        @num_outgoing_messages = 1
+        ::EM.next_tick { flush_outgoing_data }
+      end
+    end
+    private :send_coalesced_data
+
+
+    def flush_outgoing_data
+      return  unless @outgoing_data
+
+      unless error?
+        send_data @outgoing_data
+        @@num_writes += 1
+        @@num_written_messages += @num_outgoing_messages
+      end
+      @outgoing_data = nil
+    end
+    private :flush_outgoing_data
+
+
+    # Ensure queued messages are written before closing the connection after writing.
+    def close_connection after_writing=false
+      if after_writing
+        flush_outgoing_data
+      else
+        @outgoing_data = nil
+      end
+      super
+    end
+
   end
 
 end
@@ -28,6 +28,11 @@ module OverSIP::SIP
         set_sock_opt Socket::SOL_TCP, Socket::TCP_KEEPINTVL, ::OverSIP::SIP.tcp_keepalive_interval  # Interval between TCP pings.
       end
 
+      start_crlf_keepalive
+
+      # TLS connections already have the TLS handshake deadline.
+      reset_idle_deadline  unless @deadline
+
       log_system_debug("connection opened from " << remote_desc)  if $oversip_debug
     end
 
@@ -48,6 +53,7 @@ module OverSIP::SIP
 
     def unbind cause=nil
       @state = :ignore
+      disarm_deadline
 
       # Remove the connection.
       self.class.connections.delete @connection_id
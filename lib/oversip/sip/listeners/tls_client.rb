@@ -8,7 +8,7 @@ module OverSIP::SIP
     attr_writer :callback_on_server_tls_handshake
 
 
-    def initialize ip, port
+    def initialize ip, port, pool=nil
       super
       @pending_messages = []
     end
@@ -18,22 +18,12 @@ module OverSIP::SIP
       @server_pems = []
       @server_last_pem = false
 
-      start_tls({
-        :verify_peer => @callback_on_server_tls_handshake,
-        :cert_chain_file => ::OverSIP.tls_public_cert,
-        :private_key_file => ::OverSIP.tls_private_cert,
-        :ssl_version => %w(tlsv1 tlsv1_1 tlsv1_2)
-      })
+      start_tls ::OverSIP::TLS.client_options(@callback_on_server_tls_handshake)
 
       # If the remote server does never send us a TLS certificate
       # after the TCP connection we would leak by storing more and
       # more messages in @pending_messages array.
-      @timer_tls_handshake = ::EM::Timer.new(TLS_HANDSHAKE_MAX_TIME) do
-        unless @connected
-          log_system_notice "TLS handshake not performed within #{TLS_HANDSHAKE_MAX_TIME} seconds, closing the connection"
-          close_connection
-        end
-      end
+      arm_deadline :tls_handshake, TLS_HANDSHAKE_MAX_TIME
     end
 
 
@@ -60,44 +50,72 @@ module OverSIP::SIP
       # @connected in TlsClient means "TLS connection" rather than
       # just "TCP connection".
       @connected = true
-      @timer_tls_handshake.cancel  if @timer_tls_handshake
+      reset_idle_deadline
+      ::OverSIP::TLS.client_handshake_completed
+
+      start_crlf_keepalive
+
+      # Without OverSIP::SipEvents.on_server_tls_handshake() send the pending messages now.
+      unless @callback_on_server_tls_handshake
+        send_pending_messages
+        return
+      end
 
       # Run OverSIP::SipEvents.on_server_tls_handshake.
-      ::Fiber.new do
-        if @callback_on_server_tls_handshake
-          log_system_debug "running OverSIP::SipEvents.on_server_tls_handshake()..."  if $oversip_debug
-          begin
-            ::OverSIP::SipEvents.on_server_tls_handshake self, @server_pems
-          rescue ::Exception => e
-            log_system_error "error calling OverSIP::SipEvents.on_server_tls_handshake():"
-            log_system_error e
-            close_connection
-          end
-
-          # If the user or peer has closed the connection in the on_server_tls_handshake() callback
-          # then notify pending transactions.
-          if @local_closed or error?
-            log_system_debug "connection closed, aborting"  if $oversip_debug
-            @pending_client_transactions.each do |client_transaction|
-              client_transaction.tls_validation_failed
-            end
-            @pending_client_transactions.clear
-            @pending_messages.clear
-            @state = :ignore
-          end
+      spawned = ::OverSIP.fiber_pool.spawn do
+        log_system_debug "running OverSIP::SipEvents.on_server_tls_handshake()..."  if $oversip_debug
+        begin
+          ::OverSIP::SipEvents.on_server_tls_handshake self, @server_pems
+        rescue ::Exception => e
+          log_system_error "error calling OverSIP::SipEvents.on_server_tls_handshake():"
+          log_system_error e
+          close_connection
         end
 
-        @pending_client_transactions.clear
-        @pending_messages.each do |msg|
-          send_data msg
+        # If the user or peer has closed the connection in the on_server_tls_handshake() callback
+        # then notify pending transactions.
+        if @local_closed or error?
+          log_system_debug "connection closed, aborting"  if $oversip_debug
+          abort_pending_messages :tls_validation_failed
+        else
+          send_pending_messages
         end
-        @pending_messages.clear
-      end.resume
+      end
+
+      # The fiber pool queue is full.
+      unless spawned
+        log_system_notice "fiber pool full, cannot run the TLS handshake callback, closing connection"
+        abort_pending_messages :connection_failed
+        close_connection
+      end
     end
 
+
+    def send_pending_messages
+      @pending_client_transactions.clear
+      @pending_messages.each do |msg|
+        send_coalesced_data msg
+      end
+      @pending_messages.clear
+    end
+    private :send_pending_messages
+
+
+    # Notifies the pending client transactions (calling the given method) and
+    # drops the pending messages.
+    def abort_pending_messages method
+      @pending_client_transactions.each do |client_transaction|
+        client_transaction.send method
+      end
+      @pending_client_transactions.clear
+      @pending_messages.clear
+      @state = :ignore
+    end
+    private :abort_pending_messages
+
     def unbind cause=nil
       super
-      @timer_tls_handshake.cancel  if @timer_tls_handshake
+      disarm_deadline
       @pending_messages.clear
     end
 
@@ -111,8 +129,10 @@ module OverSIP::SIP
         return false
       end
 
+      capture_sent_msg msg  if $oversip_capture
+
       if @connected
-        send_data msg
+        send_coalesced_data msg
       else
         log_system_debug "TLS handshake not completed yet, waiting before sending the message"  if $oversip_debug
         @pending_messages << msg
@@ -6,6 +6,11 @@ module OverSIP::SIP
     # (avoid DoS attacks).
     HEADERS_MAX_SIZE = 16384
 
+    # TLVs of the HAProxy Protocol v2 header (Hash with :unique_id, :ssl,
+    # :ssl_client_cert, :ssl_client_cert_verified, :ssl_version, :ssl_cn and
+    # :ssl_cipher), nil if not given by the TLS proxy.
+    attr_reader :haproxy_protocol_tlvs
+
     def process_received_data
       @state == :ignore and return
 
@@ -13,6 +18,7 @@ module OverSIP::SIP
         when :init
           @parser.reset
           @parser_nbytes = 0
+          reset_idle_deadline
           # If it's a TCP connection from the TLS tunnel then parse the HAProxy Protocol line
           # if it's not yet done.
           unless @haproxy_protocol_parsed
@@ -31,6 +37,8 @@ module OverSIP::SIP
           get_body
 
         when :finished
+          capture_received_msg  if $oversip_capture
+
           if @msg.request?
             process_request
           else
@@ -50,13 +58,24 @@ module OverSIP::SIP
     end
 
     def parse_haproxy_protocol
-      if (haproxy_protocol_data = ::OverSIP::Utils.parse_haproxy_protocol(@buffer.to_str))
+      haproxy_protocol_data = ::OverSIP::Utils.parse_haproxy_protocol(@buffer.to_str)
+
+      # Wait for more data.
+      return false  if haproxy_protocol_data.nil?
+
+      if haproxy_protocol_data
         @haproxy_protocol_parsed = true
 
-        # Update connection information.
-        @remote_ip_type = haproxy_protocol_data[1]
-        @remote_ip = haproxy_protocol_data[2]
-        @remote_port = haproxy_protocol_data[3]
+        # Update connection information (a v2 header with LOCAL command keeps the
+        # address of the TLS proxy).
+        if haproxy_protocol_data[1]
+          @remote_ip_type = haproxy_protocol_data[1]
+          @remote_ip = haproxy_protocol_data[2]
+          @remote_port = haproxy_protocol_data[3]
+        else
+          @remote_ip_type = self.class.ip_type
+        end
+        @haproxy_protocol_tlvs = haproxy_protocol_data[4]
 
         # Add the connection with the client's source data. Note that we pass a TlsServer as class, but
         # the server instance is a TcpServer.
@@ -75,6 +94,12 @@ module OverSIP::SIP
 
         @state = :headers
 
+        # The TLS proxy informs about the client TLS connection (HAProxy Protocol v2).
+        if @haproxy_protocol_tlvs and @haproxy_protocol_tlvs[:ssl] and ::OverSIP::SIP.callback_on_client_tls_handshake
+          run_on_client_tls_handshake
+          return false
+        end
+
       else
         log_system_error "HAProxy Protocol parsing error, closing connection"
         close_connection_after_writing
@@ -83,6 +108,62 @@ module OverSIP::SIP
       end
     end
 
+
+    # The client (given by the HAProxy Protocol) may use an IP family other than the
+    # one of this tunnel listener, so the SIP capture takes the listening IP and port
+    # of the TLS tunnel server of the client's family. If there is no such server the
+    # messages of the connection cannot be captured (mixed families in a HEP3 packet).
+    def local_ip_port
+      @local_ip_port ||= if @remote_ip_type.nil? or @remote_ip_type == self.class.ip_type
+        [ self.class.ip, self.class.port ]
+      else
+        klass = ( @remote_ip_type == :ipv4 ? ::OverSIP::SIP::IPv4TlsTunnelServer : ::OverSIP::SIP::IPv6TlsTunnelServer )
+        if klass.ip
+          [ klass.ip, klass.port ]
+        else
+          log_system_notice "no #{@remote_ip_type == :ipv4 ? "IPv4" : "IPv6"} TLS tunnel server, SIP messages of this connection are not captured"
+          [ nil, nil ]
+        end
+      end
+    end
+
+
+    # The client certificates are not available (the TLS proxy terminates TLS) so
+    # the callback is given an empty pems Array and must check the haproxy_protocol_tlvs
+    # of the connection (i.e. :ssl_client_cert_verified and :ssl_cn).
+    def run_on_client_tls_handshake
+      # Set the state to :waiting_for_on_client_tls_handshake so data received before
+      # user callback validation is just stored.
+      @state = :waiting_for_on_client_tls_handshake
+
+      spawned = ::OverSIP.fiber_pool.spawn do
+        begin
+          log_system_debug "running OverSIP::SipEvents.on_client_tls_handshake()..."  if $oversip_debug
+          ::OverSIP::SipEvents.on_client_tls_handshake self, []
+          # If the user of the peer has not closed the connection then continue.
+          unless @local_closed or error?
+            @state = :headers
+            # Call process_received_data() to process possible data received in the meanwhile.
+            process_received_data
+          else
+            log_system_debug "connection closed, aborting"  if $oversip_debug
+          end
+
+        rescue ::Exception => e
+          log_system_error "error calling OverSIP::SipEvents.on_client_tls_handshake():"
+          log_system_error e
+          close_connection
+        end
+      end
+
+      # The fiber pool queue is full.
+      unless spawned
+        log_system_notice "fiber pool full, cannot run the TLS handshake callback, closing connection"
+        @state = :ignore
+        close_connection
+      end
+    end
+
   end
 
 end
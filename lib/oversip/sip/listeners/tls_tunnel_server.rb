@@ -18,6 +18,11 @@ module OverSIP::SIP
       # Create an Outbound (RFC 5626) flow token for this connection.
       @outbound_flow_token = ::OverSIP::SIP::TransportManager.add_outbound_connection self
 
+      start_crlf_keepalive
+
+      # TLS connections already have the TLS handshake deadline.
+      reset_idle_deadline  unless @deadline
+
       log_system_debug ("connection from the TLS tunnel " << remote_desc)  if $oversip_debug
     end
 
@@ -38,6 +43,7 @@ module OverSIP::SIP
 
     def unbind cause=nil
       @state = :ignore
+      disarm_deadline
 
       # Remove the connection.
       self.class.connections.delete @connection_id  if @connection_id
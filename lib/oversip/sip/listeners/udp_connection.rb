@@ -3,8 +3,13 @@ module OverSIP::SIP
   class UdpConnection < Connection
 
     def receive_data data
+      @msg_received_at = ::OverSIP::SIP::Latency.now  if ::OverSIP::SIP::Latency.enabled?
       @buffer << data
 
+      ::OverSIP::ReactorProbe.callback(:receive_data, self) { process_received_data }
+    end
+
+    def process_received_data
       while (case @state
         when :init
           @parser.reset
@@ -65,6 +70,8 @@ module OverSIP::SIP
           return false
         end
 
+      ::OverSIP::Capture.write source_ip, source_port, self.class.ip, self.class.port, :udp, buffer_str, nil  if $oversip_capture
+
       # Parse the currently buffered data. If parsing fails @parser_nbytes gets nil value.
       unless @parser_nbytes = @parser.execute(buffer_str, @parser_nbytes)
         # The parsed data is invalid, however some data could be parsed so @parsed.parsed
@@ -72,6 +79,7 @@ module OverSIP::SIP
         # - SIP::Request
         # - SIP::Response
         # - nil (the message is so wrong that cannot be neither a request or response).
+        ::OverSIP::Metrics.parse_error :udp
         if wrong_message = @parser.parsed
           log_system_warn "parsing error for #{MSG_TYPE[wrong_message.class]}: \"#{@parser.error}\""
         else
@@ -197,6 +205,7 @@ module OverSIP::SIP
     end  # parse_headers
 
     def send_sip_msg msg, ip, port
+      ::OverSIP::Capture.write self.class.ip, self.class.port, ip, port, :udp, msg, nil  if $oversip_capture
       send_datagram msg, ip, port
       true
     end
@@ -73,6 +73,9 @@ module OverSIP::SIP
 
 
     def process_request
+      ::OverSIP::Metrics.request_received @msg.transport, @msg.sip_method
+      ::OverSIP::SIP::Latency.received @msg, @msg_received_at  if ::OverSIP::SIP::Latency.enabled?
+
       # Run the user provided OverSIP::SipEvents.on_request() callback (unless the request
       # it's a retransmission, a CANCEL or an ACK for a final non-2XX response).
       unless check_transaction
@@ -87,6 +90,9 @@ module OverSIP::SIP
           return
         end
 
+        # Shed new initial requests under overload (prior to any other processing).
+        return  if ::OverSIP::SIP::OverloadControl.shed @msg
+
         # Create the antiloop identifier for this request.
         @msg.antiloop_id = ::OverSIP::SIP::Tags.create_antiloop_id(@msg)
 
@@ -100,16 +106,21 @@ module OverSIP::SIP
         @msg.tvars = {}
         @msg.cvars = @msg.connection.cvars
 
-        # Run OverSIP::SipEvents.on_request within a fiber.
-        ::Fiber.new do
-          begin
-            ::OverSIP::SipEvents.on_request @msg
-          rescue ::Exception => e
-            log_system_error "error calling OverSIP::SipEvents.on_request() => 500:"
-            log_system_error e
-            @msg.reply 500, "Internal Error", ["Content-Type: text/plain"], "#{e.class}: #{e.message}"
-          end
-        end.resume
+        # Run OverSIP::SipEvents.on_request within a pooled fiber (the block may be
+        # queued until a fiber is available, so don't refer to @msg within it).
+        request = @msg
+        ::OverSIP::ReactorProbe.user do
+          ::OverSIP.fiber_pool.spawn do
+            ::OverSIP::SIP::Latency.mark request, ::OverSIP::SIP::Latency::CORE
+            begin
+              ::OverSIP::SipEvents.on_request request
+            rescue ::Exception => e
+              log_system_error "error calling OverSIP::SipEvents.on_request() => 500:"
+              log_system_error e
+              request.reply 500, "Internal Error", ["Content-Type: text/plain"], "#{e.class}: #{e.message}"
+            end
+          end or ::OverSIP::SIP::OverloadControl.reject(request)
+        end
       end
     end
     private :process_request
@@ -117,6 +128,8 @@ module OverSIP::SIP
 
     # Process a received response.
     def process_response
+      ::OverSIP::Metrics.response_received @msg.transport, @msg.status_code
+
       case @msg.sip_method
       when :INVITE
         if client_transaction = @msg.connection.class.invite_client_transactions[@msg.via_branch_id]
@@ -154,6 +167,7 @@ module OverSIP::SIP
             log_system_debug "INVITE retransmission received via other connection, updating server transaction"  if $oversip_debug
             server_transaction.request.connection = @msg.connection
           end
+          ::OverSIP::Metrics.retransmission_received @msg.transport
           server_transaction.retransmit_last_response
           return true
         end
@@ -200,6 +214,7 @@ module OverSIP::SIP
             log_system_debug "#{server_transaction.request.sip_method} retransmission received via other connection, updating server transaction"  if $oversip_debug
             server_transaction.request.connection = @msg.connection
           end
+          ::OverSIP::Metrics.retransmission_received @msg.transport
           server_transaction.retransmit_last_response
           return true
         end
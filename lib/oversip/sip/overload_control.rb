@@ -0,0 +1,159 @@
+module OverSIP::SIP
+
+  # Overload control. Every CHECK_INTERVAL seconds the reactor lag (see
+  # OverSIP::ReactorProbe) and the number of live server transactions are
+  # compared with sip[overload_max_lag] and sip[overload_max_transactions]. While
+  # any of them is exceeded (or the queue of the fiber pool running
+  # OverSIP::SipEvents.on_request() is more than half full or has rejected
+  # requests) the reduction percentage grows (and it decreases again once they
+  # are not).
+  #
+  # New initial requests are rejected with 503 and Retry-After with a probability
+  # given by the reduction: initial INVITEs with that percentage and other initial
+  # requests (REGISTER, SUBSCRIBE, OPTIONS...) with the double, so new calls are
+  # shed last. In-dialog requests, ACK, CANCEL and responses are always admitted.
+  #
+  # Upstream peers supporting overload control (RFC 7339, "oc" parameter in their
+  # Via) get the reduction in the Via of every response, so they shed requests
+  # before sending them ("loss" algorithm).
+  module OverloadControl
+
+    extend ::OverSIP::Logger
+
+    @log_id = "OverloadControl"
+
+    CHECK_INTERVAL = 0.5
+
+    # Reduction (percentage) increment/decrement in every check.
+    REDUCTION_STEP_UP = 10
+    REDUCTION_STEP_DOWN = 5
+
+    # Validity (milliseconds) of the reduction sent to upstream peers (RFC 7339).
+    OC_VALIDITY = 5000
+
+    @reduction = 0
+    @num_rejected = 0
+
+    @reduction_gauge = ::OverSIP::Metrics.register :gauge, "oversip_sip_overload_reduction", "Percentage of new requests being shed due to overload"
+    @rejected = {
+      :INVITE => ::OverSIP::Metrics.register(:counter, "oversip_sip_overload_rejected_total", "Initial requests rejected due to overload", %{method="INVITE"}),
+      :other => ::OverSIP::Metrics.register(:counter, "oversip_sip_overload_rejected_total", "Initial requests rejected due to overload", %{method="other"})
+    }
+
+    class << self
+      # Current reduction (percentage of initial INVITEs to reject).
+      attr_reader :reduction
+      attr_reader :num_rejected
+    end
+
+
+    def self.module_init
+      conf = ::OverSIP.configuration[:sip]
+
+      @max_lag = conf[:overload_max_lag] ? conf[:overload_max_lag] / 1000.0 : nil
+      @max_transactions = conf[:overload_max_transactions]
+      @retry_after = "Retry-After: #{conf[:overload_retry_after]}"
+      @reduction = 0
+      set_oc_seq
+
+      # Blocks rejected by the fiber pool running OverSIP::SipEvents.on_request() (full
+      # queue) are a sign of overload.
+      ::OverSIP.fiber_pool.on_reject = proc { @fiber_pool_rejected = true }
+    end
+
+
+    # Start the periodic checks (if enabled).
+    def self.run
+      return  unless @max_lag or @max_transactions
+
+      ::EM.add_periodic_timer(CHECK_INTERVAL) { check }
+    end
+
+
+    def self.check
+      overloaded = ( @max_lag and ::OverSIP::ReactorProbe.last_lag > @max_lag ) ||
+                   ( @max_transactions and num_server_transactions > @max_transactions ) ||
+                   fiber_pool_saturated? || @fiber_pool_rejected
+      @fiber_pool_rejected = false
+
+      if overloaded
+        return  if @reduction == 100
+        log_system_warn "overload detected (reactor lag #{(::OverSIP::ReactorProbe.last_lag * 1000).round} ms), shedding new requests"  if @reduction == 0
+        @reduction = [ @reduction + REDUCTION_STEP_UP, 100 ].min
+      else
+        return  if @reduction == 0
+        @reduction = [ @reduction - REDUCTION_STEP_DOWN, 0 ].max
+        log_system_notice "overload finished"  if @reduction == 0
+      end
+
+      set_oc_seq
+      ::OverSIP::Metrics.set @reduction_gauge, @reduction
+    end
+    private_class_method :check
+
+
+    def self.num_server_transactions
+      ::OverSIP::Metrics.transaction_classes.inject(0) do |num, klass|
+        num + klass.invite_server_transactions.size + klass.non_invite_server_transactions.size
+      end
+    end
+    private_class_method :num_server_transactions
+
+
+    # More than half of the queue of the fiber pool running OverSIP::SipEvents.on_request()
+    # is used.
+    def self.fiber_pool_saturated?
+      pool = ::OverSIP.fiber_pool
+      pool.max_queue and pool.queue_size > pool.max_queue / 2
+    end
+    private_class_method :fiber_pool_saturated?
+
+
+    # The "oc-seq" value must increase every time the reduction changes (RFC 7339 5.2).
+    def self.set_oc_seq
+      @oc_seq = "%.3f" % ::Time.now.to_f
+    end
+    private_class_method :set_oc_seq
+
+
+    # Called for every received request before running OverSIP::SipEvents.on_request().
+    # If the request must be shed it's replied with 503 and true is returned.
+    def self.shed request
+      return false  if @reduction == 0
+      return false  unless request.initial? and request.sip_method != :ACK
+
+      rate = ( request.sip_method == :INVITE ) ? @reduction : @reduction * 2
+      return false  if rate < 100 and ::Kernel.rand(100) >= rate
+
+      reject request
+      true
+    end
+
+
+    # Replies 503 to the given request (also used when the queue of the fiber pool
+    # running OverSIP::SipEvents.on_request() is full).
+    def self.reject request
+      @num_rejected += 1
+      ::OverSIP::Metrics.inc @rejected[ request.sip_method == :INVITE ? :INVITE : :other ]
+      log_system_debug "overload: rejecting #{request.sip_method} => 503"  if $oversip_debug
+
+      request.reply 503, "Server Overloaded", [ @retry_after ]
+    end
+
+
+    # Returns the given top Via header of a response (to a request whose top Via
+    # contains the "oc" parameter) with the RFC 7339 overload control parameters.
+    def self.oc_via via
+      # Remove the "oc" and "oc-*" parameters set by the peer.
+      via = via.gsub(/;\s*oc(-[a-z]+)?(\s*=\s*("[^"]*"|[^;\s]*))?(?=[;\s]|\z)/i, "")
+
+      if @reduction > 0
+        "#{via};oc=#{@reduction};oc-algo=\"loss\";oc-validity=#{OC_VALIDITY};oc-seq=#{@oc_seq}"
+      else
+        "#{via};oc=0;oc-algo=\"loss\";oc-validity=0;oc-seq=#{@oc_seq}"
+      end
+    end
+
+  end
+
+end
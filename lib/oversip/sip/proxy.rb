@@ -23,6 +23,7 @@ module OverSIP::SIP
       end
 
       @log_id = "Proxy #{@conf[:name]} #{@request.via_branch_id}"
+      ::OverSIP::SIP::Latency.mark @request, ::OverSIP::SIP::Latency::ROUTED
 
       # Create the server transaction if it doesn't exist yet.
       @server_transaction = @request.server_transaction or case @request.sip_method
@@ -49,6 +50,7 @@ module OverSIP::SIP
 
         if @client_transaction.connection
           add_routing_headers
+          ::OverSIP::SIP::Latency.mark @request, ::OverSIP::SIP::Latency::SENT
           @client_transaction.send_request
         else
           unless @request.sip_method == :ACK
@@ -21,6 +21,8 @@ module OverSIP::SIP
 
     attr_accessor :cvars  # Connection variables (a hash).
 
+    attr_accessor :timestamps  # Monotonic timestamps of the processing stages (see OverSIP::SIP::Latency).
+
 
     def log_id
       @log_id ||= "SIP Request #{@via_branch_id}"
@@ -44,40 +46,21 @@ module OverSIP::SIP
       end
       return false  unless @server_transaction.receive_response(status_code)  if @server_transaction
 
-      reason_phrase ||= REASON_PHRASE[status_code] || REASON_PHRASE_NOT_SET
-
       if status_code > 100
         @internal_to_tag ||= @to_tag || ( @server_transaction ? ::SecureRandom.hex(6) : ::OverSIP::SIP::Tags.totag_for_sl_reply )
       end
 
-      response = "SIP/2.0 #{status_code} #{reason_phrase}\r\n"
-
-      @hdr_via.each do |hdr|
-        response << "Via: " << hdr << CRLF
-      end
-
-      response << "From: " << @hdr_from << CRLF
-
-      response << "To: " << @hdr_to
-      response << ";tag=#{@internal_to_tag}"  if @internal_to_tag
-      response << CRLF
+      # RFC 7339 overload control parameters for upstream peers supporting it.
+      first_via = ::OverSIP::SIP::OverloadControl.oc_via(@hdr_via[0])  if @via_params and @via_params.has_key? "oc"
 
-      response << "Call-ID: " << @call_id << CRLF
-      response << "CSeq: " << @cseq.to_s << " " << @sip_method.to_s << CRLF
-      response << "Content-Length: #{body ? body.bytesize : "0"}\r\n"
-
-      extra_headers.each do |header|
-        response << header.to_s << CRLF
-      end  if extra_headers
-
-      response << HDR_SERVER << CRLF
-      response << CRLF
-
-      response << body  if body
+      # Built in C (sip_parser extension) with the values captured by the parser.
+      response = build_reply status_code, reason_phrase, first_via, extra_headers, body
 
       @server_transaction.last_response = response  if @server_transaction
 
-      log_system_debug "replying #{status_code} \"#{reason_phrase}\""  if $oversip_debug
+      log_system_debug "replying #{status_code} \"#{reason_phrase || REASON_PHRASE[status_code] || REASON_PHRASE_NOT_SET}\""  if $oversip_debug
+      ::OverSIP::Metrics.response_sent @transport, status_code
+      ::OverSIP::SIP::Latency.response_sent self  if @timestamps and status_code > 100
 
       send_response(response)
       true
@@ -87,6 +70,11 @@ module OverSIP::SIP
     def reply_full response
       return false  unless @server_transaction.receive_response(response.status_code)  if @server_transaction
 
+      # RFC 7339 overload control parameters for upstream peers supporting it.
+      if @via_params and @via_params.has_key? "oc" and (vias = response.headers["Via"])
+        vias[0] = ::OverSIP::SIP::OverloadControl.oc_via vias[0]
+      end
+
       # Ensure the response has Content-Length. Add it otherwise.
       if response.body
         response.headers["Content-Length"] = [ response.body.bytesize.to_s ]
@@ -98,6 +86,8 @@ module OverSIP::SIP
       @server_transaction.last_response = response_leg_a  if @server_transaction
 
       log_system_debug "forwarding response #{response.status_code} \"#{response.reason_phrase}\""  if $oversip_debug
+      ::OverSIP::Metrics.response_sent @transport, response.status_code
+      ::OverSIP::SIP::Latency.response_sent self  if @timestamps and response.status_code > 100
 
       send_response(response_leg_a)
       true
@@ -5,6 +5,17 @@ module OverSIP::SIP
     Target = ::Struct.new(:transport, :ip, :ip_type, :port)
 
     class Target
+      # Compact binary key of the IP and port (see OverSIP::Utils.connection_key) for
+      # looking up TCP/TLS connections, computed once.
+      def connection_key
+        @connection_key ||= ::OverSIP::Utils.connection_key self[1], self[3]
+      end
+
+      # Key of the target in the proxy blacklist.
+      def blacklist_key
+        @blacklist_key ||= "#{self[0]}_".force_encoding(::Encoding::BINARY) << connection_key
+      end
+
       def to_s
         if self[2] == :ipv4
           "#{self[0]}:#{self[1]}:#{self[3]}"
@@ -115,7 +126,7 @@ module OverSIP::SIP
       include ::OverSIP::Logger
 
       def self.class_init
-        @@fiber_pool = ::OverSIP::FiberPool.new 50
+        @@fiber_pool = ::OverSIP::FiberPool.new 50, nil, "dns"
       end
 
       def initialize dns_conf, id, uri_scheme, uri_host, uri_host_type, uri_port=nil, uri_transport=nil
@@ -551,10 +562,12 @@ module OverSIP::SIP
         query = RFC3263.resolver.submit_NAPTR domain
         query.callback do |result|
           log_system_debug "DNS NAPTR succeeded for '#{domain}'"  if $oversip_debug
+          ::OverSIP::Metrics.dns_query :NAPTR, true
           f.resume result
         end
         query.errback do |result|
           log_system_debug "DNS NAPTR error resolving '#{domain}': #{result}"  if $oversip_debug
+          ::OverSIP::Metrics.dns_query :NAPTR, false
           f.resume nil
         end
 
@@ -584,6 +597,7 @@ module OverSIP::SIP
           else
             log_system_debug "DNS SRV succeeded for '#{domain}'"  if $oversip_debug
           end
+          ::OverSIP::Metrics.dns_query :SRV, true
           f.resume result
         end
         query.errback do |result|
@@ -592,6 +606,7 @@ module OverSIP::SIP
           else
             log_system_debug "DNS SRV error resolving '#{domain}': #{result}"  if $oversip_debug
           end
+          ::OverSIP::Metrics.dns_query :SRV, false
           f.resume nil
         end
 
@@ -606,10 +621,12 @@ module OverSIP::SIP
         query = RFC3263.resolver.submit_A domain
         query.callback do |result|
           log_system_debug "DNS A succeeded for domain '#{domain}'"  if $oversip_debug
+          ::OverSIP::Metrics.dns_query :A, true
           f.resume result
         end
         query.errback do |result|
           log_system_debug "DNS A error resolving domain '#{domain}': #{result}"  if $oversip_debug
+          ::OverSIP::Metrics.dns_query :A, false
           f.resume nil
         end
 
@@ -624,10 +641,12 @@ module OverSIP::SIP
         query = RFC3263.resolver.submit_AAAA domain
         query.callback do |result|
           log_system_debug "DNS AAAA succeeded for domain '#{domain}'"  if $oversip_debug
+          ::OverSIP::Metrics.dns_query :AAAA, true
           f.resume result
         end
         query.errback do |result|
           log_system_debug "DNS AAAA error resolving domain '#{domain}': #{result}"  if $oversip_debug
+          ::OverSIP::Metrics.dns_query :AAAA, false
           f.resume nil
         end
 
@@ -15,7 +15,9 @@ module OverSIP::SIP
     end
 
     def retransmit_last_response
-      @request.send_response @last_response  if @last_response
+      return  unless @last_response
+      ::OverSIP::Metrics.retransmission_sent @request.transport
+      @request.send_response @last_response
     end
 
   end  # class ServerTransaction
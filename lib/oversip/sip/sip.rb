@@ -7,6 +7,8 @@ module OverSIP::SIP
     @local_ipv6 = conf[:sip][:listen_ipv6]
 
     @tcp_keepalive_interval = conf[:sip][:tcp_keepalive_interval]
+    @crlf_keepalive_interval = conf[:sip][:crlf_keepalive_interval]
+    @idle_connection_timeout = conf[:sip][:idle_connection_timeout]
 
     @local_aliases = {}
 
@@ -61,6 +63,14 @@ module OverSIP::SIP
     @tcp_keepalive_interval
   end
 
+  def self.crlf_keepalive_interval
+    @crlf_keepalive_interval
+  end
+
+  def self.idle_connection_timeout
+    @idle_connection_timeout
+  end
+
   def self.local_ipv4
     @local_ipv4
   end
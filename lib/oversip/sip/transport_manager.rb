@@ -15,7 +15,10 @@ module OverSIP::SIP
     # the client transaction is stored in the @pending_client_transactions of the client
     # connection.
     # This method always returns a connection object, never nil or false.
-    def self.get_connection klass, ip, port, client_transaction=nil, callback_on_server_tls_handshake=false
+    # Connections are indexed by the compact binary key of their IP and port (see
+    # OverSIP::Utils.connection_key) which can be given (i.e. cached in a RFC3263::Target)
+    # so no key is computed here.
+    def self.get_connection klass, ip, port, client_transaction=nil, callback_on_server_tls_handshake=false, connection_key=nil
       # A normal connection (so we arrive here after RFC 3263 procedures).
       case klass.transport
 
@@ -26,15 +29,16 @@ module OverSIP::SIP
       # In TCP/TLS first check if there is an existing connection to the given destination.
       # If not create a new one.
       when :tcp
+        connection_key ||= ::OverSIP::Utils.connection_key ip, port
         case klass.ip_type
           when :ipv4
-            conn = klass.connections["#{ip}_#{port}"] || ::EM.oversip_connect_tcp_server(::OverSIP::SIP.local_ipv4, ip, port, ::OverSIP::SIP::IPv4TcpClient, ip, port)
+            conn = ::OverSIP::SIP::ConnectionPool.get_connection(klass, connection_key) || klass.connections[connection_key] || ::EM.oversip_connect_tcp_server(::OverSIP::SIP.local_ipv4, ip, port, ::OverSIP::SIP::IPv4TcpClient, ip, port)
 
             if conn.is_a? ::OverSIP::SIP::IPv4TcpClient and not conn.connected
               conn.pending_client_transactions << client_transaction
             end
           when :ipv6
-            conn = klass.connections["#{::OverSIP::Utils.normalize_ipv6 ip}_#{port}"] || ::EM.oversip_connect_tcp_server(::OverSIP::SIP.local_ipv6, ip, port, ::OverSIP::SIP::IPv6TcpClient, ip, port)
+            conn = ::OverSIP::SIP::ConnectionPool.get_connection(klass, connection_key) || klass.connections[connection_key] || ::EM.oversip_connect_tcp_server(::OverSIP::SIP.local_ipv6, ip, port, ::OverSIP::SIP::IPv6TcpClient, ip, port)
 
             if conn.is_a? ::OverSIP::SIP::IPv6TcpClient and not conn.connected
               conn.pending_client_transactions << client_transaction
@@ -42,16 +46,17 @@ module OverSIP::SIP
           end
 
       when :tls
+        connection_key ||= ::OverSIP::Utils.connection_key ip, port
         case klass.ip_type
           when :ipv4
-            conn = klass.connections["#{ip}_#{port}"] || ::EM.oversip_connect_tcp_server(::OverSIP::SIP.local_ipv4, ip, port, ::OverSIP::SIP::IPv4TlsClient, ip, port)
+            conn = ::OverSIP::SIP::ConnectionPool.get_connection(klass, connection_key, callback_on_server_tls_handshake) || klass.connections[connection_key] || ::EM.oversip_connect_tcp_server(::OverSIP::SIP.local_ipv4, ip, port, ::OverSIP::SIP::IPv4TlsClient, ip, port)
 
             if conn.is_a? ::OverSIP::SIP::IPv4TlsClient and not conn.connected
               conn.callback_on_server_tls_handshake = callback_on_server_tls_handshake
               conn.pending_client_transactions << client_transaction
             end
           when :ipv6
-            conn = klass.connections["#{::OverSIP::Utils.normalize_ipv6 ip}_#{port}"] || ::EM.oversip_connect_tcp_server(::OverSIP::SIP.local_ipv6, ip, port, ::OverSIP::SIP::IPv6TlsClient, ip, port)
+            conn = ::OverSIP::SIP::ConnectionPool.get_connection(klass, connection_key, callback_on_server_tls_handshake) || klass.connections[connection_key] || ::EM.oversip_connect_tcp_server(::OverSIP::SIP.local_ipv6, ip, port, ::OverSIP::SIP::IPv6TlsClient, ip, port)
 
             if conn.is_a? ::OverSIP::SIP::IPv6TlsClient and not conn.connected
               conn.callback_on_server_tls_handshake = callback_on_server_tls_handshake
@@ -70,13 +75,10 @@ module OverSIP::SIP
     end
 
 
+    # ip_type is not needed anymore (the connection key is the same for any IP form),
+    # kept for backwards compatibility.
     def self.add_connection server, server_class, ip_type, ip, port
-      connection_id = case ip_type
-        when :ipv4
-          "#{ip}_#{port}"
-        when :ipv6
-          "#{::OverSIP::Utils.normalize_ipv6 ip}_#{port}"
-        end
+      connection_id = ::OverSIP::Utils.connection_key ip, port
 
       server_class.connections[connection_id] = server
 
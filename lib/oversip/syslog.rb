@@ -27,40 +27,20 @@ module OverSIP
       "emerg"  => 7
     }
 
+    # Log records are enqueued into OverSIP::LogRing and a background thread sends
+    # them to syslog (and to stdout/stderr when not daemonized), so the reactor never
+    # blocks on logging.
     def self.log level_value, msg, log_id, user
-      user = user ? " [user] " : " "
-
       msg = case msg
       when ::String
-        "<#{log_id}>#{user}#{msg}"
+        msg
       when ::Exception
-        "<#{log_id}>#{user}#{msg.message} (#{msg.class })\n#{(msg.backtrace || [])[0..3].join("\n")}"
+        "#{msg.message} (#{msg.class })\n#{(msg.backtrace || [])[0..3].join("\n")}"
       else
-        "<#{log_id}>#{user}#{msg.inspect}"
+        msg.inspect
       end
 
-      msg = msg.gsub(/%/,"%%").gsub(/\x00/,"")
-
-      case level_value
-      when 0
-        ::Syslog.debug sprintf("%7s %s", "DEBUG:", msg)
-      when 1
-        ::Syslog.info sprintf("%7s %s", "INFO:", msg)
-      when 2
-        ::Syslog.notice sprintf("%7s %s", "NOTICE:", msg)
-      when 3
-        ::Syslog.warning sprintf("%7s %s", "WARN:", msg)
-      when 4
-        ::Syslog.err sprintf("%7s %s", "ERROR:", msg)
-      when 5
-        ::Syslog.crit sprintf("%7s %s", "CRIT:", msg)
-      when 6
-        ::Syslog.alert sprintf("%7s %s", "ALERT:", msg)
-      when 7
-        ::Syslog.emerg sprintf("%7s %s", "EMERG:", msg)
-      else  # Shouldn't occur.
-        ::Syslog.err sprintf("%7s %s", "UNKNOWN:", msg)
-      end
+      ::OverSIP::LogRing.log level_value, log_id, msg, user
     end
 
   end
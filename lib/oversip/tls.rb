@@ -6,8 +6,43 @@ module OverSIP
 
     TLS_PEM_CHAIN_REGEXP = /-{5}BEGIN CERTIFICATE-{5}\n.*?-{5}END CERTIFICATE-{5}\n/m
 
+    # TLS versions allowed by the in-process TLS engine (SIP TLS, WSS and outbound TLS).
+    SSL_VERSIONS = %w(tlsv1 tlsv1_1 tlsv1_2).freeze
+
     @log_id = "TLS"
 
+    # Number of completed TLS handshakes in in-process TLS connections (inbound
+    # SIP TLS and WSS, and outbound SIP TLS). They are all full handshakes as
+    # EventMachine creates a TLS context per connection (no session resumption),
+    # so these counters show the cost of reconnection storms.
+    @num_server_handshakes = 0
+    @num_client_handshakes = 0
+
+    # Cache of certificate chain validation results (keyed by the SHA-256 of the
+    # chain) so the same peers presenting the same chains are not parsed and
+    # verified again in every TLS connection. Entries expire at the earliest
+    # notAfter of the chain (or after VALIDATION_CACHE_TTL seconds) and the cache
+    # is flushed when the CA store is (re)loaded. Failed validations just expire
+    # after VALIDATION_CACHE_ERROR_TTL seconds as they may be transient (i.e. a
+    # certificate not valid yet).
+    VALIDATION_CACHE_SIZE = 1000
+    VALIDATION_CACHE_TTL = 3600
+    VALIDATION_CACHE_ERROR_TTL = 10
+
+    ValidationCacheEntry = ::Struct.new(:cert, :validated, :tls_error, :tls_error_string, :expires, :sip_identities)
+
+    @validation_cache = {}
+    # Certificates returned by the cache (so get_sip_identities() can reuse the
+    # identities already extracted from them).
+    @validation_cache_certs = {}.compare_by_identity
+    @num_validation_cache_hits = 0
+    @num_validation_cache_misses = 0
+
+    class << self
+      attr_reader :num_server_handshakes, :num_client_handshakes
+      attr_reader :num_validation_cache_hits, :num_validation_cache_misses
+    end
+
 
     def self.module_init
       configuration = ::OverSIP.configuration
@@ -15,11 +50,20 @@ module OverSIP
         log_system_info "TLS enabled"
         ::OverSIP.tls_public_cert = configuration[:tls][:public_cert]
         ::OverSIP.tls_private_cert = configuration[:tls][:private_cert]
+
+        @server_options = {
+          :verify_peer => true,
+          :cert_chain_file => ::OverSIP.tls_public_cert,
+          :private_key_file => ::OverSIP.tls_private_cert,
+          :ssl_version => SSL_VERSIONS
+        }.freeze
       else
         log_system_info "TLS disabled"
         return
       end
 
+      clear_validation_cache
+
       if (ca_dir = configuration[:tls][:ca_dir])
         @store = ::OpenSSL::X509::Store.new
         num_certs_added = 0
@@ -82,6 +126,35 @@ module OverSIP
     end  # def self.module_init
 
 
+    # Options for EM::Connection#start_tls in TLS server connections (SIP TLS and WSS).
+    # TLS is performed in-process by EventMachine (OpenSSL with memory BIOs driven by
+    # the reactor) and decrypted data is given to receive_data().
+    def self.server_options
+      @server_options
+    end
+
+
+    def self.server_handshake_completed
+      @num_server_handshakes += 1
+    end
+
+
+    def self.client_handshake_completed
+      @num_client_handshakes += 1
+    end
+
+
+    # Options for EM::Connection#start_tls in TLS client connections.
+    def self.client_options verify_peer
+      {
+        :verify_peer => verify_peer,
+        :cert_chain_file => ::OverSIP.tls_public_cert,
+        :private_key_file => ::OverSIP.tls_private_cert,
+        :ssl_version => SSL_VERSIONS
+      }
+    end
+
+
     # Return an array with the result of the TLS certificate validation as follows:
     #   cert, validated, tls_error, tls_error_string
     # where:
@@ -96,9 +169,24 @@ module OverSIP
       return nil, nil, nil, "no CAs provided, validation disabled"  unless @store
       return nil, false, nil, "no certificate provided by peer"  unless pems.any?
 
+      key = ::OpenSSL::Digest::SHA256.digest pems.join
+      now = ::Time.now
+
       pem = pems.pop
       intermediate_pems = pems
 
+      if (entry = @validation_cache[key])
+        @validation_cache.delete key
+        if entry.expires > now
+          # Keep the cache ordered by last use.
+          @validation_cache[key] = entry
+          @num_validation_cache_hits += 1
+          return entry.cert, entry.validated, entry.tls_error, entry.tls_error_string
+        end
+        @validation_cache_certs.delete entry.cert
+      end
+      @num_validation_cache_misses += 1
+
       begin
         cert = ::OpenSSL::X509::Certificate.new pem
 
@@ -112,10 +200,21 @@ module OverSIP
         end
 
         if @store.verify cert, intermediate_certs
-          return cert, true
+          entry = ValidationCacheEntry.new cert, true
         else
-          return cert, false, @store.error, @store.error_string
+          entry = ValidationCacheEntry.new cert, false, @store.error, @store.error_string
+        end
+
+        expires = now + ( entry.validated ? VALIDATION_CACHE_TTL : VALIDATION_CACHE_ERROR_TTL )
+        ([cert] + (intermediate_certs || [])).each do |c|
+          expires = c.not_after  if c.not_after < expires
         end
+        if expires > now
+          entry.expires = expires
+          add_to_validation_cache key, entry
+        end
+
+        return entry.cert, entry.validated, entry.tls_error, entry.tls_error_string
 
       rescue => e
         log_system_error "exception validating a certificate: #{e.class}: #{e.message}"
@@ -124,9 +223,40 @@ module OverSIP
     end  # def self.validate
 
 
+    def self.add_to_validation_cache key, entry
+      if @validation_cache.size >= VALIDATION_CACHE_SIZE
+        # Remove the least recently used entry.
+        oldest_key, oldest_entry = @validation_cache.first
+        @validation_cache.delete oldest_key
+        @validation_cache_certs.delete oldest_entry.cert
+      end
+
+      @validation_cache[key] = entry
+      @validation_cache_certs[entry.cert] = entry
+    end
+    private_class_method :add_to_validation_cache
+
+
+    def self.clear_validation_cache
+      @validation_cache.clear
+      @validation_cache_certs.clear
+    end
+
+
     def self.get_sip_identities cert
       return []  unless cert
 
+      # Certificate returned by validate() from the cache.
+      if (entry = @validation_cache_certs[cert])
+        return ( entry.sip_identities ||= extract_sip_identities(cert) ).dup
+      end
+
+      extract_sip_identities cert
+    end
+
+
+    def self.extract_sip_identities cert
+
       verify_subjectAltName_DNS = true
       verify_CN = true
       subjectAltName_URI_sip_entries = []
@@ -166,6 +296,7 @@ module OverSIP
       # Return an array with the SIP identities (domains) in the certificate.
       return sip_identities.keys
     end
+    private_class_method :extract_sip_identities
 
   end
 
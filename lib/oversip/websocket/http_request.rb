@@ -23,6 +23,7 @@ module OverSIP::WebSocket
     attr_reader :hdr_sec_websocket_version
     attr_reader :hdr_sec_websocket_key
     attr_reader :hdr_sec_websocket_protocol
+    attr_reader :hdr_sec_websocket_extensions
 
 
     LOG_ID = "HTTP WS Request"
@@ -36,6 +36,21 @@ module OverSIP::WebSocket
       ! error?
     end
 
+    # Local IP and port (for the SIP capture): the listening ones for servers and
+    # the socket ones for client connections.
+    def local_ip_port
+      @local_ip_port ||= if self.class.ip
+        [ self.class.ip, self.class.port ]
+      else
+        begin
+          port, ip = ::Socket.unpack_sockaddr_in(get_sockname)
+          [ ip, port ]
+        rescue
+          [ nil, nil ]
+        end
+      end
+    end
+
     def close status=nil, reason=nil
       # When in WebSocket protocol send a close control frame before closing
       # the connection.
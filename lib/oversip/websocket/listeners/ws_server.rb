@@ -6,6 +6,10 @@ module OverSIP::WebSocket
     # (avoid DoS attacks).
     HEADERS_MAX_SIZE = 2048
 
+    # Max time (seconds) for receiving the HTTP GET request once connected
+    # (avoid slowloris attacks).
+    HTTP_HEADERS_MAX_TIME = 10
+
     WS_MAGIC_GUID_04 = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11".freeze
     WS_VERSIONS = { 7=>true, 8=>true, 13=>true }
     HDR_SUPPORTED_WEBSOCKET_VERSIONS = [ "X-Supported-WebSocket-Versions: #{WS_VERSIONS.keys.join(", ")}" ]
@@ -46,6 +50,9 @@ module OverSIP::WebSocket
       # Create an Outbound (RFC 5626) flow token for this connection.
       @outbound_flow_token = ::OverSIP::SIP::TransportManager.add_outbound_connection self
 
+      # WSS connections already have the TLS handshake deadline.
+      arm_deadline :headers, HTTP_HEADERS_MAX_TIME  unless @deadline
+
       log_system_debug("connection opened from " << remote_desc)  if $oversip_debug
     end
 
@@ -67,6 +74,7 @@ module OverSIP::WebSocket
 
     def unbind cause=nil
       @state = :ignore
+      disarm_deadline
 
       # Remove the connection.
       self.class.connections.delete @connection_id
@@ -74,6 +82,9 @@ module OverSIP::WebSocket
       # Remove the Outbound token flow.
       ::OverSIP::SIP::TransportManager.delete_outbound_connection @outbound_flow_token
 
+      # Release permessage-deflate zlib streams.
+      @permessage_deflate.close  if @permessage_deflate
+
       @local_closed = true  if cause == ::Errno::ETIMEDOUT
       @local_closed = false  if @client_closed
 
@@ -104,7 +115,7 @@ module OverSIP::WebSocket
       @state == :waiting_for_on_client_tls_handshake and return
       @state == :waiting_for_on_connection and return
 
-      process_received_data
+      ::OverSIP::ReactorProbe.callback(:receive_data, self) { process_received_data }
     end
 
     def process_received_data
@@ -175,6 +186,30 @@ module OverSIP::WebSocket
     end  # parse_headers
 
 
+    # Connection deadlines (see OverSIP::DeadlineWheel).
+    def arm_deadline reason, seconds
+      @deadline = reason
+      ::OverSIP::DeadlineWheel.arm self, seconds, reason
+    end
+
+    def disarm_deadline
+      return  unless @deadline
+      @deadline = nil
+      ::OverSIP::DeadlineWheel.disarm self
+    end
+
+    # Called by OverSIP::DeadlineWheel. Returns true if the connection is closed.
+    def deadline_expired reason
+      @deadline = nil
+      return false  if @state == :ignore or @state == :websocket
+
+      log_system_notice "#{reason} deadline expired, closing connection with #{remote_desc}"
+      close_connection
+      @state = :ignore
+      true
+    end
+
+
     def check_http_request
       # Check OverSIP status.
       unless ::OverSIP.status == :running
@@ -237,6 +272,14 @@ module OverSIP::WebSocket
         end
       end
 
+      # Check Sec-WebSocket-Extensions (just permessage-deflate is supported).
+      if @http_request.hdr_sec_websocket_extensions and ::OverSIP::WebSocket::PermessageDeflate.enabled?
+        if (negotiated = ::OverSIP::WebSocket::PermessageDeflate.negotiate @http_request.hdr_sec_websocket_extensions)
+          @permessage_deflate, @websocket_extensions = negotiated
+          log_system_debug "permessage-deflate negotiated: #{@websocket_extensions}"  if $oversip_debug
+        end
+      end
+
       @state = :on_connection_callback
       true
     end
@@ -290,10 +333,11 @@ module OverSIP::WebSocket
       @http_request.reply 101, nil, extra_headers
 
       # Set the WS framing layer and WS application layer.
-      @ws_framing = ::OverSIP::WebSocket::WsFraming.new self, @buffer
+      @ws_framing = ::OverSIP::WebSocket::WsFraming.new self, @buffer, @permessage_deflate
       ws_sip_app = ::OverSIP::WebSocket::WsSipApp.new self, @ws_framing
       @ws_framing.ws_app = ws_sip_app
 
+      disarm_deadline
       @state = :websocket
       true
     end
@@ -313,6 +357,11 @@ module OverSIP::WebSocket
         return false
       end
 
+      if $oversip_capture
+        local_ip, local_port = local_ip_port
+        ::OverSIP::Capture.write local_ip, local_port, @remote_ip, @remote_port, transport, msg, nil
+      end
+
       # If the SIP message is fully valid UTF-8 send a WS text frame.
       if msg.force_encoding(::Encoding::UTF_8).valid_encoding?
         @ws_framing.send_text_frame msg
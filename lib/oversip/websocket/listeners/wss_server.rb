@@ -9,22 +9,12 @@ module OverSIP::WebSocket
       @client_pems = []
       @client_last_pem = false
 
-      start_tls({
-        :verify_peer => true,
-        :cert_chain_file => ::OverSIP.tls_public_cert,
-        :private_key_file => ::OverSIP.tls_private_cert,
-        :ssl_version => %w(sslv2) # USE SSL instead of TLS. TODO: yes?
-      })
+      start_tls ::OverSIP::TLS.server_options
 
       # If the remote client does never send us a TLS certificate
       # after the TCP connection we would leak by storing more and
       # more messages in @pending_messages array.
-      @timer_tls_handshake = ::EM::Timer.new(TLS_HANDSHAKE_MAX_TIME) do
-        unless @connected
-          log_system_notice "TLS handshake not performed within #{TLS_HANDSHAKE_MAX_TIME} seconds, closing the connection"
-          close_connection
-        end
-      end
+      arm_deadline :tls_handshake, TLS_HANDSHAKE_MAX_TIME
     end
 
 
@@ -48,7 +38,9 @@ module OverSIP::WebSocket
       # @connected in WssServer means "TLS connection" rather than
       # just "TCP connection".
       @connected = true
-      @timer_tls_handshake.cancel  if @timer_tls_handshake
+      # The HTTP GET request must be received within a while.
+      arm_deadline :headers, HTTP_HEADERS_MAX_TIME
+      ::OverSIP::TLS.server_handshake_completed
 
       if ::OverSIP::WebSocket.callback_on_client_tls_handshake
         # Set the state to :waiting_for_on_client_tls_handshake so data received after TLS handshake but before
@@ -56,7 +48,7 @@ module OverSIP::WebSocket
         @state = :waiting_for_on_client_tls_handshake
 
         # Run OverSIP::WebSocketEvents.on_client_tls_handshake.
-        ::Fiber.new do
+        spawned = ::OverSIP.fiber_pool.spawn do
           begin
             log_system_debug "running OverSIP::SipWebSocketEvents.on_client_tls_handshake()..."  if $oversip_debug
             ::OverSIP::WebSocketEvents.on_client_tls_handshake self, @client_pems
@@ -74,13 +66,20 @@ module OverSIP::WebSocket
             log_system_error e
             close_connection
           end
-        end.resume
+        end
+
+        # The fiber pool queue is full.
+        unless spawned
+          log_system_notice "fiber pool full, cannot run the TLS handshake callback, closing connection"
+          @state = :ignore
+          close_connection
+        end
       end
     end
 
 
     def unbind cause=nil
-      @timer_tls_handshake.cancel  if @timer_tls_handshake
+      disarm_deadline
       super
     end
 
@@ -2,6 +2,11 @@ module OverSIP::WebSocket
 
   class WssTunnelServer < WsServer
 
+    # TLVs of the HAProxy Protocol v2 header (Hash with :unique_id, :ssl,
+    # :ssl_client_cert, :ssl_client_cert_verified, :ssl_version, :ssl_cn and
+    # :ssl_cipher), nil if not given by the TLS proxy.
+    attr_reader :haproxy_protocol_tlvs
+
     def post_connection
       begin
         # Temporal @remote_ip and @remote_port until the HAProxy protocol line is parsed.
@@ -16,12 +21,16 @@ module OverSIP::WebSocket
       # Create an Outbound (RFC 5626) flow token for this connection.
       @outbound_flow_token = ::OverSIP::SIP::TransportManager.add_outbound_connection self
 
+      # The HAProxy Protocol header and the HTTP GET request must be received within a while.
+      arm_deadline :headers, HTTP_HEADERS_MAX_TIME
+
       log_system_debug ("connection from the TLS tunnel " << remote_desc)  if $oversip_debug
     end
 
 
     def unbind cause=nil
       @state = :ignore
+      disarm_deadline
 
       # Remove the connection.
       self.class.connections.delete @connection_id  if @connection_id
@@ -102,13 +111,24 @@ module OverSIP::WebSocket
 
 
     def parse_haproxy_protocol
-      if (haproxy_protocol_data = ::OverSIP::Utils.parse_haproxy_protocol(@buffer.to_str))
+      haproxy_protocol_data = ::OverSIP::Utils.parse_haproxy_protocol(@buffer.to_str)
+
+      # Wait for more data.
+      return false  if haproxy_protocol_data.nil?
+
+      if haproxy_protocol_data
         @haproxy_protocol_parsed = true
 
-        # Update connection information.
-        @remote_ip_type = haproxy_protocol_data[1]
-        @remote_ip = haproxy_protocol_data[2]
-        @remote_port = haproxy_protocol_data[3]
+        # Update connection information (a v2 header with LOCAL command keeps the
+        # address of the TLS proxy).
+        if haproxy_protocol_data[1]
+          @remote_ip_type = haproxy_protocol_data[1]
+          @remote_ip = haproxy_protocol_data[2]
+          @remote_port = haproxy_protocol_data[3]
+        else
+          @remote_ip_type = self.class.ip_type
+        end
+        @haproxy_protocol_tlvs = haproxy_protocol_data[4]
 
         # Update log information.
         remote_desc true
@@ -118,6 +138,12 @@ module OverSIP::WebSocket
 
         @state = :http_headers
 
+        # The TLS proxy informs about the client TLS connection (HAProxy Protocol v2).
+        if @haproxy_protocol_tlvs and @haproxy_protocol_tlvs[:ssl] and ::OverSIP::WebSocket.callback_on_client_tls_handshake
+          run_on_client_tls_handshake
+          return false
+        end
+
       # If parsing fails then the TLS proxy has sent us a wrong HAProxy Protocol line ¿?
       else
         log_system_error "HAProxy Protocol parsing error, closing connection"
@@ -127,6 +153,62 @@ module OverSIP::WebSocket
       end
     end
 
+
+    # The client (given by the HAProxy Protocol) may use an IP family other than the
+    # one of this tunnel listener, so the SIP capture takes the listening IP and port
+    # of the WSS tunnel server of the client's family. If there is no such server the
+    # messages of the connection cannot be captured (mixed families in a HEP3 packet).
+    def local_ip_port
+      @local_ip_port ||= if @remote_ip_type.nil? or @remote_ip_type == self.class.ip_type
+        [ self.class.ip, self.class.port ]
+      else
+        klass = ( @remote_ip_type == :ipv4 ? ::OverSIP::WebSocket::IPv4WssTunnelServer : ::OverSIP::WebSocket::IPv6WssTunnelServer )
+        if klass.ip
+          [ klass.ip, klass.port ]
+        else
+          log_system_notice "no #{@remote_ip_type == :ipv4 ? "IPv4" : "IPv6"} WSS tunnel server, SIP messages of this connection are not captured"
+          [ nil, nil ]
+        end
+      end
+    end
+
+
+    # The client certificates are not available (the TLS proxy terminates TLS) so
+    # the callback is given an empty pems Array and must check the haproxy_protocol_tlvs
+    # of the connection (i.e. :ssl_client_cert_verified and :ssl_cn).
+    def run_on_client_tls_handshake
+      # Set the state to :waiting_for_on_client_tls_handshake so data received before
+      # user callback validation is just stored.
+      @state = :waiting_for_on_client_tls_handshake
+
+      spawned = ::OverSIP.fiber_pool.spawn do
+        begin
+          log_system_debug "running OverSIP::WebSocketEvents.on_client_tls_handshake()..."  if $oversip_debug
+          ::OverSIP::WebSocketEvents.on_client_tls_handshake self, []
+          # If the user of the peer has not closed the connection then continue.
+          unless @local_closed or error?
+            @state = :http_headers
+            # Call process_received_data() to process possible data received in the meanwhile.
+            process_received_data
+          else
+            log_system_debug "connection closed during OverSIP::WebSocketEvents.on_client_tls_handshake(), aborting"  if $oversip_debug
+          end
+
+        rescue ::Exception => e
+          log_system_error "error calling OverSIP::WebSocketEvents.on_client_tls_handshake():"
+          log_system_error e
+          close_connection
+        end
+      end
+
+      # The fiber pool queue is full.
+      unless spawned
+        log_system_notice "fiber pool full, cannot run the TLS handshake callback, closing connection"
+        @state = :ignore
+        close_connection
+      end
+    end
+
   end
 
 end
@@ -0,0 +1,220 @@
+module OverSIP::WebSocket
+
+  # permessage-deflate WebSocket extension (RFC 7692).
+  #
+  # Memory used by each connection is bounded by the configured window bits and
+  # memory level (deflate uses (1 << (window_bits + 2)) + (1 << (mem_level + 9)) bytes
+  # and inflate (1 << window_bits) bytes, plus a few KB of zlib state). When context
+  # takeover is disabled the zlib streams are released after every message so idle
+  # connections hold no compression memory at all.
+  class PermessageDeflate
+
+    include ::OverSIP::Logger
+
+    EXTENSION_NAME = "permessage-deflate"
+
+    # Every compressed message ends with an empty uncompressed block which is
+    # removed by the sender and must be appended by the receiver (RFC 7692 7.2.1).
+    MESSAGE_TAIL = "\x00\x00\xff\xff".force_encoding(::Encoding::BINARY).freeze
+
+    # Smaller messages are sent uncompressed (it does not pay off).
+    MIN_COMPRESS_SIZE = 64
+
+    # Compressed data is inflated in slices of this size so the max message size
+    # is checked while inflating (avoid decompression bombs).
+    INFLATE_SLICE_SIZE = 1024
+
+    MAX_WINDOW_BITS = 15
+    # zlib does not support 8 bits windows for raw deflate.
+    MIN_WINDOW_BITS = 9
+
+
+    def self.class_init
+      conf = ::OverSIP.configuration[:websocket]
+
+      @@enabled = conf[:permessage_deflate]
+      @@window_bits = conf[:permessage_deflate_window_bits]
+      @@mem_level = conf[:permessage_deflate_mem_level]
+      @@context_takeover = conf[:permessage_deflate_context_takeover]
+      @@max_message_size = conf[:max_ws_message_size]
+    end
+
+
+    def self.enabled?
+      @@enabled
+    end
+
+
+    LOG_ID = "PermessageDeflate"
+    def log_id
+      LOG_ID
+    end
+
+
+    # Given the extension offers in the Sec-WebSocket-Extensions header of the
+    # HTTP GET request, accepts the first valid permessage-deflate offer.
+    # Returns an Array with the PermessageDeflate instance and the value for the
+    # Sec-WebSocket-Extensions header of the 101 response, or nil if no offer is
+    # acceptable.
+    def self.negotiate offers
+      offers.each do |offer|
+        params = offer.split(";").map {|param| param.strip}
+        next  unless params.shift.to_s.downcase == EXTENSION_NAME
+
+        if (negotiated = negotiate_offer params)
+          return negotiated
+        end
+      end
+
+      nil
+    end
+
+
+    def self.negotiate_offer params
+      deflate_window_bits = @@window_bits
+      inflate_window_bits = MAX_WINDOW_BITS
+      deflate_no_context_takeover = ! @@context_takeover
+      inflate_no_context_takeover = ! @@context_takeover
+      server_max_window_bits_offered = false
+      client_max_window_bits_offered = false
+      received_params = {}
+
+      params.each do |param|
+        name, value = param.split("=", 2)
+        name = name.strip.downcase
+        value = value.strip.delete('"')  if value
+
+        # Each parameter must appear at most once.
+        return nil  if received_params[name]
+        received_params[name] = true
+
+        case name
+        when "server_no_context_takeover"
+          return nil  if value
+          deflate_no_context_takeover = true
+        when "client_no_context_takeover"
+          return nil  if value
+          inflate_no_context_takeover = true
+        when "server_max_window_bits"
+          return nil  unless (bits = window_bits_value value)
+          # We cannot honor a 8 bits window (zlib limitation), so decline the offer.
+          return nil  if bits < MIN_WINDOW_BITS
+          deflate_window_bits = bits  if bits < deflate_window_bits
+          server_max_window_bits_offered = true
+        when "client_max_window_bits"
+          if value
+            return nil  unless (bits = window_bits_value value)
+            inflate_window_bits = bits
+          end
+          client_max_window_bits_offered = true
+        else
+          return nil
+        end
+      end
+
+      # If the client allows it, ask it to use our window size.
+      if client_max_window_bits_offered and @@window_bits < inflate_window_bits
+        inflate_window_bits = @@window_bits
+      end
+
+      response = EXTENSION_NAME.dup
+      response << "; server_no_context_takeover"  if deflate_no_context_takeover
+      response << "; client_no_context_takeover"  if inflate_no_context_takeover
+      response << "; server_max_window_bits=#{deflate_window_bits}"  if server_max_window_bits_offered
+      response << "; client_max_window_bits=#{inflate_window_bits}"  if client_max_window_bits_offered
+
+      # A bigger inflate window is always compatible with a smaller deflate window.
+      inflate_window_bits = MIN_WINDOW_BITS  if inflate_window_bits < MIN_WINDOW_BITS
+
+      [ new(deflate_window_bits, deflate_no_context_takeover, inflate_window_bits, inflate_no_context_takeover), response ]
+    end
+    private_class_method :negotiate_offer
+
+
+    def self.window_bits_value value
+      return nil  unless value and value =~ /\A\d{1,2}\z/
+      bits = value.to_i
+      return nil  unless bits.between?(8, MAX_WINDOW_BITS)
+      bits
+    end
+    private_class_method :window_bits_value
+
+
+    def initialize deflate_window_bits, deflate_no_context_takeover, inflate_window_bits, inflate_no_context_takeover
+      @deflate_window_bits = deflate_window_bits
+      @deflate_no_context_takeover = deflate_no_context_takeover
+      @inflate_window_bits = inflate_window_bits
+      @inflate_no_context_takeover = inflate_no_context_takeover
+    end
+
+
+    # Inflates the (already unmasked) payload of a frame belonging to a compressed
+    # message. fin must be true for the last frame of the message.
+    # Returns:
+    # - The inflated String.
+    # - nil: The inflated data exceeds the max message size.
+    # - false: Invalid compressed data.
+    def inflate payload, fin
+      @inflater ||= ::Zlib::Inflate.new(-@inflate_window_bits)
+
+      payload << MESSAGE_TAIL  if fin
+
+      inflated = "".force_encoding ::Encoding::BINARY
+      pos = 0
+      while pos < payload.bytesize
+        inflated << @inflater.inflate(payload.byteslice(pos, INFLATE_SLICE_SIZE))
+        return nil  if inflated.bytesize > @@max_message_size
+        pos += INFLATE_SLICE_SIZE
+      end
+
+      if fin
+        if @inflate_no_context_takeover
+          @inflater.close
+          @inflater = nil
+        # The peer may end the deflate stream (BFINAL block), so start a new one.
+        elsif @inflater.finished?
+          @inflater.reset
+        end
+      end
+
+      inflated
+
+    rescue ::Zlib::Error => e
+      log_system_notice "error inflating compressed message: #{e.class}: #{e.message}"
+      close
+      false
+    end
+
+
+    # Deflates the given message and returns the compressed payload (without the
+    # trailing empty block).
+    def deflate message
+      @deflater ||= ::Zlib::Deflate.new(::Zlib::DEFAULT_COMPRESSION, -@deflate_window_bits, @@mem_level)
+
+      compressed = @deflater.deflate(message, ::Zlib::SYNC_FLUSH)
+      compressed.slice!(-4, 4)  if compressed.end_with? MESSAGE_TAIL
+
+      if @deflate_no_context_takeover
+        @deflater.close
+        @deflater = nil
+      end
+
+      compressed
+    end
+
+
+    # Release the zlib streams.
+    def close
+      if @inflater
+        @inflater.close  rescue nil
+        @inflater = nil
+      end
+      if @deflater
+        @deflater.close  rescue nil
+        @deflater = nil
+      end
+    end
+
+  end
+
+end
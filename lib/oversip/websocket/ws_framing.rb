@@ -13,11 +13,12 @@ module OverSIP::WebSocket
       10 => :pong
     }
 
-    keepalive_ping_frame = "".encode ::Encoding::BINARY
-    keepalive_ping_frame << 137
-    keepalive_ping_frame << "keep-alive".bytesize
-    keepalive_ping_frame << "keep-alive".encode(::Encoding::BINARY)
-    KEEPALIVE_PING_FRAME = keepalive_ping_frame
+    # byte1 = OPCODE_TO_INT[:ping] | 0b10000000 => 137
+    KEEPALIVE_PING_FRAME = ::OverSIP::WebSocket::FramingUtils.frame(137, "keep-alive").freeze
+
+    # Frames with a payload of this size or bigger are sent as two separate chunks
+    # (header and payload) rather than being copied into a single String.
+    GATHER_WRITE_MIN_SIZE = 4096
 
 
     def self.class_init
@@ -26,6 +27,7 @@ module OverSIP::WebSocket
 
 
     attr_writer :ws_app
+    attr_accessor :keepalive_activity
 
 
     LOG_ID = "WsFraming"
@@ -34,27 +36,36 @@ module OverSIP::WebSocket
     end
 
 
-    def initialize connection, buffer
+    def initialize connection, buffer, permessage_deflate=nil
       @connection = connection
       @buffer = buffer
+      @permessage_deflate = permessage_deflate
       @utf8_validator = ::OverSIP::WebSocket::FramingUtils::Utf8Validator.allocate
       @state = :init
     end
 
 
+    # Keep-alive ping frames are sent by the shared OverSIP::KeepAliveScheduler.
     def do_keep_alive interval
-      @keep_alive_timer = ::EM::PeriodicTimer.new(interval) do
-        unless @connection.error?  # Ensure it.
-          log_system_debug "sending keep-alive ping frame"  if $oversip_debug
-          @connection.send_data KEEPALIVE_PING_FRAME
-        else
-          @keep_alive_timer.cancel
-        end
-      end
+      ::OverSIP::KeepAliveScheduler.for_interval(interval).add self
+    end
+
+
+    def keepalive?
+      ! @keepalive_stopped and ! @connection.error?
+    end
+
+
+    def send_keepalive
+      log_system_debug "sending keep-alive ping frame"  if $oversip_debug
+      @connection.send_data KEEPALIVE_PING_FRAME
     end
 
 
     def receive_data
+      # Received data, so no keep-alive ping is needed in the current interval.
+      @keepalive_activity = true
+
       while (case @state
         when :init
           return false  if @buffer.size < 2
@@ -70,7 +81,8 @@ module OverSIP::WebSocket
           @rsv2 = (byte1 & 0b00100000) == 0b00100000
           @rsv3 = (byte1 & 0b00010000) == 0b00010000
 
-          if @rsv1 or @rsv2 or @rsv3
+          # RSV1 is used by the permessage-deflate extension (if negotiated).
+          if (@rsv1 and not @permessage_deflate) or @rsv2 or @rsv3
             log_system_notice "frame has RSV bits set, clossing the connection"
             @connection.close 1002, "RSV bit set not supported"
             return false
@@ -179,6 +191,13 @@ module OverSIP::WebSocket
             return false
           end
 
+          # RSV1 (permessage-deflate) can only be set in the first frame of a data message.
+          if @rsv1 and not text_or_binary_frame?
+            log_system_notice "received RSV1 bit set in a control or continuation frame, sending close frame"
+            @connection.close 1002, "RSV1 bit set in a control or continuation frame"
+            return false
+          end
+
           # Check max frame size.
           if @payload_length > @@max_frame_size
             @connection.close 1009, "frame too big"
@@ -191,9 +210,50 @@ module OverSIP::WebSocket
         when :payload_data
           return false  if @buffer.size < @payload_length
 
-          unless @payload_length.zero?
+          if text_or_binary_frame?
+            # A new data message starts, the RSV1 bit of its first frame tells whether it
+            # is compressed (permessage-deflate).
+            @msg_compressed = @rsv1
+
+            # A new text message starts, so reset the UTF8 validator.
+            @utf8_validator.reset  if @sym_opcode == :text
+          end
+
+          # Compressed message (permessage-deflate). It must be inflated before validating
+          # UTF-8 (and the last frame must be inflated even if empty).
+          if @msg_compressed and not control_frame?
+            @payload = ( @payload_length.zero? ? "".force_encoding(::Encoding::BINARY) : @buffer.read(@payload_length) )
+            ::OverSIP::WebSocket::FramingUtils.unmask! @payload, @masking_key
+
+            case @payload = @permessage_deflate.inflate(@payload, @fin)
+            when nil
+              log_system_notice "inflated message too big, sending close frame"
+              @connection.close 1009, "message too big"
+              return false
+            when false
+              @connection.close 1007, "invalid compressed data"
+              return false
+            end
+
+            if @sym_opcode == :text or (@sym_opcode == :continuation and @msg_sym_opcode == :text)
+              @valid_utf8 = @utf8_validator.validate @payload
+            end
+
+          elsif not @payload_length.zero?
             # NOTE: @payload will always be Encoding::BINARY
-            @payload = ::OverSIP::WebSocket::FramingUtils.unmask @buffer.read(@payload_length), @masking_key
+            # NOTE: The String returned by @buffer.read is owned by us, so unmask it in place.
+            @payload = @buffer.read(@payload_length)
+
+            # For text messages unmask and validate UTF-8 in a single pass. The validator
+            # returns:
+            # - true: Valid UTF-8 string.
+            # - nil: Valid but not terminated UTF-8 string.
+            # - false: Invalid UTF-8 string.
+            if @sym_opcode == :text or (@sym_opcode == :continuation and @msg_sym_opcode == :text)
+              @valid_utf8 = @utf8_validator.unmask_and_validate! @payload, @masking_key
+            else
+              ::OverSIP::WebSocket::FramingUtils.unmask! @payload, @masking_key
+            end
           end
           # NOTE: @payload could be nil.
 
@@ -213,17 +273,15 @@ module OverSIP::WebSocket
             # they will have opcode=continuation).
             @msg_sym_opcode = @sym_opcode
 
-            # Reset the UTF8 validator.
-            @utf8_validator.reset
-
             if @payload
-              if (valid_utf8 = @utf8_validator.validate(@payload)) == false
+              # NOTE: Payload already unmasked and validated in :payload_data state.
+              if @valid_utf8 == false
                 log_system_notice "received single text frame contains invalid UTF-8, closing the connection"
                 @connection.close 1007, "single text frame contains invalid UTF-8"
                 return false
               end
 
-              if @fin and not valid_utf8
+              if @fin and not @valid_utf8
                 log_system_notice "received single text frame contains incomplete UTF-8, closing the connection"
                 @connection.close 1007, "single text frame contains incomplete UTF-8"
                 return false
@@ -270,13 +328,14 @@ module OverSIP::WebSocket
 
             if @payload
               if @msg_sym_opcode == :text
-                if (valid_utf8 = @utf8_validator.validate(@payload)) == false
+                # NOTE: Payload already unmasked and validated in :payload_data state.
+                if @valid_utf8 == false
                   log_system_notice "received continuation text frame contains invalid UTF-8, closing the connection"
                   @connection.close 1007, "continuation text frame contains invalid UTF-8"
                   return false
                 end
 
-                if @fin and not valid_utf8
+                if @fin and not @valid_utf8
                   log_system_notice "received continuation final text frame contains incomplete UTF-8, closing the connection"
                   @connection.close 1007, "continuation final text frame contains incomplete UTF-8"
                   return false
@@ -370,33 +429,24 @@ module OverSIP::WebSocket
     def send_text_frame message
       log_system_debug "sending text frame: payload_length=#{message.bytesize}"  if $oversip_debug
 
-      frame = "".encode ::Encoding::BINARY
-
-      # byte1 = OPCODE_TO_INT[:text] | 0b10000000 => 129
-      #
-      # - FIN bit set.
-      # - RSV1-3 bits not set.
-      # - opcode = 1
-      frame << 129
-
-      length = message.bytesize
-      if length <= 125
-        frame << length # since rsv4 is 0
-      elsif length < 65536 # write 2 byte length
-        frame << 126
-        frame << [length].pack('n')
-      else # write 8 byte length
-        frame << 127
-        frame << [length >> 32, length & 0xFFFFFFFF].pack("NN")
-      end
-
-      if message.encoding == ::Encoding::BINARY
-        frame << message
+      # Compress the message if permessage-deflate was negotiated.
+      if @permessage_deflate and message.bytesize >= PermessageDeflate::MIN_COMPRESS_SIZE
+        # byte1 = OPCODE_TO_INT[:text] | 0b11000000 => 193
+        #
+        # - FIN bit set.
+        # - RSV1 bit set (compressed message).
+        # - RSV2-3 bits not set.
+        # - opcode = 1
+        send_frame 193, @permessage_deflate.deflate(message)
       else
-        frame << message.force_encoding(::Encoding::BINARY)
+        # byte1 = OPCODE_TO_INT[:text] | 0b10000000 => 129
+        #
+        # - FIN bit set.
+        # - RSV1-3 bits not set.
+        # - opcode = 1
+        send_frame 129, message
       end
 
-      @connection.send_data frame
       true
     end
 
@@ -404,33 +454,24 @@ module OverSIP::WebSocket
     def send_binary_frame message
       log_system_debug "sending binary frame: payload_length=#{message.bytesize}"  if $oversip_debug
 
-      frame = "".encode ::Encoding::BINARY
-
-      # byte1 = OPCODE_TO_INT[:binary] | 0b10000000 => 130
-      #
-      # - FIN bit set.
-      # - RSV1-3 bits not set.
-      # - opcode = 2
-      frame << 130
-
-      length = message.bytesize
-      if length <= 125
-        frame << length # since rsv4 is 0
-      elsif length < 65536 # write 2 byte length
-        frame << 126
-        frame << [length].pack('n')
-      else # write 8 byte length
-        frame << 127
-        frame << [length >> 32, length & 0xFFFFFFFF].pack("NN")
-      end
-
-      if message.encoding == ::Encoding::BINARY
-        frame << message
+      # Compress the message if permessage-deflate was negotiated.
+      if @permessage_deflate and message.bytesize >= PermessageDeflate::MIN_COMPRESS_SIZE
+        # byte1 = OPCODE_TO_INT[:binary] | 0b11000000 => 194
+        #
+        # - FIN bit set.
+        # - RSV1 bit set (compressed message).
+        # - RSV2-3 bits not set.
+        # - opcode = 2
+        send_frame 194, @permessage_deflate.deflate(message)
       else
-        frame << message.force_encoding(::Encoding::BINARY)
+        # byte1 = OPCODE_TO_INT[:binary] | 0b10000000 => 130
+        #
+        # - FIN bit set.
+        # - RSV1-3 bits not set.
+        # - opcode = 2
+        send_frame 130, message
       end
 
-      @connection.send_data frame
       true
     end
 
@@ -442,27 +483,13 @@ module OverSIP::WebSocket
         log_system_debug "sending ping frame: payload_length=0"  if $oversip_debug
       end
 
-      frame = "".encode ::Encoding::BINARY
-
       # byte1 = OPCODE_TO_INT[:ping] | 0b10000000 => 137
       #
       # - FIN bit set.
       # - RSV1-3 bits not set.
       # - opcode = 9
-      frame << 137
-
-      length = ( data ? data.bytesize : 0 )
-      frame << length
+      send_frame 137, data
 
-      if data
-        if data.encoding == ::Encoding::BINARY
-          frame << data
-        else
-          frame << data.force_encoding(::Encoding::BINARY)
-        end
-      end
-
-      @connection.send_data frame
       true
     end
 
@@ -474,33 +501,19 @@ module OverSIP::WebSocket
         log_system_debug "sending pong frame: payload_length=0"  if $oversip_debug
       end
 
-      frame = "".encode ::Encoding::BINARY
-
       # byte1 = OPCODE_TO_INT[:pong] | 0b10000000 => 138
       #
       # - FIN bit set.
       # - RSV1-3 bits not set.
       # - opcode = 10
-      frame << 138
+      send_frame 138, data
 
-      length = ( data ? data.bytesize : 0 )
-      frame << length
-
-      if data
-        if data.encoding == ::Encoding::BINARY
-          frame << data
-        else
-          frame << data.force_encoding(::Encoding::BINARY)
-        end
-      end
-
-      @connection.send_data frame
       true
     end
 
 
     def send_close_frame status=nil, reason=nil, in_reply_to_close=nil
-      @keep_alive_timer.cancel  if @keep_alive_timer
+      @keepalive_stopped = true
 
       unless in_reply_to_close
         log_system_debug "sending close frame: status=#{status.inspect}, reason=#{reason.inspect}"  if $oversip_debug
@@ -510,36 +523,36 @@ module OverSIP::WebSocket
 
       @buffer.clear
 
-      frame = "".encode ::Encoding::BINARY
+      if status
+        payload = [status].pack('n')
+        payload << reason.dup.force_encoding(::Encoding::BINARY)  if reason
+      end
 
       # byte1 = OPCODE_TO_INT[:close] | 0b10000000 => 136
       #
       # - FIN bit set.
       # - RSV1-3 bits not set.
       # - opcode = 8
-      frame << 136
-      if status
-        length = ( reason ? 2 + reason.bytesize : 2 )
-      else
-        length = 0
-      end
-
-      frame << length # since rsv4 is 0
-      if status
-        frame << [status].pack('n')
-        if reason
-          if reason.encoding == ::Encoding::BINARY
-            frame << reason
-          else
-            frame << reason.force_encoding(::Encoding::BINARY)
-          end
-        end
-      end
+      send_frame 136, payload
 
-      @connection.send_data frame
       true
     end
 
+
+    # Writes the frame into the connection. Small frames are built (header and payload)
+    # into a single String of the exact size. For big payloads just the header is built
+    # and both parts are given to the connection, which writes them together (gather
+    # write) so the payload is never copied into a new String.
+    def send_frame byte1, payload
+      if payload and payload.bytesize >= GATHER_WRITE_MIN_SIZE
+        @connection.send_data ::OverSIP::WebSocket::FramingUtils.frame_header(byte1, payload.bytesize)
+        @connection.send_data payload
+      else
+        @connection.send_data ::OverSIP::WebSocket::FramingUtils.frame(byte1, payload)
+      end
+    end
+    private :send_frame
+
   end
 
 end
@@ -53,10 +53,18 @@ module OverSIP::WebSocket
 
 
     def process_sip_message ws_message
+      @msg_received_at = ::OverSIP::SIP::Latency.now  if ::OverSIP::SIP::Latency.enabled?
+
+      if $oversip_capture
+        local_ip, local_port = @connection.local_ip_port
+        ::OverSIP::Capture.write @connection.remote_ip, @connection.remote_port, local_ip, local_port, @connection.transport, ws_message, nil
+      end
+
       # Just a single SIP message allowed per WS message.
       @parser.reset
 
       unless parser_nbytes = @parser.execute(ws_message, 0)
+        ::OverSIP::Metrics.parse_error @connection.transport
         if wrong_message = @parser.parsed
           log_system_warn "SIP parsing error for #{MSG_TYPE[wrong_message.class]}: \"#{@parser.error}\""
         else
@@ -67,6 +75,7 @@ module OverSIP::WebSocket
       end
 
       unless @parser.finished?
+        ::OverSIP::Metrics.parse_error @connection.transport
         log_system_warn "SIP parsing error: message not completed"
 
         @connection.close 4001, "SIP message incomplete"
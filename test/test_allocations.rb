@@ -0,0 +1,68 @@
+require "oversip_test_helper"
+require "yaml"
+
+
+class TestAllocations < OverSIPTest
+
+  Allocations = ::OverSIP::SIP::Allocations
+
+  # Max objects allocated per message in every stage.
+  BUDGET = ::YAML.load_file ::File.expand_path("../allocation_budget.yml", __FILE__)
+
+  ITERATIONS = 200
+
+  INVITE = "INVITE sip:alice@example.net SIP/2.0\r\nVia: SIP/2.0/UDP 1.2.3.4:5060;branch=z9hG4bKinvite;rport\r\nVia: SIP/2.0/TCP 10.0.0.1:5060;branch=z9hG4bKprevious\r\nRecord-Route: <sip:10.0.0.1;transport=tcp;lr>\r\nMax-Forwards: 70\r\nFrom: \"Bob\" <sip:bob@example.net>;tag=1234\r\nTo: <sip:alice@example.net>\r\nCall-ID: allocations-invite\r\nCSeq: 1 INVITE\r\nContact: <sip:bob@1.2.3.4:5060>\r\nAllow: INVITE,ACK,CANCEL,BYE,OPTIONS\r\nSupported: timer,100rel\r\nContent-Type: application/sdp\r\nContent-Length: 0\r\n\r\n"
+  REGISTER = "REGISTER sip:example.net SIP/2.0\r\nVia: SIP/2.0/UDP 1.2.3.4:5060;branch=z9hG4bKregister;rport\r\nMax-Forwards: 70\r\nFrom: <sip:bob@example.net>;tag=5678\r\nTo: <sip:bob@example.net>\r\nCall-ID: allocations-register\r\nCSeq: 1 REGISTER\r\nContact: <sip:bob@1.2.3.4:5060>;expires=3600\r\nContent-Length: 0\r\n\r\n"
+  RESPONSE = "SIP/2.0 200 OK\r\nVia: SIP/2.0/UDP 1.2.3.4:5060;branch=z9hG4bKinvite;rport=5060\r\nFrom: <sip:bob@example.net>;tag=1234\r\nTo: <sip:alice@example.net>;tag=abcd\r\nCall-ID: allocations-response\r\nCSeq: 1 INVITE\r\nContact: <sip:alice@5.6.7.8:5060>\r\nContent-Length: 0\r\n\r\n"
+
+  # UDP server which does not process the parsed messages.
+  def connection
+    conn = ::OverSIP::SIP::IPv4UdpServer.allocate
+    conn.send :initialize
+    def conn.get_peername ; ::Socket.sockaddr_in(5060, "1.2.3.4") ; end
+    def conn.process_request ; @parsed = @msg ; end
+    def conn.process_response ; @parsed = @msg ; end
+    conn
+  end
+  private :connection
+
+  def received conn, data
+    conn.receive_data data
+    msg = conn.instance_variable_get :@parsed
+    def msg.send_response response ; end
+    msg
+  end
+  private :received
+
+  def assert_within_budget averages
+    BUDGET.each do |stage, types|
+      types.each do |type, max_objects|
+        objects, malloc, samples = averages[stage.to_sym][type.to_sym]
+        assert_equal ITERATIONS, samples, "#{stage} #{type} samples"
+        assert objects <= max_objects, "#{stage} #{type}: #{objects.round(1)} objects per message exceed the budget (#{max_objects})"
+      end
+    end
+  end
+  private :assert_within_budget
+
+  def test_budget
+    Allocations.enable
+    conn = connection
+
+    # Warm up.
+    3.times { [ INVITE, REGISTER, RESPONSE ].each {|data| received conn, data} }
+    Allocations.reset
+
+    ITERATIONS.times do
+      invite = received conn, INVITE
+      invite.to_s
+      invite.reply 100
+
+      received(conn, REGISTER).reply 200
+      received conn, RESPONSE
+    end
+
+    assert_within_budget Allocations.averages
+  end
+
+end
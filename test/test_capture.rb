@@ -0,0 +1,67 @@
+require "oversip_test_helper"
+
+
+class TestCapture < OverSIPTest
+
+  def setup
+    @file = ::Tempfile.new "oversip_capture"
+    ::OverSIP::Capture.open @file.path, 65536
+  end
+
+  def teardown
+    ::OverSIP::Capture.close
+    @file.close!
+  end
+
+  def data
+    ::File.binread(@file.path).byteslice(::OverSIP::Capture::HEADER_SIZE..-1)
+  end
+
+  def test_write_hep3_packet
+    headers = "OPTIONS sip:oversip.net SIP/2.0\r\nCall-ID: 1234\r\nContent-Length: 4\r\n\r\n"
+
+    assert_true ::OverSIP::Capture.write("1.2.3.4", 5060, "5.6.7.8", 5070, :udp, headers, "body")
+    assert_equal 1, ::OverSIP::Capture.num_packets
+
+    packet = data
+    assert_equal "HEP3", packet.byteslice(0, 4)
+    length = packet.byteslice(4, 2).unpack("n").first
+    assert_equal headers + "body", packet.byteslice(length - headers.bytesize - 4, headers.bytesize + 4)
+  end
+
+  def test_invalid_addresses
+    assert_false ::OverSIP::Capture.write("1.2.3.4", 5060, "2001:db8::1", 5060, :tcp, "msg", nil)
+    assert_false ::OverSIP::Capture.write("invalid", 5060, "1.2.3.4", 5060, :tcp, "msg", nil)
+    assert_equal 0, ::OverSIP::Capture.num_packets
+  end
+
+  def test_ring_wraps
+    msg = "MESSAGE sip:oversip.net SIP/2.0\r\n\r\n" + "x" * 1000
+    100.times { ::OverSIP::Capture.write("2001:db8::1", 5060, "2001:db8::2", 5060, :tls, msg, nil) }
+
+    assert_equal 100, ::OverSIP::Capture.num_packets
+    assert_equal "HEP3", data.byteslice(0, 4)
+  end
+
+  def test_reopen_keeps_capture
+    2.times { ::OverSIP::Capture.write("1.2.3.4", 5060, "5.6.7.8", 5060, :udp, "OPTIONS sip:a@b SIP/2.0\r\n\r\n", nil) }
+    ::OverSIP::Capture.close
+
+    assert_true ::OverSIP::Capture.open(@file.path, 65536)
+    assert_equal 2, ::OverSIP::Capture.num_packets
+    ::OverSIP::Capture.write("1.2.3.4", 5060, "5.6.7.8", 5060, :udp, "OPTIONS sip:a@b SIP/2.0\r\n\r\n", nil)
+    assert_equal 3, ::OverSIP::Capture.num_packets
+  end
+
+  def test_reopen_with_other_size_rotates
+    ::OverSIP::Capture.write("1.2.3.4", 5060, "5.6.7.8", 5060, :udp, "OPTIONS sip:a@b SIP/2.0\r\n\r\n", nil)
+    ::OverSIP::Capture.close
+
+    assert_false ::OverSIP::Capture.open(@file.path, 131072)
+    assert_equal 0, ::OverSIP::Capture.num_packets
+    assert_equal ::OverSIP::Capture::HEADER_SIZE + 65536, ::File.size("#{@file.path}.old")
+  ensure
+    ::File.delete "#{@file.path}.old"  rescue nil
+  end
+
+end
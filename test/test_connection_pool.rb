@@ -0,0 +1,186 @@
+require "oversip_test_helper"
+
+
+class TestConnectionPool < OverSIPTest
+
+  ConnectionPool = ::OverSIP::SIP::ConnectionPool
+
+  class FakeConnection
+    attr_reader :args
+    attr_accessor :connected, :error, :callback_on_server_tls_handshake
+
+    def initialize args
+      @args = args
+      @connected = false
+      @error = false
+    end
+
+    def error?
+      @error
+    end
+  end
+
+  # Replaces EM.oversip_connect_tcp_server (returning fake connections, or raising
+  # while @refuse is set) and EM.add_timer (timers are run by the test).
+  def setup
+    @connections = connections = []
+    @timers = timers = []
+    @refuse = false
+    test = self
+
+    @em_methods = [ :oversip_connect_tcp_server, :add_timer ].map {|method| [ method, ::EM.method(method) ]}
+    ::EM.define_singleton_method(:oversip_connect_tcp_server) do |*args|
+      raise ::RuntimeError, "connection refused"  if test.refuse
+      connections << ( conn = FakeConnection.new args )
+      conn
+    end
+    ::EM.define_singleton_method(:add_timer) {|interval, &block| timers << [ interval, block ]}
+  end
+
+  def teardown
+    @em_methods.each {|method, original| ::EM.define_singleton_method method, original}
+  end
+
+  attr_reader :refuse
+
+  def new_pool transport=:tcp, size=3, callback_on_server_tls_handshake=false
+    server_class = ( transport == :tcp ? ::OverSIP::SIP::IPv4TcpServer : ::OverSIP::SIP::IPv4TlsServer )
+    client_class = ( transport == :tcp ? ::OverSIP::SIP::IPv4TcpClient : ::OverSIP::SIP::IPv4TlsClient )
+    pool = ConnectionPool::Pool.new server_class, client_class, "10.0.0.1", "10.0.0.2", 5060, size, callback_on_server_tls_handshake
+    def pool.log_system_error msg ; end
+    pool
+  end
+  private :new_pool
+
+  def run_timers
+    timers = @timers.dup
+    @timers.clear
+    timers.each {|interval, block| block.call}
+  end
+  private :run_timers
+
+  def test_prewarm
+    pool = new_pool :tcp, 3
+    pool.connect_all
+
+    assert_equal 3, @connections.size
+    @connections.each do |conn|
+      assert_equal [ "10.0.0.1", "10.0.0.2", 5060, ::OverSIP::SIP::IPv4TcpClient, "10.0.0.2", 5060, pool ], conn.args
+      assert_nil conn.callback_on_server_tls_handshake
+    end
+  end
+
+  def test_prewarm_tls
+    new_pool(:tls, 2, true).connect_all
+    new_pool(:tls, 1, false).connect_all
+
+    assert_equal [ true, true, false ], @connections.map {|conn| conn.callback_on_server_tls_handshake}
+  end
+
+  def test_round_robin_across_connected
+    pool = new_pool :tcp, 3
+    pool.connect_all
+
+    # Not connected yet.
+    assert_nil pool.get_connection
+
+    @connections[0].connected = true
+    @connections[2].connected = true
+    picked = ::Array.new(4) { pool.get_connection }
+    assert_equal [ @connections[0], @connections[2], @connections[0], @connections[2] ], picked
+
+    @connections[2].error = true
+    assert_equal [ @connections[0] ] * 2, ::Array.new(2) { pool.get_connection }
+  end
+
+  def test_reconnect_after_close
+    pool = new_pool :tcp, 1
+    pool.connect_all
+    conn = @connections[0]
+    conn.connected = true
+
+    pool.connection_closed conn
+    assert_nil pool.get_connection
+    assert_equal [ ConnectionPool::RECONNECT_MIN_INTERVAL ], @timers.map {|interval, block| interval}
+
+    run_timers
+    assert_equal 2, @connections.size
+    @connections[1].connected = true
+    assert_same @connections[1], pool.get_connection
+
+    # Unknown connections are ignored.
+    pool.connection_closed conn
+    assert_empty @timers
+  end
+
+  def test_reconnect_backoff
+    pool = new_pool :tcp, 1
+    pool.connect_all
+
+    # Connection attempts failing before being connected double the interval.
+    intervals = []
+    8.times do
+      pool.connection_closed @connections.last
+      intervals << @timers[0][0]
+      run_timers
+    end
+    assert_equal [ 2, 4, 8, 16, 32, 64, 64, 64 ], intervals
+
+    # Once connected the interval is reset.
+    @connections.last.connected = true
+    pool.connection_closed @connections.last
+    assert_equal ConnectionPool::RECONNECT_MIN_INTERVAL, @timers[0][0]
+  end
+
+  def test_connect_error
+    pool = new_pool :tcp, 1
+    @refuse = true
+    pool.connect_all
+
+    assert_empty @connections
+    assert_equal [ 2 ], @timers.map {|interval, block| interval}
+
+    @refuse = false
+    run_timers
+    assert_equal 1, @connections.size
+  end
+
+  def test_get_connection_by_destination
+    ::OverSIP.configuration = { :sip => {
+      :connection_pool => [ "tcp:10.0.0.2:5060", "tls:10.0.0.3:5061", "tcp:[2001:db8::1]:5060" ],
+      :connection_pool_size => 2,
+      :connection_pool_callback_on_server_tls_handshake => false,
+      :sip_tcp => true, :sip_tls => true, :enable_ipv4 => true, :enable_ipv6 => false
+    } }
+    def ConnectionPool.log_system_warn msg ; end
+    def ConnectionPool.log_system_info msg ; end
+    ConnectionPool.module_init
+    ConnectionPool.run
+
+    tcp_key = ::OverSIP::Utils.connection_key "10.0.0.2", 5060
+    tls_key = ::OverSIP::Utils.connection_key "10.0.0.3", 5061
+    tcp = @connections.select {|conn| conn.args[1] == "10.0.0.2"}
+    tls = @connections.select {|conn| conn.args[1] == "10.0.0.3"}
+    assert_equal 2, tcp.size
+    assert_equal 2, tls.size
+    # The IPv6 destination is ignored (IPv6 disabled).
+    assert_equal 4, @connections.size
+
+    tcp.each {|conn| conn.connected = true}
+    assert_includes tcp, ConnectionPool.get_connection(::OverSIP::SIP::IPv4TcpServer, tcp_key)
+    assert_nil ConnectionPool.get_connection(::OverSIP::SIP::IPv4TlsServer, tls_key)
+    assert_nil ConnectionPool.get_connection(::OverSIP::SIP::IPv4TcpServer, tls_key)
+
+    # The TLS pool does not run the TLS handshake callback so it's not used when the
+    # proxy requires it.
+    tls.each {|conn| conn.connected = true}
+    assert_equal [ false, false ], tls.map {|conn| conn.callback_on_server_tls_handshake}
+    assert_includes tls, ConnectionPool.get_connection(::OverSIP::SIP::IPv4TlsServer, tls_key, false)
+    assert_nil ConnectionPool.get_connection(::OverSIP::SIP::IPv4TlsServer, tls_key, true)
+    assert_nil ConnectionPool.get_connection(::OverSIP::SIP::IPv4TlsServer, tcp_key)
+  ensure
+    ConnectionPool.instance_variable_set :@pools, {}
+    [ :log_system_warn, :log_system_info ].each {|method| ConnectionPool.singleton_class.send :remove_method, method  rescue nil}
+  end
+
+end
@@ -0,0 +1,169 @@
+require "oversip_test_helper"
+
+
+class TestDeadlineWheel < OverSIPTest
+
+  DeadlineWheel = ::OverSIP::DeadlineWheel
+
+  class FakeConnection
+    attr_reader :expired
+
+    def initialize
+      @expired = []
+    end
+
+    def deadline_expired reason
+      @expired << reason
+      true
+    end
+  end
+
+  # Empty wheel without periodic timer (ticks are run by the test).
+  def setup
+    DeadlineWheel.instance_variable_set :@slots, ::Array.new(DeadlineWheel::SIZE)
+    DeadlineWheel.instance_variable_set :@connections, {}.compare_by_identity
+    DeadlineWheel.instance_variable_set :@current, 0
+    DeadlineWheel.instance_variable_set :@num_reaped, ::Hash.new(0)
+    DeadlineWheel.instance_variable_set :@timer, true
+  end
+
+  def tick num=1
+    num.times { DeadlineWheel.send :tick }
+  end
+  private :tick
+
+  def test_arm_and_expire
+    conn = FakeConnection.new
+    DeadlineWheel.arm conn, 3, :headers
+    assert_equal :headers, DeadlineWheel.armed(conn)
+
+    tick 2
+    assert_empty conn.expired
+    tick
+    assert_equal [ :headers ], conn.expired
+    assert_nil DeadlineWheel.armed(conn)
+    assert_equal 1, DeadlineWheel.num_reaped[:headers]
+
+    # Expired just once.
+    tick DeadlineWheel::SIZE
+    assert_equal [ :headers ], conn.expired
+  end
+
+  def test_disarm
+    conn = FakeConnection.new
+    DeadlineWheel.arm conn, 2, :idle
+    DeadlineWheel.disarm conn
+    assert_nil DeadlineWheel.armed(conn)
+
+    tick 5
+    assert_empty conn.expired
+    assert_equal 0, DeadlineWheel.num_reaped[:idle]
+
+    # Disarming a connection without deadline does nothing.
+    DeadlineWheel.disarm conn
+  end
+
+  def test_reset_replaces_the_deadline
+    conn = FakeConnection.new
+    DeadlineWheel.arm conn, 2, :headers
+    tick
+    DeadlineWheel.arm conn, 5, :body
+    assert_equal :body, DeadlineWheel.armed(conn)
+
+    tick 4
+    assert_empty conn.expired
+    tick
+    assert_equal [ :body ], conn.expired
+  end
+
+  def test_wrap_around
+    DeadlineWheel.instance_variable_set :@current, DeadlineWheel::SIZE - 2
+    conn = FakeConnection.new
+    DeadlineWheel.arm conn, 5, :tls_handshake
+
+    tick 4
+    assert_empty conn.expired
+    tick
+    assert_equal [ :tls_handshake ], conn.expired
+    assert_equal 3, DeadlineWheel.instance_variable_get(:@current)
+  end
+
+  def test_deadlines_are_bounded
+    short = FakeConnection.new
+    long = FakeConnection.new
+    DeadlineWheel.arm short, 0.1, :idle
+    DeadlineWheel.arm long, DeadlineWheel::SIZE * 10, :idle
+
+    tick
+    assert_equal [ :idle ], short.expired
+    # At most SIZE - 1 ticks.
+    tick DeadlineWheel::SIZE - 3
+    assert_empty long.expired
+    tick
+    assert_equal [ :idle ], long.expired
+  end
+
+  def test_rearm_within_expiration
+    conn = FakeConnection.new
+    def conn.deadline_expired reason
+      super
+      ::OverSIP::DeadlineWheel.arm self, 2, :idle  if reason == :headers
+    end
+    DeadlineWheel.arm conn, 1, :headers
+
+    tick
+    assert_equal :idle, DeadlineWheel.armed(conn)
+    tick 2
+    assert_equal [ :headers, :idle ], conn.expired
+  end
+
+  def test_only_closed_connections_are_counted
+    conn = FakeConnection.new
+    # Already closed.
+    def conn.deadline_expired reason
+      super
+      false
+    end
+    DeadlineWheel.arm conn, 1, :idle
+
+    tick
+    assert_equal [ :idle ], conn.expired
+    assert_equal 0, DeadlineWheel.num_reaped[:idle]
+  end
+
+  def test_many_connections_in_a_slot
+    connections = ::Array.new(100) { FakeConnection.new }
+    connections.each {|conn| DeadlineWheel.arm conn, 1, :idle}
+    DeadlineWheel.disarm connections[0]
+
+    tick
+    assert_equal [ [] ] + [ [ :idle ] ] * 99, connections.map {|conn| conn.expired}
+    assert_equal 99, DeadlineWheel.num_reaped[:idle]
+  end
+
+  def test_keepalive_reply_does_not_arm_the_headers_deadline
+    conn = ::OverSIP::SIP::IPv4TcpServer.allocate
+    conn.send :initialize
+    conn.instance_variable_set :@writes, []
+    def conn.writes ; @writes ; end
+    def conn.send_data data ; @writes << data ; end
+    def conn.close_connection after_writing=false ; @state = :ignore ; end
+    conn.reset_idle_deadline
+
+    # Reply to our keepalive.
+    conn.receive_data "\r\n"
+    assert_not_equal :headers, DeadlineWheel.armed(conn)
+    tick ::OverSIP::SIP::TcpConnection::HEADERS_MAX_TIME + 1
+    assert_not_equal :ignore, conn.instance_variable_get(:@state)
+    assert_equal 0, DeadlineWheel.num_reaped[:headers]
+
+    # A keepalive from the peer is still replied.
+    conn.receive_data "\r\n\r\n"
+    assert_equal [ "\r\n" ], conn.writes
+
+    # A partial message does arm it.
+    conn.receive_data "OPTIONS sip:oversip.net SIP/2.0\r\n"
+    assert_equal :headers, DeadlineWheel.armed(conn)
+  end
+
+end
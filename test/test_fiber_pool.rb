@@ -0,0 +1,130 @@
+require "oversip_test_helper"
+
+
+class TestFiberPool < OverSIPTest
+
+  def test_run_blocks
+    pool = ::OverSIP::FiberPool.new 2
+    results = []
+
+    assert_true pool.spawn { results << 1 }
+    assert_true pool.spawn { results << 2 }
+    assert_true pool.spawn { results << 3 }
+
+    assert_equal [ 1, 2, 3 ], results
+    assert_equal 0, pool.num_busy
+    assert_equal 0, pool.queue_size
+  end
+
+  def test_queue_and_reject
+    pool = ::OverSIP::FiberPool.new 2, 1
+    waiting = []
+    results = []
+
+    # Blocks waiting for some event (as when waiting for a DNS response) keep their fibers busy.
+    2.times {|i| assert_true pool.spawn { waiting << ::Fiber.current ; ::Fiber.yield ; results << i }}
+    assert_equal 2, pool.num_busy
+
+    assert_true pool.spawn { results << :queued }
+    assert_equal 1, pool.queue_size
+    assert_false pool.spawn { results << :rejected }
+
+    # Once a fiber finishes its block it runs the queued one.
+    waiting.shift.resume
+    assert_equal [ 0, :queued ], results
+    assert_equal 0, pool.queue_size
+    assert_equal 1, pool.num_busy
+
+    waiting.shift.resume
+    assert_equal [ 0, :queued, 1 ], results
+    assert_equal 0, pool.num_busy
+  end
+
+  def test_metrics
+    pool = ::OverSIP::FiberPool.new 1, 0, "test"
+    waiting = nil
+
+    pool.spawn { waiting = ::Fiber.current ; ::Fiber.yield }
+    assert_false pool.spawn { }
+
+    render = ::OverSIP::Metrics.render
+    assert_match /^oversip_fiber_pool_busy\{pool="test"\} 1$/, render
+    assert_match /^oversip_fiber_pool_rejected_total\{pool="test"\} 1$/, render
+
+    waiting.resume
+    assert_match /^oversip_fiber_pool_busy\{pool="test"\} 0$/, ::OverSIP::Metrics.render
+  end
+
+  def test_reject_callback
+    pool = ::OverSIP::FiberPool.new 1, 0
+    rejected = 0
+    pool.on_reject = proc { rejected += 1 }
+
+    pool.spawn { ::Fiber.yield }
+    2.times { assert_false pool.spawn { } }
+
+    assert_equal 2, rejected
+    assert_equal 2, pool.num_rejected
+  end
+
+  def test_unbounded_queue
+    pool = ::OverSIP::FiberPool.new 1
+    waiting = nil
+    results = []
+
+    pool.spawn { waiting = ::Fiber.current ; ::Fiber.yield }
+    # Queue grows beyond its initial capacity.
+    200.times {|i| assert_true pool.spawn { results << i }}
+    assert_equal 200, pool.queue_size
+
+    waiting.resume
+    assert_equal (0...200).to_a, results
+    assert_equal 0, pool.queue_size
+    assert_equal 0, pool.num_busy
+  end
+
+  def test_dead_fiber
+    pool = ::OverSIP::FiberPool.new 2
+
+    assert_raise(::RuntimeError) { pool.spawn { raise "error" } }
+    assert_equal 1, pool.num_died
+    assert_equal 0, pool.num_busy
+
+    # The dead fiber has been replaced.
+    results = []
+    2.times {|i| pool.spawn { results << i ; ::Fiber.yield }}
+    assert_equal [ 0, 1 ], results
+    assert_equal 2, pool.num_busy
+  end
+
+  # A queued block taken by a dying fiber must not be run by another one.
+  def test_dead_fiber_with_queued_blocks
+    ticks = []
+    next_tick = ::EM.method(:next_tick)
+    ::EM.define_singleton_method(:next_tick) {|&block| ticks << block}
+
+    pool = ::OverSIP::FiberPool.new 2
+    results = []
+    failing = waiting = nil
+    pool.spawn { failing = ::Fiber.current ; ::Fiber.yield ; raise "error" }
+    pool.spawn { waiting = ::Fiber.current ; ::Fiber.yield }
+    pool.spawn { results << :queued }
+    assert_equal 1, pool.queue_size
+
+    assert_raise(::RuntimeError) { failing.resume }
+    # The queued block is kept for the new fiber.
+    assert_equal 0, pool.queue_size
+    assert_equal 2, pool.num_busy
+    waiting.resume
+    assert_equal 1, pool.num_busy
+    assert_empty results
+
+    ticks.each {|block| block.call}
+    assert_equal [ :queued ], results
+    assert_equal 0, pool.num_busy
+    assert_equal 1, pool.num_died
+  ensure
+    ::EM.define_singleton_method :next_tick, next_tick
+  end
+
+end
@@ -0,0 +1,79 @@
+require "oversip_test_helper"
+
+
+class TestHaproxyProtocol < OverSIPTest
+
+  V2_SIGNATURE = "\r\n\r\n\0\r\nQUIT\n".force_encoding(::Encoding::BINARY)
+
+  def tlv type, value
+    [ type, value.bytesize ].pack("Cn") << value.dup.force_encoding(::Encoding::BINARY)
+  end
+  private :tlv
+
+  def v2_header command, family, payload
+    V2_SIGNATURE + [ 0x20 | command, family, payload.bytesize ].pack("CCn") << payload
+  end
+  private :v2_header
+
+  def ipv4_addresses
+    [ 192, 168, 0, 1, 10, 0, 0, 1 ].pack("C*") << [ 56324, 5061 ].pack("nn")
+  end
+  private :ipv4_addresses
+
+  def test_parse_v1
+    assert_equal [ 47, :ipv4, "192.168.0.1", 56324, nil ],
+                 ::OverSIP::Utils.parse_haproxy_protocol("PROXY TCP4 192.168.0.1 192.168.0.11 56324 443\r\nOPTIONS")
+    assert_nil ::OverSIP::Utils.parse_haproxy_protocol("PROXY TCP4 192.168.0.1 192.1")
+    assert_false ::OverSIP::Utils.parse_haproxy_protocol("PROXY TCP4 192.168.0.1 lalala\r\n")
+  end
+
+  def test_parse_v2_ipv4_with_tlvs
+    ssl = tlv(0x20, [ 0x03, 0 ].pack("CN") << tlv(0x21, "TLSv1.2") << tlv(0x22, "pbx.oversip.test"))
+    header = v2_header(1, 0x11, ipv4_addresses << tlv(0x05, "conn-1234") << ssl)
+
+    result = ::OverSIP::Utils.parse_haproxy_protocol(header + "OPTIONS sip:oversip.test SIP/2.0\r\n")
+    assert_equal [ header.bytesize, :ipv4, "192.168.0.1", 56324 ], result[0..3]
+    assert_equal "conn-1234", result[4][:unique_id]
+    assert_true result[4][:ssl]
+    assert_true result[4][:ssl_client_cert_verified]
+    assert_equal "TLSv1.2", result[4][:ssl_version]
+    assert_equal "pbx.oversip.test", result[4][:ssl_cn]
+  end
+
+  def test_parse_v2_client_cert_not_verified
+    header = v2_header(1, 0x11, ipv4_addresses << tlv(0x20, [ 0x03, 1 ].pack("CN")))
+
+    assert_false ::OverSIP::Utils.parse_haproxy_protocol(header)[4][:ssl_client_cert_verified]
+  end
+
+  def test_parse_v2_client_cert_in_resumed_session
+    # PP2_CLIENT_SSL | PP2_CLIENT_CERT_SESS.
+    result = ::OverSIP::Utils.parse_haproxy_protocol(v2_header(1, 0x11, ipv4_addresses << tlv(0x20, [ 0x05, 0 ].pack("CN"))))
+
+    assert_true result[4][:ssl_client_cert]
+    assert_true result[4][:ssl_client_cert_verified]
+  end
+
+  def test_parse_v2_ipv6
+    addresses = ([ 0 ] * 15 << 1).pack("C*") << ([ 0 ] * 16).pack("C*") << [ 1234, 5061 ].pack("nn")
+
+    assert_equal [ 52, :ipv6, "::1", 1234, nil ], ::OverSIP::Utils.parse_haproxy_protocol(v2_header(1, 0x21, addresses))
+  end
+
+  def test_parse_v2_local
+    assert_equal [ 16, nil, nil, nil, nil ], ::OverSIP::Utils.parse_haproxy_protocol(v2_header(0, 0x00, ""))
+  end
+
+  def test_parse_v2_incomplete
+    header = v2_header(1, 0x11, ipv4_addresses)
+
+    assert_nil ::OverSIP::Utils.parse_haproxy_protocol(header[0, 6])
+    assert_nil ::OverSIP::Utils.parse_haproxy_protocol(header[0, 20])
+  end
+
+  def test_parse_v2_invalid
+    assert_false ::OverSIP::Utils.parse_haproxy_protocol(v2_header(1, 0x11, "1234"))
+    assert_false ::OverSIP::Utils.parse_haproxy_protocol(v2_header(1, 0x11, ipv4_addresses << [ 0x05, 10 ].pack("Cn") << "abc"))
+  end
+
+end
@@ -70,4 +70,20 @@ END
     assert_equal ["qwe", "asd"], request["Nonaino-Lala"]
   end
 
+  def test_parse_http_get_with_extensions
+    parser, request = parse <<-END
+GET /ws HTTP/1.1
+Host: server.example.com
+Upgrade: websocket
+Connection: Upgrade
+Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==
+Sec-WebSocket-Version: 13
+Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits ,  foo
+sec-websocket-extensions: permessage-deflate; server_max_window_bits=10
+
+END
+
+    assert_equal ["permessage-deflate; client_max_window_bits", "foo", "permessage-deflate; server_max_window_bits=10"], request.hdr_sec_websocket_extensions
+  end
+
 end
@@ -0,0 +1,139 @@
+require "oversip_test_helper"
+
+
+class TestKeepAliveScheduler < OverSIPTest
+
+  class FakeConnection
+    attr_accessor :keepalive, :keepalive_activity, :pings
+
+    def initialize
+      @keepalive = true
+      @keepalive_activity = false
+      @pings = 0
+    end
+
+    def keepalive?
+      @keepalive
+    end
+
+    def send_keepalive
+      @pings += 1
+    end
+  end
+
+  # Scheduler without periodic timer (ticks are run by the test).
+  def scheduler interval
+    scheduler = ::OverSIP::KeepAliveScheduler.new interval
+    scheduler.instance_variable_set :@timer, true
+    scheduler
+  end
+  private :scheduler
+
+  def tick scheduler, num=1
+    num.times { scheduler.send :tick }
+  end
+  private :tick
+
+  def test_ping_once_per_interval
+    ka = scheduler 5
+    connection = FakeConnection.new
+    ka.add connection
+    assert_equal 1, ka.num_connections
+
+    # First ping after a whole interval.
+    tick ka, 4
+    assert_equal 0, connection.pings
+    tick ka
+    assert_equal 1, connection.pings
+
+    tick ka, 5
+    assert_equal 2, connection.pings
+    tick ka, 15
+    assert_equal 5, connection.pings
+    assert_equal 5, ka.num_pings_sent
+  end
+
+  def test_connections_keep_their_phase
+    ka = scheduler 3
+    first = FakeConnection.new
+    second = FakeConnection.new
+
+    ka.add first
+    tick ka
+    ka.add second
+
+    tick ka, 2
+    assert_equal [ 1, 0 ], [ first.pings, second.pings ]
+    tick ka
+    assert_equal [ 1, 1 ], [ first.pings, second.pings ]
+  end
+
+  def test_batch_in_the_same_tick
+    ka = scheduler 2
+    connections = ::Array.new(10) { FakeConnection.new }
+    connections.each {|connection| ka.add connection}
+
+    tick ka, 2
+    assert_equal [ 1 ] * 10, connections.map {|connection| connection.pings}
+    assert_equal 10, ka.num_pings_sent
+  end
+
+  def test_skip_connections_with_activity
+    ka = scheduler 2
+    connection = FakeConnection.new
+    ka.add connection
+
+    connection.keepalive_activity = true
+    tick ka, 2
+    assert_equal 0, connection.pings
+    assert_equal 1, ka.num_pings_skipped
+    assert_false connection.keepalive_activity
+
+    tick ka, 2
+    assert_equal 1, connection.pings
+  end
+
+  def test_unschedule
+    ka = scheduler 2
+    connection = FakeConnection.new
+    ka.add connection
+
+    connection.keepalive = false
+    tick ka, 2
+    assert_equal 0, connection.pings
+    assert_equal 0, ka.num_connections
+
+    # Not visited anymore.
+    connection.keepalive = true
+    tick ka, 4
+    assert_equal 0, connection.pings
+  end
+
+  def test_interval_shorter_than_tick
+    ka = scheduler 0.5
+    connection = FakeConnection.new
+    ka.add connection
+
+    tick ka
+    assert_equal 1, connection.pings
+    tick ka
+    assert_equal 2, connection.pings
+  end
+
+  def test_errors_do_not_unschedule
+    ka = scheduler 1
+    connection = FakeConnection.new
+    def connection.send_keepalive ; raise "broken" ; end
+    def ka.log_system_error msg ; end
+    ka.add connection
+
+    tick ka
+    assert_equal 1, ka.num_connections
+  end
+
+  def test_one_scheduler_per_interval
+    assert_same ::OverSIP::KeepAliveScheduler.for_interval(30), ::OverSIP::KeepAliveScheduler.for_interval(30)
+    assert_not_same ::OverSIP::KeepAliveScheduler.for_interval(30), ::OverSIP::KeepAliveScheduler.for_interval(60)
+  end
+
+end
@@ -0,0 +1,89 @@
+require "oversip_test_helper"
+
+
+class TestLatency < OverSIPTest
+
+  Latency = ::OverSIP::SIP::Latency
+
+  def request sip_method, call_id
+    parser = ::OverSIP::SIP::MessageParser.new
+    parser.execute "#{sip_method} sip:alice@example.net SIP/2.0\r\nVia: SIP/2.0/UDP 1.2.3.4;branch=z9hG4bK#{call_id}\r\nFrom: <sip:bob@example.net>;tag=1234\r\nTo: <sip:alice@example.net>\r\nCall-ID: #{call_id}\r\nCSeq: 1 #{sip_method}\r\nMax-Forwards: 10\r\nContent-Length: 0\r\n\r\n", 0
+    assert parser.finished?
+    parser.parsed
+  end
+  private :request
+
+  def count stage, sip_method
+    ::OverSIP::Metrics.render[/^oversip_sip_request_stage_seconds_count\{stage="#{stage}",method="#{sip_method}"\} (\d+)$/, 1].to_i
+  end
+  private :count
+
+  def setup
+    ::OverSIP.configuration = { :core => { :latency_trace_size => 2 } }
+    Latency.module_init
+  end
+
+  def test_proxied_request
+    stages = [ :parse, :dispatch, :user, :dns, :transport, :response, :total ]
+    counts = stages.map {|stage| count stage, :INVITE}
+
+    msg = request :INVITE, "proxied"
+    Latency.received msg, Latency.now - 0.01
+    [ Latency::CORE, Latency::ROUTED, Latency::DNS, Latency::SENT ].each {|index| Latency.mark msg, index}
+    Latency.response_sent msg
+    # Just the first response is taken into account.
+    Latency.response_sent msg
+
+    assert_equal counts.map {|c| c + 1}, stages.map {|stage| count stage, :INVITE}
+    assert msg.timestamps.each_cons(2).all? {|t1, t2| t1 <= t2}
+    assert msg.timestamps[Latency::PARSED] - msg.timestamps[Latency::RECEIVED] >= 0.01
+  end
+
+  def test_locally_replied_request
+    user = count :user, :REGISTER
+    response = count :response, :REGISTER
+
+    msg = request :REGISTER, "replied"
+    Latency.received msg, nil
+    Latency.mark msg, Latency::CORE
+    Latency.response_sent msg
+
+    assert_equal user + 1, count(:user, :REGISTER)
+    assert_equal response, count(:response, :REGISTER)
+  end
+
+  def test_unknown_method
+    other = count :total, :other
+
+    msg = request :FOO, "unknown"
+    Latency.received msg, nil
+    Latency.response_sent msg
+
+    assert_equal other + 1, count(:total, :other)
+  end
+
+  def test_slowest_requests
+    [ [ "fast", 0.001 ], [ "slow", 0.1 ], [ "medium", 0.01 ] ].each do |call_id, elapsed|
+      msg = request :OPTIONS, call_id
+      Latency.received msg, Latency.now - elapsed
+      Latency.response_sent msg
+    end
+
+    slowest = Latency.instance_variable_get :@slowest
+    assert_equal [ "slow", "medium" ], slowest.map {|entry| entry[2]}
+    assert slowest[0][3].key? :parse
+  end
+
+  def test_enabled
+    assert_true Latency.enabled?
+
+    ::OverSIP.configuration = { :core => {} }
+    Latency.module_init
+    assert_false Latency.enabled?
+
+    ::OverSIP.configuration = { :core => { :metrics_port => 9090 } }
+    Latency.module_init
+    assert_true Latency.enabled?
+  end
+
+end
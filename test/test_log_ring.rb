@@ -0,0 +1,30 @@
+require "oversip_test_helper"
+
+
+class TestLogRing < OverSIPTest
+
+  def setup
+    # Don't print the logs into stdout/stderr.
+    ::OverSIP::LogRing.start true
+  end
+
+  def test_log_and_flush
+    num_logged = ::OverSIP::LogRing.num_logged
+
+    assert_true ::OverSIP::LogRing.log(1, "TestLogRing", "message with %s and \x00 chars", false)
+    assert_true ::OverSIP::LogRing.log(4, "TestLogRing", "a" * 10000, true)
+    assert_true ::OverSIP::LogRing.flush
+
+    assert_equal num_logged + 2, ::OverSIP::LogRing.num_logged
+    assert_equal 0, ::OverSIP::LogRing.num_pending
+  end
+
+  def test_drop_when_full
+    num_dropped = ::OverSIP::LogRing.num_dropped
+    results = ( ::OverSIP::LogRing::SIZE * 4 ).times.map { ::OverSIP::LogRing.log(0, "TestLogRing", "flood", false) }
+    ::OverSIP::LogRing.flush
+
+    assert_equal num_dropped + results.count(false), ::OverSIP::LogRing.num_dropped
+  end
+
+end
@@ -0,0 +1,51 @@
+require "oversip_test_helper"
+
+
+class TestMetrics < OverSIPTest
+
+  def test_counter
+    id = ::OverSIP::Metrics.register :counter, "oversip_test_counter_total", "Test counter", %{transport="udp"}
+
+    3.times { ::OverSIP::Metrics.inc id }
+    ::OverSIP::Metrics.add id, 2
+
+    assert_equal 5, ::OverSIP::Metrics.get(id)
+    assert_match /^oversip_test_counter_total\{transport="udp"\} 5$/, ::OverSIP::Metrics.render
+    assert_match /^# TYPE oversip_test_counter_total counter$/, ::OverSIP::Metrics.render
+  end
+
+  def test_gauge
+    id = ::OverSIP::Metrics.register :gauge, "oversip_test_gauge", "Test gauge"
+
+    ::OverSIP::Metrics.set id, 10
+    ::OverSIP::Metrics.add id, -3
+
+    assert_equal 7, ::OverSIP::Metrics.get(id)
+    assert_match /^oversip_test_gauge 7$/, ::OverSIP::Metrics.render
+  end
+
+  def test_histogram
+    id = ::OverSIP::Metrics.register :histogram, "oversip_test_seconds", "Test histogram", %{stage="test"}, [ 0.01, 0.1, 1 ]
+
+    [ 0.005, 0.01, 0.5, 3 ].each {|value| ::OverSIP::Metrics.observe id, value}
+    render = ::OverSIP::Metrics.render
+
+    assert_equal 4, ::OverSIP::Metrics.get(id)
+    assert_match /^oversip_test_seconds_bucket\{stage="test",le="0.01"\} 2$/, render
+    assert_match /^oversip_test_seconds_bucket\{stage="test",le="0.1"\} 2$/, render
+    assert_match /^oversip_test_seconds_bucket\{stage="test",le="1"\} 3$/, render
+    assert_match /^oversip_test_seconds_bucket\{stage="test",le="\+Inf"\} 4$/, render
+    assert_match /^oversip_test_seconds_sum\{stage="test"\} 3.515$/, render
+    assert_match /^oversip_test_seconds_count\{stage="test"\} 4$/, render
+  end
+
+  def test_invalid
+    counter = ::OverSIP::Metrics.register :counter, "oversip_test_invalid_total", "Test"
+
+    assert_raise(::ArgumentError) { ::OverSIP::Metrics.register :gauge, "oversip_test_invalid_total", "Test" }
+    assert_raise(::ArgumentError) { ::OverSIP::Metrics.register :summary, "oversip_test_summary", "Test" }
+    assert_raise(::ArgumentError) { ::OverSIP::Metrics.observe counter, 1 }
+    assert_raise(::ArgumentError) { ::OverSIP::Metrics.inc 1000000 }
+  end
+
+end
@@ -0,0 +1,69 @@
+require "oversip_test_helper"
+
+
+class TestOverloadControl < OverSIPTest
+
+  OverloadControl = ::OverSIP::SIP::OverloadControl
+
+  class FakeRequest
+    attr_reader :sip_method, :replied
+
+    def initialize sip_method, initial=true
+      @sip_method = sip_method
+      @initial = initial
+    end
+
+    def initial?
+      @initial
+    end
+
+    def reply status_code, reason_phrase=nil, extra_headers=[], body=nil
+      @replied = [ status_code, extra_headers ]
+    end
+  end
+
+  def setup
+    ::OverSIP.configuration = { :sip => { :overload_max_lag => 100, :overload_retry_after => 10 } }
+    ::OverSIP.fiber_pool = ::OverSIP::FiberPool.new 1, 10
+    OverloadControl.module_init
+  end
+
+  def test_not_overloaded
+    request = FakeRequest.new :INVITE
+
+    assert_false OverloadControl.shed(request)
+    assert_nil request.replied
+  end
+
+  def test_full_reduction
+    OverloadControl.instance_variable_set :@reduction, 100
+
+    request = FakeRequest.new :INVITE
+    assert_true OverloadControl.shed(request)
+    assert_equal [ 503, [ "Retry-After: 10" ] ], request.replied
+
+    # In-dialog requests and ACK are always admitted.
+    assert_false OverloadControl.shed(FakeRequest.new(:BYE, false))
+    assert_false OverloadControl.shed(FakeRequest.new(:ACK))
+  end
+
+  def test_prioritized_shedding
+    OverloadControl.instance_variable_set :@reduction, 50
+
+    # Initial non-INVITE requests are shed with the double of the reduction.
+    20.times { assert_true OverloadControl.shed(FakeRequest.new(:REGISTER)) }
+
+    num_shed = 200.times.count { OverloadControl.shed FakeRequest.new(:INVITE) }
+    assert( num_shed > 50 && num_shed < 150 )
+  end
+
+  def test_oc_via
+    via = "SIP/2.0/UDP 1.2.3.4;branch=z9hG4bKabcd;oc;oc-algo=\"loss,A\";received=5.6.7.8"
+
+    assert_match /\ASIP\/2.0\/UDP 1.2.3.4;branch=z9hG4bKabcd;received=5.6.7.8;oc=0;oc-algo="loss";oc-validity=0;oc-seq=\d+\.\d{3}\z/, OverloadControl.oc_via(via)
+
+    OverloadControl.instance_variable_set :@reduction, 20
+    assert_match /;received=5.6.7.8;oc=20;oc-algo="loss";oc-validity=5000;oc-seq=/, OverloadControl.oc_via(via)
+  end
+
+end
@@ -0,0 +1,114 @@
+require "oversip_test_helper"
+
+
+class TestPermessageDeflate < OverSIPTest
+
+  PermessageDeflate = ::OverSIP::WebSocket::PermessageDeflate
+
+  MESSAGE = "REGISTER sip:example.net SIP/2.0\r\nVia: SIP/2.0/WSS df7jal23ls0d.invalid;branch=z9hG4bK56sdasks\r\nFrom: <sip:alice@example.net>;tag=5678\r\nTo: <sip:alice@example.net>\r\nCall-ID: permessage-deflate\r\nCSeq: 1 REGISTER\r\nContent-Length: 0\r\n\r\n"
+
+  def setup
+    ::OverSIP.configuration = { :websocket => {
+      :permessage_deflate => true,
+      :permessage_deflate_window_bits => 12,
+      :permessage_deflate_mem_level => 5,
+      :permessage_deflate_context_takeover => true,
+      :max_ws_message_size => 65536
+    } }
+    PermessageDeflate.class_init
+  end
+
+  def negotiate offer
+    extension, response = PermessageDeflate.negotiate [ offer ]
+    def extension.log_system_notice msg ; end
+    [ extension, response ]
+  end
+  private :negotiate
+
+  # Compresses as a client would do (RFC 7692 7.2.1).
+  def client_deflate deflater, message
+    compressed = deflater.deflate(message, ::Zlib::SYNC_FLUSH)
+    compressed.slice!(-4, 4)
+    compressed
+  end
+  private :client_deflate
+
+  def client_inflate inflater, payload
+    inflater.inflate(payload + PermessageDeflate::MESSAGE_TAIL)
+  end
+  private :client_inflate
+
+  def test_negotiate
+    extension, response = negotiate "permessage-deflate; client_max_window_bits"
+    assert_kind_of PermessageDeflate, extension
+    assert_equal "permessage-deflate; client_max_window_bits=12", response
+
+    assert_nil PermessageDeflate.negotiate([ "permessage-deflate; foo" ])
+    assert_nil PermessageDeflate.negotiate([ "permessage-deflate; server_max_window_bits=8" ])
+  end
+
+  def test_round_trip
+    extension, _ = negotiate "permessage-deflate; client_max_window_bits"
+    deflater = ::Zlib::Deflate.new(::Zlib::DEFAULT_COMPRESSION, -12)
+    inflater = ::Zlib::Inflate.new(-12)
+
+    3.times do
+      assert_equal MESSAGE, extension.inflate(client_deflate(deflater, MESSAGE), true)
+      assert_equal MESSAGE, client_inflate(inflater, extension.deflate(MESSAGE))
+    end
+  end
+
+  def test_context_takeover
+    extension, response = negotiate "permessage-deflate"
+    assert_equal "permessage-deflate", response
+    inflater = ::Zlib::Inflate.new(-15)
+
+    first = extension.deflate MESSAGE
+    second = extension.deflate MESSAGE
+    # The second message refers to the first one.
+    assert second.bytesize < first.bytesize
+    assert_equal MESSAGE, client_inflate(inflater, first)
+    assert_equal MESSAGE, client_inflate(inflater, second)
+  end
+
+  def test_no_context_takeover
+    extension, response = negotiate "permessage-deflate; server_no_context_takeover; client_no_context_takeover"
+    assert_equal "permessage-deflate; server_no_context_takeover; client_no_context_takeover", response
+
+    first = extension.deflate MESSAGE
+    second = extension.deflate MESSAGE
+    assert_equal first, second
+    # Every message can be inflated alone.
+    assert_equal MESSAGE, client_inflate(::Zlib::Inflate.new(-15), second)
+    assert_nil extension.instance_variable_get(:@deflater)
+
+    deflater = ::Zlib::Deflate.new(::Zlib::DEFAULT_COMPRESSION, -15)
+    assert_equal MESSAGE, extension.inflate(client_deflate(deflater, MESSAGE), true)
+    assert_nil extension.instance_variable_get(:@inflater)
+  end
+
+  def test_fragmented_message
+    extension, _ = negotiate "permessage-deflate"
+    deflater = ::Zlib::Deflate.new(::Zlib::DEFAULT_COMPRESSION, -15)
+    compressed = client_deflate deflater, MESSAGE * 20
+    half = compressed.bytesize / 2
+
+    inflated = extension.inflate(compressed.byteslice(0, half), false)
+    inflated << extension.inflate(compressed.byteslice(half, compressed.bytesize), true)
+    assert_equal MESSAGE * 20, inflated
+  end
+
+  def test_max_message_size
+    extension, _ = negotiate "permessage-deflate"
+    deflater = ::Zlib::Deflate.new(::Zlib::DEFAULT_COMPRESSION, -15)
+
+    assert_nil extension.inflate(client_deflate(deflater, "a" * 70000), true)
+  end
+
+  def test_invalid_data
+    extension, _ = negotiate "permessage-deflate"
+
+    assert_false extension.inflate("\xff\xff\xff\xff".force_encoding(::Encoding::BINARY), true)
+  end
+
+end
@@ -0,0 +1,81 @@
+require "oversip_test_helper"
+
+
+class TestReactorProbe < OverSIPTest
+
+  def count category
+    ::OverSIP::Metrics.render[/^oversip_reactor_callback_seconds_count\{category="#{category}"\} (\d+)$/, 1].to_i
+  end
+  private :count
+
+  def test_callback_categories
+    timer = count :timer
+    receive_data = count :receive_data
+
+    ::OverSIP::ReactorProbe.callback(:timer, nil) { }
+    ::OverSIP::ReactorProbe.callback(:receive_data, nil) { }
+
+    assert_equal timer + 1, count(:timer)
+    assert_equal receive_data + 1, count(:receive_data)
+  end
+
+  def test_callback_exception
+    user = count :user
+
+    assert_raise(::RuntimeError) { ::OverSIP::ReactorProbe.user { raise "error" } }
+    assert_equal user + 1, count(:user)
+  end
+
+  def test_callback_result
+    assert_equal :done, ::OverSIP::ReactorProbe.callback(:timer, nil) { :done }
+  end
+
+  def test_timers_and_next_ticks
+    timer = count :timer
+    next_tick = count :next_tick
+    fired = []
+
+    ::EM.run do
+      ::EM.add_timer(0.001) { fired << :timer }
+      periodic = ::EM::PeriodicTimer.new(0.001) do
+        fired << :periodic
+        if fired.count(:periodic) == 2
+          periodic.cancel
+          ::EM.next_tick { fired << :next_tick ; ::EM.stop }
+        end
+      end
+    end
+
+    assert_equal [ :next_tick, :periodic, :periodic, :timer ], fired.sort
+    assert_equal timer + 3, count(:timer)
+    assert_equal next_tick + 1, count(:next_tick)
+  end
+
+  def test_listener_receive_data
+    receive_data = count :receive_data
+    conn = ::OverSIP::SIP::IPv4UdpServer.allocate
+    conn.send :initialize
+
+    # A CRLF keep-alive goes through the whole UDP processing.
+    conn.receive_data "\r\n"
+    assert_equal receive_data + 1, count(:receive_data)
+  end
+
+  def test_slow_callback_log
+    ::OverSIP.configuration = { :core => { :slow_callback_threshold => 1 } }
+    ::OverSIP::ReactorProbe.module_init
+    warnings = []
+    ::OverSIP::ReactorProbe.define_singleton_method(:log_system_warn) {|msg| warnings << msg}
+
+    ::OverSIP::ReactorProbe.callback(:next_tick, proc { }) { sleep 0.002 }
+    ::OverSIP::ReactorProbe.callback(:next_tick, proc { }) { }
+
+    assert_equal 1, warnings.size
+    assert_match(/\Aslow reactor callback \(next_tick\): block at #{::Regexp.escape __FILE__}:\d+ took /, warnings[0])
+  ensure
+    ::OverSIP::ReactorProbe.singleton_class.send :remove_method, :log_system_warn  rescue nil
+    ::OverSIP.configuration = { :core => {} }
+    ::OverSIP::ReactorProbe.module_init
+  end
+
+end
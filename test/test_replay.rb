@@ -0,0 +1,157 @@
+require "oversip_test_helper"
+require "ipaddr"
+require "oversip/capture_reader"
+require "oversip/replay"
+
+
+class TestReplay < OverSIPTest
+
+  Replay = ::OverSIP::Replay
+
+  OPTIONS = "OPTIONS sip:oversip.net SIP/2.0\r\nCall-ID: replay\r\nCSeq: 1 OPTIONS\r\n\r\n"
+
+  def ipv4_udp src_ip, src_port, dst_ip, dst_port, payload
+    udp = [ src_port, dst_port, 8 + payload.bytesize, 0 ].pack("n4") + payload
+    ip = [ 0x45, 0, 20 + udp.bytesize, 0, 0, 64, 17, 0 ].pack("CCnnnCCn") +
+         ::IPAddr.new(src_ip).hton + ::IPAddr.new(dst_ip).hton
+    ip + udp
+  end
+  private :ipv4_udp
+
+  def ipv6_tcp src_ip, src_port, dst_ip, dst_port, seq, payload
+    tcp = [ src_port, dst_port, seq, 0, 0x50, 0x18, 65535, 0, 0 ].pack("nnNNCCnnn") + payload
+    ip = [ 0x60000000, tcp.bytesize, 6, 64 ].pack("NnCC") + ::IPAddr.new(src_ip).hton + ::IPAddr.new(dst_ip).hton
+    ip + tcp
+  end
+  private :ipv6_tcp
+
+  # pcap file (microseconds, Ethernet) with the given [ time, IP packet ] frames.
+  def pcap frames
+    data = [ 0xa1b2c3d4, 2, 4, 0, 0, 65535, 1 ].pack("VvvVVVV")
+    frames.each do |time, packet|
+      frame = "\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x08\x00".b + packet
+      data << [ time.to_i, ( ( time - time.to_i ) * 1e6 ).round, frame.bytesize, frame.bytesize ].pack("V4") << frame
+    end
+    data
+  end
+  private :pcap
+
+  def pcapng_block type, body
+    body += "\x00".b * ( -body.bytesize % 4 )
+    [ type, body.bytesize + 12 ].pack("V2") + body + [ body.bytesize + 12 ].pack("V")
+  end
+  private :pcapng_block
+
+  # pcapng file (nanoseconds, raw IP) with the given [ time, IP packet ] frames.
+  def pcapng frames
+    data = pcapng_block(0x0a0d0d0a, [ 0x1a2b3c4d, 1, 0, -1 ].pack("VvvQ<"))
+    # if_tsresol = 9 option.
+    data << pcapng_block(0x00000001, [ 101, 0, 65535, 9, 1, 9, 0, 0 ].pack("vvVvvCx3vv"))
+    frames.each do |time, packet|
+      ts = ( time * 1e9 ).round
+      data << pcapng_block(0x00000006, [ 0, ts >> 32, ts & 0xffffffff, packet.bytesize, packet.bytesize ].pack("V5") + packet)
+    end
+    data
+  end
+  private :pcapng
+
+  def read data
+    file = ::Tempfile.new "oversip_replay"
+    file.binmode
+    file.write data
+    file.close
+    Replay::TraceReader.read file.path
+  ensure
+    file.close!
+  end
+  private :read
+
+  def test_read_pcap
+    packets = read pcap([
+      [ 10.25, ipv4_udp("10.0.0.1", 5060, "10.0.0.2", 5070, OPTIONS) ],
+      # Packets without payload are ignored.
+      [ 10.5, ipv4_udp("10.0.0.2", 5070, "10.0.0.1", 5060, "") ],
+      [ 11.0, ipv4_udp("10.0.0.2", 5070, "10.0.0.1", 5060, "SIP/2.0 200 OK\r\n\r\n") ]
+    ])
+
+    assert_equal 2, packets.size
+    assert_in_delta 10.25, packets[0].time, 1e-6
+    assert_equal [ :udp, "10.0.0.1", 5060, "10.0.0.2", 5070, OPTIONS ],
+                 [ packets[0].protocol, packets[0].src_ip, packets[0].src_port, packets[0].dst_ip, packets[0].dst_port, packets[0].payload ]
+    assert_equal "SIP/2.0 200 OK\r\n\r\n", packets[1].payload
+  end
+
+  def test_read_pcapng
+    packets = read pcapng([
+      [ 1.000000001, ipv6_tcp("2001:db8::1", 40000, "2001:db8::2", 5060, 1000, OPTIONS) ]
+    ])
+
+    assert_equal 1, packets.size
+    packet = packets[0]
+    assert_in_delta 1.000000001, packet.time, 1e-9
+    assert_equal [ :tcp, "2001:db8::1", 40000, "2001:db8::2", 5060, 1000, OPTIONS ],
+                 [ packet.protocol, packet.src_ip, packet.src_port, packet.dst_ip, packet.dst_port, packet.seq, packet.payload ]
+  end
+
+  def test_read_truncated_pcap
+    data = pcap([ [ 1.0, ipv4_udp("10.0.0.1", 5060, "10.0.0.2", 5060, OPTIONS) ] ] * 2)
+
+    assert_equal 1, read(data.byteslice(0, data.bytesize - 10)).size
+  end
+
+  def test_timers_in_virtual_time
+    reactor = Replay::Reactor.new
+    fired = []
+
+    reactor.add_timer 2, proc { fired << [ :b, reactor.now ] ; reactor.next_tick proc { fired << [ :tick, reactor.now ] } }
+    reactor.add_timer 1, proc { fired << [ :a, reactor.now ] ; reactor.add_timer 0.5, proc { fired << [ :c, reactor.now ] } }
+    cancelled = reactor.add_timer 1.2, proc { fired << [ :cancelled, reactor.now ] }
+    reactor.add_timer 10, proc { fired << [ :late, reactor.now ] }
+    reactor.cancel_timer cancelled
+
+    reactor.advance_to 5
+    assert_equal [ [ :a, 1.0 ], [ :c, 1.5 ], [ :b, 2.0 ], [ :tick, 2.0 ] ], fired
+    assert_equal 5.0, reactor.now
+    assert_equal 3, reactor.num_timers_fired
+
+    # The clock never goes back.
+    reactor.advance_to 4
+    assert_equal 5.0, reactor.now
+  end
+
+  def test_reactor_errors
+    reactor = Replay::Reactor.new
+    def Replay.log_system_error msg ; end
+    fired = []
+
+    reactor.add_timer 1, proc { raise "error" }
+    reactor.add_timer 1, proc { fired << :next }
+    reactor.advance_to 1
+
+    assert_equal [ :next ], fired
+    assert_equal 1, reactor.num_errors
+  ensure
+    Replay.singleton_class.send :remove_method, :log_system_error  rescue nil
+  end
+
+  def test_tcp_retransmissions
+    Replay.instance_variable_set :@tcp_next_seq, {}
+    new_data = lambda do |seq, payload, src_port=40000|
+      Replay.send :tcp_new_data, Replay::Packet.new(0.0, :tcp, "10.0.0.1", src_port, "10.0.0.2", 5060, payload, seq)
+    end
+
+    assert_equal "abcd", new_data.call(1000, "abcd")
+    # Full retransmission.
+    assert_nil new_data.call(1000, "abcd")
+    # Retransmission overlapping new data.
+    assert_equal "ef", new_data.call(1002, "cdef")
+    assert_equal "gh", new_data.call(1006, "gh")
+    # Sequence number wrap (other flow).
+    assert_equal "wxyz", new_data.call(0xfffffffe, "wxyz", 40001)
+    assert_equal "!", new_data.call(1, "z!", 40001)
+    assert_equal "ij", new_data.call(1008, "ij")
+    # UDP packets are not modified.
+    assert_equal "abcd", Replay.send(:tcp_new_data, Replay::Packet.new(0.0, :udp, "10.0.0.1", 5060, "10.0.0.2", 5060, "abcd"))
+  end
+
+end
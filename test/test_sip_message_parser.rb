@@ -165,4 +165,34 @@ END
     assert_equal "sips:i%C3%B1aki@aliax.net:7070", msg.ruri.to_s
   end
 
+
+  def test_build_reply
+    parser, msg = parse <<-END
+OPTIONS sip:alice@example.net SIP/2.0\r
+Via: SIP/2.0/UDP 1.2.3.4:5060;branch=z9hG4bK111;rport\r
+v: SIP/2.0/TCP 10.0.0.1;branch=z9hG4bK222\r
+From: "Bob" <sip:bob@example.net>;tag=1234\r
+To: <sip:alice@example.net>\r
+i: build-reply\r
+CSeq: 10 OPTIONS\r
+Content-Length: 0\r
+\r
+    END
+
+    assert_equal "SIP/2.0 100 Trying\r\nVia: SIP/2.0/UDP 1.2.3.4:5060;branch=z9hG4bK111;rport\r\nVia: SIP/2.0/TCP 10.0.0.1;branch=z9hG4bK222\r\nFrom: \"Bob\" <sip:bob@example.net>;tag=1234\r\nTo: <sip:alice@example.net>\r\nCall-ID: build-reply\r\nCSeq: 10 OPTIONS\r\nContent-Length: 0\r\n#{::OverSIP::SIP::HDR_SERVER}\r\n\r\n",
+                 msg.send(:build_reply, 100, nil, nil, [], nil)
+
+    msg.instance_variable_set :@internal_to_tag, "abcd"
+    assert_equal "SIP/2.0 200 Ñice\r\nVia: SIP/2.0/UDP 1.2.3.4:5060;branch=z9hG4bK111;rport;oc=20\r\nVia: SIP/2.0/TCP 10.0.0.1;branch=z9hG4bK222\r\nFrom: \"Bob\" <sip:bob@example.net>;tag=1234\r\nTo: <sip:alice@example.net>;tag=abcd\r\nCall-ID: build-reply\r\nCSeq: 10 OPTIONS\r\nContent-Length: 4\r\nAccept: text/plain\r\nAllow: OPTIONS\r\n#{::OverSIP::SIP::HDR_SERVER}\r\n\r\nábc",
+                 msg.send(:build_reply, 200, "Ñice", "SIP/2.0/UDP 1.2.3.4:5060;branch=z9hG4bK111;rport;oc=20", [ "Accept: text/plain", :"Allow: OPTIONS" ], "ábc")
+
+    assert_equal "SIP/2.0 299 Reason Phrase Not Set\r\n", msg.send(:build_reply, 299, nil, nil, nil, nil).lines.first
+
+    # Any Enumerable of extra headers.
+    [ [ "Accept: text/plain" ].each, [ "Accept: text/plain" ].lazy ].each do |extra_headers|
+      assert_match(/\r\nAccept: text\/plain\r\n/, msg.send(:build_reply, 200, nil, nil, extra_headers, nil))
+    end
+    assert_raise(::TypeError) { msg.send(:build_reply, 200, nil, nil, 1234, nil) }
+  end
+
 end
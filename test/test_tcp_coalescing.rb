@@ -0,0 +1,124 @@
+# coding: utf-8
+
+require "oversip_test_helper"
+
+
+class TestTcpCoalescing < OverSIPTest
+
+  TcpConnection = ::OverSIP::SIP::TcpConnection
+
+  # Replaces EM.next_tick (ticks are run by the test) and EM.close_connection.
+  def setup
+    @ticks = ticks = []
+    @closed = closed = []
+    @em_methods = [ :next_tick, :close_connection ].map {|method| [ method, ::EM.method(method) ]}
+    ::EM.define_singleton_method(:next_tick) {|&block| ticks << block}
+    ::EM.define_singleton_method(:close_connection) {|signature, after_writing| closed << after_writing}
+  end
+
+  def teardown
+    @em_methods.each {|method, original| ::EM.define_singleton_method method, original}
+  end
+
+  # Server connection recording the written data.
+  def connection
+    conn = ::OverSIP::SIP::IPv4TcpServer.allocate
+    conn.instance_variable_set :@writes, []
+    def conn.writes ; @writes ; end
+    def conn.send_data data ; @writes << data ; end
+    def conn.error? ; @error ; end
+    def conn.error= error ; @error = error ; end
+    conn
+  end
+  private :connection
+
+  def run_ticks
+    ticks = @ticks.dup
+    @ticks.clear
+    ticks.each {|block| block.call}
+  end
+  private :run_ticks
+
+  def test_single_message
+    conn = connection
+    msg = "OPTIONS sip:a@b SIP/2.0\r\n\r\n"
+
+    assert_true conn.send_sip_msg(msg)
+    # Written at the end of the tick.
+    assert_empty conn.writes
+    run_ticks
+    assert_equal [ msg ], conn.writes
+  end
+
+  def test_messages_in_a_tick_become_one_write
+    conn = connection
+    messages = [ "SIP/2.0 100 Trying\r\n\r\n", "SIP/2.0 180 Ringing\r\n\r\n", "SIP/2.0 200 OK\r\n\r\n" ]
+    num_writes = TcpConnection.num_writes
+    num_messages = TcpConnection.num_written_messages
+
+    messages.each {|msg| conn.send_sip_msg msg}
+    assert_equal 1, @ticks.size
+    run_ticks
+
+    assert_equal [ messages.join ], conn.writes
+    assert_equal num_writes + 1, TcpConnection.num_writes
+    assert_equal num_messages + 3, TcpConnection.num_written_messages
+
+    # The next tick starts a new write.
+    conn.send_sip_msg messages[0]
+    run_ticks
+    assert_equal [ messages.join, messages[0] ], conn.writes
+  end
+
+  def test_encoding_mix
+    conn = connection
+    messages = [
+      "MESSAGE sip:ñ@b SIP/2.0\r\n\r\nñ",
+      "MESSAGE sip:a@b SIP/2.0\r\n\r\n\xff\xfe".force_encoding(::Encoding::BINARY),
+      "MESSAGE sip:ü@b SIP/2.0\r\n\r\nü"
+    ]
+
+    messages.each {|msg| conn.send_sip_msg msg}
+    run_ticks
+
+    assert_equal 1, conn.writes.size
+    assert_equal messages.map {|msg| msg.b}.join, conn.writes[0].b
+    # Queued messages are not modified.
+    assert_equal ::Encoding::UTF_8, messages[0].encoding
+  end
+
+  def test_close_after_writing_flushes
+    conn = connection
+    conn.send_sip_msg "SIP/2.0 200 OK\r\n\r\n"
+
+    conn.close_connection true
+    assert_equal [ "SIP/2.0 200 OK\r\n\r\n" ], conn.writes
+    assert_equal [ true ], @closed
+
+    # Nothing written twice.
+    run_ticks
+    assert_equal 1, conn.writes.size
+  end
+
+  def test_close_drops_queued_data
+    conn = connection
+    conn.send_sip_msg "SIP/2.0 200 OK\r\n\r\n"
+
+    conn.close_connection false
+    run_ticks
+    assert_empty conn.writes
+    assert_equal [ false ], @closed
+  end
+
+  def test_closed_connection
+    conn = connection
+    conn.send_sip_msg "SIP/2.0 200 OK\r\n\r\n"
+    conn.error = true
+    run_ticks
+    assert_empty conn.writes
+
+    def conn.log_system_notice msg ; end
+    assert_false conn.send_sip_msg("SIP/2.0 200 OK\r\n\r\n")
+  end
+
+end
@@ -0,0 +1,77 @@
+require "oversip_test_helper"
+
+
+class TestTls < OverSIPTest
+
+  def create_cert subject, issuer_cert=nil, issuer_key=nil, subject_alt_name=nil
+    key = ::OpenSSL::PKey::RSA.new 1024
+    cert = ::OpenSSL::X509::Certificate.new
+    cert.version = 2
+    cert.serial = rand(1 << 30)
+    cert.subject = ::OpenSSL::X509::Name.parse subject
+    cert.issuer = issuer_cert ? issuer_cert.subject : cert.subject
+    cert.public_key = key.public_key
+    cert.not_before = ::Time.now - 60
+    cert.not_after = ::Time.now + 86400
+
+    ef = ::OpenSSL::X509::ExtensionFactory.new
+    ef.subject_certificate = cert
+    ef.issuer_certificate = issuer_cert || cert
+    cert.add_extension ef.create_extension("basicConstraints", issuer_cert ? "CA:FALSE" : "CA:TRUE", true)
+    cert.add_extension ef.create_extension("subjectAltName", subject_alt_name)  if subject_alt_name
+    cert.sign issuer_key || key, ::OpenSSL::Digest::SHA256.new
+
+    return cert, key
+  end
+  private :create_cert
+
+  def setup
+    @ca_cert, @ca_key = create_cert "/CN=ca.oversip.test"
+    store = ::OpenSSL::X509::Store.new
+    store.add_cert @ca_cert
+    ::OverSIP::TLS.instance_variable_set :@store, store
+    ::OverSIP::TLS.clear_validation_cache
+  end
+
+  def teardown
+    ::OverSIP::TLS.instance_variable_set :@store, nil
+    ::OverSIP::TLS.clear_validation_cache
+  end
+
+  def test_validate_cached
+    cert, _ = create_cert "/CN=pbx.oversip.test", @ca_cert, @ca_key, "DNS:PBX.oversip.test, URI:sip:oversip.test"
+    hits = ::OverSIP::TLS.num_validation_cache_hits
+
+    cert1, validated1 = ::OverSIP::TLS.validate [ cert.to_pem ]
+    cert2, validated2 = ::OverSIP::TLS.validate [ cert.to_pem ]
+
+    assert_true validated1
+    assert_true validated2
+    assert_equal hits + 1, ::OverSIP::TLS.num_validation_cache_hits
+    assert cert1.equal?(cert2)
+    assert_equal [ "oversip.test" ], ::OverSIP::TLS.get_sip_identities(cert2)
+    assert_equal [ "oversip.test" ], ::OverSIP::TLS.get_sip_identities(cert2)
+  end
+
+  def test_validate_error_cached
+    other_ca_cert, other_ca_key = create_cert "/CN=other-ca.oversip.test"
+    cert, _ = create_cert "/CN=pbx.oversip.test", other_ca_cert, other_ca_key
+
+    result1 = ::OverSIP::TLS.validate [ cert.to_pem ]
+    result2 = ::OverSIP::TLS.validate [ cert.to_pem ]
+
+    assert_false result1[1]
+    assert_equal result1[1..3], result2[1..3]
+    assert_kind_of ::Integer, result2[2]
+
+    # The CA is added later, the error is cached just for a while.
+    ::OverSIP::TLS.instance_variable_get(:@store).add_cert other_ca_cert
+    assert_false ::OverSIP::TLS.validate([ cert.to_pem ])[1]
+    ::OverSIP::TLS.instance_variable_get(:@validation_cache).each_value do |entry|
+      assert_operator entry.expires, :<=, ::Time.now + ::OverSIP::TLS::VALIDATION_CACHE_ERROR_TTL
+      entry.expires -= ::OverSIP::TLS::VALIDATION_CACHE_ERROR_TTL
+    end
+    assert_true ::OverSIP::TLS.validate([ cert.to_pem ])[1]
+  end
+
+end
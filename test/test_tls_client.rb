@@ -0,0 +1,97 @@
+require "oversip_test_helper"
+
+
+class TestTlsClient < OverSIPTest
+
+  class FakeTransaction
+    attr_reader :events
+
+    def initialize
+      @events = []
+    end
+
+    def connection_failed
+      @events << :connection_failed
+    end
+
+    def tls_validation_failed
+      @events << :tls_validation_failed
+    end
+  end
+
+  def setup
+    @fiber_pool = ::OverSIP.fiber_pool
+    @on_server_tls_handshake = ::OverSIP::SipEvents.method(:on_server_tls_handshake)
+  end
+
+  def teardown
+    ::OverSIP.fiber_pool = @fiber_pool
+    ::OverSIP::SipEvents.define_singleton_method :on_server_tls_handshake, @on_server_tls_handshake
+  end
+
+  # TLS client connection with a pending message and a pending transaction,
+  # recording the written data.
+  def client callback
+    conn = ::OverSIP::SIP::IPv4TlsClient.allocate
+    conn.instance_variable_set :@pending_messages, [ "OPTIONS sip:a@b SIP/2.0\r\n\r\n" ]
+    conn.instance_variable_set :@pending_client_transactions, [ FakeTransaction.new ]
+    conn.instance_variable_set :@server_pems, []
+    conn.callback_on_server_tls_handshake = callback
+    conn.instance_variable_set :@writes, []
+    def conn.writes ; @writes ; end
+    def conn.send_coalesced_data data ; @writes << data ; end
+    def conn.close_connection after_writing=false ; @local_closed = true ; end
+    def conn.error? ; false ; end
+    def conn.reset_idle_deadline ; end
+    def conn.start_crlf_keepalive ; end
+    def conn.log_system_notice msg ; end
+    def conn.log_system_error msg ; end
+    conn
+  end
+  private :client
+
+  def test_without_callback
+    ::OverSIP.fiber_pool = nil
+    conn = client false
+    transaction = conn.pending_client_transactions[0]
+
+    # No fiber needed.
+    conn.ssl_handshake_completed
+    assert_equal [ "OPTIONS sip:a@b SIP/2.0\r\n\r\n" ], conn.writes
+    assert_empty conn.pending_client_transactions
+    assert_empty transaction.events
+  end
+
+  def test_callback_accepts
+    ::OverSIP.fiber_pool = ::OverSIP::FiberPool.new 1
+    ::OverSIP::SipEvents.define_singleton_method(:on_server_tls_handshake) {|connection, pems| }
+    conn = client true
+
+    conn.ssl_handshake_completed
+    assert_equal [ "OPTIONS sip:a@b SIP/2.0\r\n\r\n" ], conn.writes
+  end
+
+  def test_callback_closes
+    ::OverSIP.fiber_pool = ::OverSIP::FiberPool.new 1
+    ::OverSIP::SipEvents.define_singleton_method(:on_server_tls_handshake) {|connection, pems| connection.close_connection}
+    conn = client true
+    transaction = conn.pending_client_transactions[0]
+
+    conn.ssl_handshake_completed
+    assert_empty conn.writes
+    assert_equal [ :tls_validation_failed ], transaction.events
+  end
+
+  def test_fiber_pool_full
+    ::OverSIP.fiber_pool = ::OverSIP::FiberPool.new 1, 1
+    2.times { ::OverSIP.fiber_pool.spawn { ::Fiber.yield } }
+    conn = client true
+    transaction = conn.pending_client_transactions[0]
+
+    conn.ssl_handshake_completed
+    assert_empty conn.writes
+    assert_equal [ :connection_failed ], transaction.events
+    assert_true conn.instance_variable_get(:@local_closed)
+  end
+
+end
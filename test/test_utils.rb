@@ -0,0 +1,21 @@
+require "oversip_test_helper"
+
+
+class TestUtils < OverSIPTest
+
+  def test_connection_key
+    assert_equal [ 1, 2, 3, 4, 5060 ].pack("C4n"), ::OverSIP::Utils.connection_key("1.2.3.4", 5060)
+    assert_equal 18, ::OverSIP::Utils.connection_key("2001:db8::1", 5061).bytesize
+    assert_true ::OverSIP::Utils.connection_key("1.2.3.4", 5060).frozen?
+    assert_nil ::OverSIP::Utils.connection_key("oversip.net", 5060)
+  end
+
+  def test_connection_key_ipv6_forms
+    key = ::OverSIP::Utils.connection_key "2001:db8::1", 5060
+
+    assert_equal key, ::OverSIP::Utils.connection_key("2001:0DB8:0:0::0001", 5060)
+    assert_equal key, ::OverSIP::Utils.connection_key("[2001:db8::1]", 5060)
+    assert_not_equal key, ::OverSIP::Utils.connection_key("2001:db8::1", 5061)
+  end
+
+end
@@ -0,0 +1,105 @@
+# coding: utf-8
+
+require "oversip_test_helper"
+
+
+class TestWsFramingUtils < OverSIPTest
+
+  MASK = [ 0x37, 0xfa, 0x21, 0x3d ].pack("C*")
+
+  def unmask_ruby payload, mask
+    unmasked = "".encode ::Encoding::BINARY
+    payload.each_byte.with_index {|b, i| unmasked << (b ^ mask.getbyte(i % 4)) }
+    unmasked
+  end
+  private :unmask_ruby
+
+  def test_unmask
+    [ 0, 1, 3, 4, 7, 8, 15, 16, 17, 31, 32, 33, 63, 64, 65, 125, 1000, 65536 ].each do |len|
+      payload = ::SecureRandom.random_bytes len
+      assert_equal unmask_ruby(payload, MASK), ::OverSIP::WebSocket::FramingUtils.unmask(payload, MASK), "payload length #{len}"
+    end
+  end
+
+  def test_unmask_unaligned
+    payload = ::SecureRandom.random_bytes 300
+    (0..15).each do |offset|
+      slice = payload[offset..-1]
+      assert_equal unmask_ruby(slice, MASK), ::OverSIP::WebSocket::FramingUtils.unmask(slice, MASK), "offset #{offset}"
+    end
+  end
+
+  def test_unmask_in_place
+    payload = ::SecureRandom.random_bytes 1001
+    expected = unmask_ruby payload, MASK
+    result = ::OverSIP::WebSocket::FramingUtils.unmask! payload, MASK
+    assert_equal expected, payload
+    assert_same payload, result
+  end
+
+  def test_utf8_validator_validate
+    validator = ::OverSIP::WebSocket::FramingUtils::Utf8Validator.allocate
+
+    assert_true validator.validate(("INVITE sip:alice@example.org SIP/2.0\r\n" * 10).force_encoding(::Encoding::BINARY))
+    validator.reset
+    assert_true validator.validate(("ñaña €uro " * 20 + "asciitail").force_encoding(::Encoding::BINARY))
+    validator.reset
+    assert_nil validator.validate(("a" * 40 + "€")[0..-2].force_encoding(::Encoding::BINARY))
+    validator.reset
+    assert_false validator.validate(("a" * 40 + "\xff" + "a" * 40).force_encoding(::Encoding::BINARY))
+  end
+
+  def test_utf8_validator_unmask_and_validate
+    validator = ::OverSIP::WebSocket::FramingUtils::Utf8Validator.allocate
+
+    [ "REGISTER sip:example.org SIP/2.0\r\n" * 5, "ñ" * 33, "a" * 29 + "€" + "b" * 70 ].each do |text|
+      text = text.force_encoding ::Encoding::BINARY
+      payload = ::OverSIP::WebSocket::FramingUtils.unmask text, MASK
+      validator.reset
+      assert_true validator.unmask_and_validate!(payload, MASK)
+      assert_equal text, payload
+    end
+
+    validator.reset
+    payload = ::OverSIP::WebSocket::FramingUtils.unmask(("a" * 50 + "\xc0\xaf").force_encoding(::Encoding::BINARY), MASK)
+    assert_false validator.unmask_and_validate!(payload, MASK)
+  end
+
+  def test_utf8_validator_unmask_and_validate_fragmented
+    validator = ::OverSIP::WebSocket::FramingUtils::Utf8Validator.allocate
+    text = ("a" * 31 + "€" + "a" * 40).force_encoding ::Encoding::BINARY
+
+    # Split the message in the middle of the "€" multibyte character.
+    fragment1 = ::OverSIP::WebSocket::FramingUtils.unmask text[0, 32], MASK
+    fragment2 = ::OverSIP::WebSocket::FramingUtils.unmask text[32..-1], MASK
+
+    validator.reset
+    assert_nil validator.unmask_and_validate!(fragment1, MASK)
+    assert_true validator.unmask_and_validate!(fragment2, MASK)
+    assert_equal text, fragment1 + fragment2
+  end
+
+  def test_frame_header
+    assert_equal [ 129, 0 ].pack("C*"), ::OverSIP::WebSocket::FramingUtils.frame_header(129, 0)
+    assert_equal [ 129, 125 ].pack("C*"), ::OverSIP::WebSocket::FramingUtils.frame_header(129, 125)
+    assert_equal [ 130, 126, 126 ].pack("CCn"), ::OverSIP::WebSocket::FramingUtils.frame_header(130, 126)
+    assert_equal [ 130, 126, 65535 ].pack("CCn"), ::OverSIP::WebSocket::FramingUtils.frame_header(130, 65535)
+    assert_equal [ 193, 127, 0, 65536 ].pack("CCNN"), ::OverSIP::WebSocket::FramingUtils.frame_header(193, 65536)
+    assert_equal [ 129, 127, 1, 5 ].pack("CCNN"), ::OverSIP::WebSocket::FramingUtils.frame_header(129, 2**32 + 5)
+  end
+
+  def test_frame
+    assert_equal [ 137, 0 ].pack("C*"), ::OverSIP::WebSocket::FramingUtils.frame(137, nil)
+
+    message = "OPTIONS sip:example.org SIP/2.0\r\n" * 10
+    frame = ::OverSIP::WebSocket::FramingUtils.frame(129, message)
+    assert_equal ::OverSIP::WebSocket::FramingUtils.frame_header(129, message.bytesize) + message.b, frame
+    assert_equal 4 + message.bytesize, frame.bytesize
+  end
+
+  def test_unmask_twice_returns_original
+    payload = ::SecureRandom.random_bytes 517
+    assert_equal payload, ::OverSIP::WebSocket::FramingUtils.unmask(::OverSIP::WebSocket::FramingUtils.unmask(payload, MASK), MASK)
+  end
+
+end